@@ -57,9 +57,22 @@ SOFTWARE.
 #include <string.h>
 
 #define Bool int
-#define Xmalloc malloc
-#define Xfree free
-#define Xrealloc realloc
+#define Xmalloc rfbRegionAlloc
+#define Xfree rfbRegionFree
+#define Xrealloc rfbRegionRealloc
+
+// - rfb::Region supplies these, so that it can keep the rectangles of
+//   temporary regions in an rfb::UpdateArena rather than on the heap.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void* rfbRegionAlloc(size_t size);
+void* rfbRegionRealloc(void* ptr, size_t size);
+void rfbRegionFree(void* ptr);
+#ifdef __cplusplus
+}
+#endif
 
 #ifndef max
 #define max(a,b)            (((a) > (b)) ? (a) : (b))
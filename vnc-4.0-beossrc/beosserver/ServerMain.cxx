@@ -161,11 +161,12 @@
 
 /* VNC library headers. */
 
+#include <network/EventLoop.h>
 #include <network/TcpSocket.h>
 #include <rfb/Logger_stdio.h>
 #include <rfb/LogWriter.h>
 #include <rfb/SSecurityFactoryStandard.h>
-#include <rfb/VNCServerST.h>
+#include <rfb/VNCServerMT.h>
 
 /* BeOS (Be Operating System) headers. */
 
@@ -203,6 +204,22 @@ static const int k_DeadManPulseTimer = 3000000;
   /* Time delay before the pulse timer checks that the main loop is still
   running.  If not, it will create a new polling BeOS message. */
 
+static const int k_BusyWaitMillis = 5;
+  /* How long to wait for network activity while clients are waiting for
+  updates, between slices of scanning the screen for changes. */
+
+static const int k_QuietWaitMillis = 40;
+  /* While clients are waiting for updates but the scan keeps finding no
+  changes, the wait between slices doubles from k_BusyWaitMillis up to this,
+  and drops back as soon as something changes.  40 milliseconds is about the
+  rate at which the background scan aims to do its slices anyway, so the
+  slice size settles rather than shrinking. */
+
+static const int k_IdleWaitMillis = 100;
+  /* How long to wait for network activity when no clients want updates.  The
+  BeOS messages (clipboard changes, quit requests) are handled by the same
+  thread, so they can be delayed by up to this long. */
+
 static rfb::LogWriter vlog("ServerMain");
 
 static rfb::IntParameter port_number("PortNumber",
@@ -277,6 +294,15 @@ public: /* Member variables. */
     update, the pulse thread will inject a new BMessage, just in case the chain
     of update BMessages was broken. */
 
+  network::EventLoop *m_EventLoopPntr;
+    /* Waits for activity on the listening socket and the client sockets,
+    which stay registered with it while they are open. */
+
+  int m_BusyWaitMillis;
+    /* How long to wait for network activity between slices of the screen
+    scan, from k_BusyWaitMillis to k_QuietWaitMillis depending on whether the
+    screen has been changing. */
+
   network::TcpListener *m_TcpListenerPntr;
     /* A socket that listens for incoming connections. */
 
@@ -296,6 +322,8 @@ ServerApp::ServerApp ()
   m_BeOSNetworkState (NET_RESTARTING),
   m_FakeDesktopPntr (NULL),
   m_TimeOfLastBackgroundUpdate (0),
+  m_EventLoopPntr (NULL),
+  m_BusyWaitMillis (k_BusyWaitMillis),
   m_TcpListenerPntr (NULL),
   m_VNCServerPntr (NULL)
 {
@@ -308,6 +336,7 @@ ServerApp::~ServerApp ()
 
   delete m_TcpListenerPntr;
   delete m_VNCServerPntr;
+  delete m_EventLoopPntr;
   delete m_FakeDesktopPntr;
 }
 
@@ -380,6 +409,7 @@ void ServerApp::PollNetwork ()
     if (m_TcpListenerPntr != NULL)
       delete m_TcpListenerPntr;
     m_TcpListenerPntr = new network::TcpListener ((int)port_number);
+    m_EventLoopPntr->add (m_TcpListenerPntr->getFd ());
 
     vlog.info("Listening on port %d", (int)port_number);
     m_BeOSNetworkState = NET_UP;
@@ -396,60 +426,63 @@ void ServerApp::PollNetwork ()
 
   try
   {
-    int            cur_fd;
-    int            highest_fd;
-    fd_set         rfds;
-    struct timeval tv;
-
-    tv.tv_sec = 0;
-    tv.tv_usec = 5000; // Time delay in millionths of a second, keep short.
-
-    FD_ZERO(&rfds);
-    highest_fd = 0;
-
-    cur_fd = m_TcpListenerPntr->getFd();
-    FD_SET(cur_fd, &rfds);
-    if (cur_fd > highest_fd)
-      highest_fd = cur_fd;
-
-    std::list<network::Socket*> sockets;
-    m_VNCServerPntr->getSockets(&sockets);
-    std::list<network::Socket*>::iterator iter;
-    for (iter = sockets.begin(); iter != sockets.end(); iter++)
+    int i;
+    int listener_fd;
+    int n;
+    int timeout;
+
+    // Wait for network activity.  While clients are waiting for updates the
+    // screen has to be scanned for changes, so only wait briefly, though
+    // longer while nothing is changing.  Otherwise sleep until something
+    // happens on the network or a client times out.  checkTimeouts() also
+    // sets which client sockets have output queued.
+
+    timeout = m_VNCServerPntr->clientsReadyForUpdate () ?
+      m_BusyWaitMillis : k_IdleWaitMillis;
+    network::SocketServer::soonestTimeout (&timeout,
+      m_VNCServerPntr->checkTimeouts ());
+
+    n = m_EventLoopPntr->wait (timeout);
+
+    listener_fd = m_TcpListenerPntr->getFd ();
+    for (i = 0; i < n; i++)
     {
-      cur_fd = (*iter)->getFd();
-      FD_SET(cur_fd, &rfds);
-      if (cur_fd > highest_fd)
-        highest_fd = cur_fd;
+      if (m_EventLoopPntr->readyFd (i) != listener_fd)
+        m_VNCServerPntr->processEvent (m_EventLoopPntr->readyFd (i),
+          m_EventLoopPntr->readyEvents (i));
     }
 
-    if (highest_fd >= FD_SETSIZE) // Probably trashed stack if this happened.
-      throw rdr::SystemException("FD_SETSIZE Exceeded", -1);
+    // Accept new connections last, so that their file descriptors can't be
+    // confused with those of sockets closed while handling the events above.
 
-    int n = select(highest_fd + 1, &rfds, 0, 0, &tv);
-    if (n < 0) throw rdr::SystemException("select", errno);
-
-    for (iter = sockets.begin(); iter != sockets.end(); iter++) {
-      if (FD_ISSET((*iter)->getFd(), &rfds)) {
-        m_VNCServerPntr->processSocketEvent(*iter);
+    for (i = 0; i < n; i++)
+    {
+      if (m_EventLoopPntr->readyFd (i) == listener_fd)
+      {
+        network::Socket* sock = m_TcpListenerPntr->accept();
+        if (sock != NULL) // NULL if it fails security checks.  Can throw too.
+          m_VNCServerPntr->addClient(sock);
       }
     }
 
-    if (FD_ISSET(m_TcpListenerPntr->getFd(), &rfds)) {
-      network::Socket* sock = m_TcpListenerPntr->accept();
-      if (sock != NULL) // NULL if it fails security checks.  Can throw too.
-        m_VNCServerPntr->addClient(sock);
-    }
-
-    m_VNCServerPntr->checkTimeouts();
-
     // Run the background scan of the screen for changes, but only when an
     // update is requested.  Otherwise the update timing feedback system won't
     // work correctly (bursts of ridiculously high frame rates when the client
     // isn't asking for a new update).
 
     if (m_VNCServerPntr->clientsReadyForUpdate ())
+    {
+      unsigned int ChangesBefore = m_VNCServerPntr->getChangesFound ();
       m_FakeDesktopPntr->BackgroundScreenUpdateCheck ();
+      if (m_VNCServerPntr->getChangesFound () != ChangesBefore)
+        m_BusyWaitMillis = k_BusyWaitMillis;
+      else
+      {
+        m_BusyWaitMillis *= 2;
+        if (m_BusyWaitMillis > k_QuietWaitMillis)
+          m_BusyWaitMillis = k_QuietWaitMillis;
+      }
+    }
 
     // Trigger the next update pretty much immediately, after other intervening
     // messages in the queue have been processed.
@@ -496,12 +529,15 @@ void ServerApp::ReadyToRun ()
   {
     /* VNC Setup. */
 
+    m_EventLoopPntr = new network::EventLoop;
+
     m_FakeDesktopPntr = new SDesktopBeOS ();
 
-    m_VNCServerPntr = new rfb::VNCServerST ("MyBeOSVNCServer",
+    m_VNCServerPntr = new rfb::VNCServerMT ("MyBeOSVNCServer",
       m_FakeDesktopPntr, NULL /* security factory */);
 
     m_FakeDesktopPntr->setServer (m_VNCServerPntr);
+    m_VNCServerPntr->setEventLoop (m_EventLoopPntr);
 
     network::TcpSocket::initTcpSockets();
 
@@ -538,6 +574,7 @@ void ServerApp::ShutDownNetwork()
   // sockets that interact with the BeOS networking system.
   if (m_TcpListenerPntr != NULL)
   {
+    m_EventLoopPntr->remove (m_TcpListenerPntr->getFd ());
     m_TcpListenerPntr->shutdown();
     delete m_TcpListenerPntr;
     m_TcpListenerPntr = NULL;
@@ -0,0 +1,176 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- EventLoop.cxx
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif defined(__BEOS__)
+#include <sys/socket.h> // For fd_set.
+#ifdef __HAIKU__
+#include <sys/select.h>
+#endif
+#else
+#include <sys/select.h>
+#endif
+
+#include <network/EventLoop.h>
+#include <network/Socket.h>
+
+using namespace network;
+
+EventLoop::EventLoop()
+{
+#ifdef __linux__
+  epollFd = epoll_create(64);
+  if (epollFd < 0)
+    throw SocketException("epoll_create", errno);
+#endif
+}
+
+EventLoop::~EventLoop()
+{
+#ifdef __linux__
+  close(epollFd);
+#endif
+}
+
+void EventLoop::add(int fd, int events)
+{
+#ifndef __linux__
+  if (fd >= FD_SETSIZE)
+    throw rdr::Exception("EventLoop: file descriptor too big for select()");
+#endif
+  if (fd >= (int)interest.size())
+    interest.resize(fd + 1, -1);
+  if (interest[fd] >= 0)
+    return;
+  fds.push_back(fd);
+  interest[fd] = events;
+#ifdef __linux__
+  setInterest(fd, events, EPOLL_CTL_ADD);
+#endif
+}
+
+void EventLoop::setEvents(int fd, int events)
+{
+  if (fd >= (int)interest.size() || interest[fd] < 0 ||
+      interest[fd] == events)
+    return;
+  interest[fd] = events;
+#ifdef __linux__
+  setInterest(fd, events, EPOLL_CTL_MOD);
+#endif
+}
+
+void EventLoop::remove(int fd)
+{
+  if (fd >= (int)interest.size() || interest[fd] < 0)
+    return;
+  interest[fd] = -1;
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (fds[i] == fd) {
+      fds[i] = fds.back();
+      fds.pop_back();
+      break;
+    }
+  }
+#ifdef __linux__
+  // Fails harmlessly if the fd has already been closed, which removes it
+  // from the epoll set anyway.
+  struct epoll_event ev;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &ev);
+#endif
+}
+
+void EventLoop::setInterest(int fd, int events, int op)
+{
+#ifdef __linux__
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.data.fd = fd;
+  if (events & Read) ev.events |= EPOLLIN;
+  if (events & Write) ev.events |= EPOLLOUT;
+  if (epoll_ctl(epollFd, op, fd, &ev) < 0)
+    throw SocketException("epoll_ctl", errno);
+#endif
+}
+
+int EventLoop::wait(int timeoutms)
+{
+  ready.clear();
+
+#ifdef __linux__
+  enum { MAX_EVENTS = 64 };
+  struct epoll_event evs[MAX_EVENTS];
+  int n = epoll_wait(epollFd, evs, MAX_EVENTS, timeoutms);
+  if (n < 0) {
+    if (errno == EINTR) return 0;
+    throw SocketException("epoll_wait", errno);
+  }
+
+  for (int i = 0; i < n; i++) {
+    Ready r;
+    r.fd = evs[i].data.fd;
+    r.events = 0;
+    if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) r.events |= Read;
+    if (evs[i].events & EPOLLOUT) r.events |= Write;
+    ready.push_back(r);
+  }
+#else
+  fd_set rfds, wfds;
+  int highest_fd = 0;
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  for (size_t i = 0; i < fds.size(); i++) {
+    int fd = fds[i];
+    if (interest[fd] & Read) FD_SET(fd, &rfds);
+    if (interest[fd] & Write) FD_SET(fd, &wfds);
+    if (fd > highest_fd) highest_fd = fd;
+  }
+
+  struct timeval tv;
+  struct timeval* tvp = 0;
+  if (timeoutms >= 0) {
+    tv.tv_sec = timeoutms / 1000;
+    tv.tv_usec = (timeoutms % 1000) * 1000;
+    tvp = &tv;
+  }
+
+  int n = select(highest_fd + 1, &rfds, &wfds, 0, tvp);
+  if (n < 0) {
+    if (errno == EINTR) return 0;
+    throw SocketException("select", errno);
+  }
+
+  for (size_t i = 0; i < fds.size(); i++) {
+    Ready r;
+    r.fd = fds[i];
+    r.events = 0;
+    if (FD_ISSET(r.fd, &rfds)) r.events |= Read;
+    if (FD_ISSET(r.fd, &wfds)) r.events |= Write;
+    if (r.events)
+      ready.push_back(r);
+  }
+#endif
+
+  return ready.size();
+}
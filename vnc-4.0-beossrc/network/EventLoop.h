@@ -0,0 +1,75 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- EventLoop.h - waits for events on a set of file descriptors.
+//
+//     File descriptors are registered once, with the events they are
+//     interested in (Read and/or Write), and stay registered until they
+//     are removed.  wait() then blocks until some of them are ready or the
+//     timeout expires.  It uses epoll on Linux and select() elsewhere.  With
+//     select() descriptors must be less than FD_SETSIZE, which is 1024 on
+//     Haiku.
+//
+//     Errors and hangups are reported as Read, so that the caller finds out
+//     about them when it next reads from the descriptor.
+
+#ifndef __NETWORK_EVENT_LOOP_H__
+#define __NETWORK_EVENT_LOOP_H__
+
+#include <vector>
+
+namespace network {
+
+  class EventLoop {
+  public:
+    enum { Read = 1, Write = 2 };
+
+    EventLoop();
+    ~EventLoop();
+
+    // add() registers fd, setEvents() changes the events it is interested
+    // in and remove() unregisters it.  setEvents() does nothing if the
+    // events haven't changed, so it can be called freely.
+    void add(int fd, int events=Read);
+    void setEvents(int fd, int events);
+    void remove(int fd);
+
+    // wait() waits up to timeoutms (-1 waits forever) and returns the
+    // number of ready descriptors.  readyFd() and readyEvents() say which
+    // they are, until the next call to wait().  A descriptor removed since
+    // wait() returned is still listed, so callers should check for that if
+    // handling one descriptor can remove another.
+    int wait(int timeoutms);
+    int readyFd(int i) { return ready[i].fd; }
+    int readyEvents(int i) { return ready[i].events; }
+
+  private:
+    struct Ready {
+      int fd;
+      int events;
+    };
+    std::vector<Ready> ready;
+    std::vector<int> interest; // Events for each fd, indexed by fd.
+    std::vector<int> fds;
+#ifdef __linux__
+    int epollFd;
+#endif
+    void setInterest(int fd, int events, int op);
+  };
+
+}
+
+#endif // __NETWORK_EVENT_LOOP_H__
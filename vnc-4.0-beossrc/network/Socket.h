@@ -109,6 +109,11 @@ namespace network {
     //   the server MUST delete the socket AND return false.
     virtual bool processSocketEvent(network::Socket* sock) = 0;
 
+    // processSocketWriteEvent() tells the server the socket has become
+    // writable, so that it can send output which has been queued.  It must
+    // not delete the socket.
+    virtual void processSocketWriteEvent(network::Socket* sock) {}
+
     // checkTimeouts() allows the server to check socket timeouts, etc.  The
     // return value is the number of milliseconds to wait before
     // checkTimeouts() should be called again.  If this number is zero then
@@ -31,12 +31,20 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #endif
 #ifdef __BEOS__ // Put this after other includes so "write" redefinition works.
 #include <sys/socket.h> // For fd_set.
 #define write(s,b,l) send(s,(char*)b,l,0) // BeOS R5 socket handles are not file handles.
 #endif
 
+// Without writev() the segments are just written one at a time.
+
+#if !defined(_WIN32) && (!defined(__BEOS__) || defined(__HAIKU__))
+#define HAVE_WRITEV
+#endif
+
 
 #include <rdr/FdOutStream.h>
 #include <rdr/Exception.h>
@@ -49,9 +57,12 @@ enum { DEFAULT_BUF_SIZE = 16384,
 
 FdOutStream::FdOutStream(int fd_, int timeoutms_, int bufSize_)
   : fd(fd_), timeoutms(timeoutms_),
-    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    nSegments(0), copied(0), referenced(0), blocking(true), maxQueued(0),
+    queue(0), queueStart(0), queueEnd(0), queueSize(0), backlogged(false),
+    drainBytes(0), drainMicros(0), freeBytes(0), freeMicros(0)
 {
-  ptr = start = new U8[bufSize];
+  ptr = segmentEnd = start = new U8[bufSize];
   end = start + bufSize;
 }
 
@@ -62,46 +73,53 @@ FdOutStream::~FdOutStream()
   } catch (Exception&) {
   }
   delete [] start;
+  delete [] queue;
 }
 
 void FdOutStream::setTimeout(int timeoutms_) {
   timeoutms = timeoutms_;
 }
 
+// writeBytes() copies anything smaller than the buffer, so that the many
+// rectangles of an update go out together when the buffer fills or the
+// update is flushed.  The caller's data may not outlive the call, so a block
+// which is bigger than the whole buffer can only be left in the chain if it
+// is sent at once.  It is flushed along with whatever is buffered ahead of
+// it, which is no more writes than copying it through the buffer would take.
+
 void FdOutStream::writeBytes(const void* data, int length)
 {
-  if (length < MIN_BULK_SIZE) {
+  if (length < bufSize) {
     OutStream::writeBytes(data, length);
     return;
   }
 
-  const U8* dataPtr = (const U8*)data;
-
+  writeBytesRef(data, length);
   flush();
+}
 
-  while (length > 0) {
-    int n = writeWithTimeout(dataPtr, length);
-    length -= n;
-    dataPtr += n;
-    offset += n;
+void FdOutStream::writeBytesRef(const void* data, int length)
+{
+  if (length < MIN_BULK_SIZE) {
+    OutStream::writeBytes(data, length);
+    return;
   }
+
+  endBufferSegment();
+  addSegment((const U8*)data, length);
+  referenced += length;
 }
 
 int FdOutStream::length()
 {
-  return offset + ptr - start;
+  return offset + ptr - segmentEnd;
 }
 
 void FdOutStream::flush()
 {
-  U8* sentUpTo = start;
-  while (sentUpTo < ptr) {
-    int n = writeWithTimeout((const void*) sentUpTo, ptr - sentUpTo);
-    sentUpTo += n;
-    offset += n;
-  }
-
-  ptr = start;
+  endBufferSegment();
+  writeSegments();
+  ptr = segmentEnd = start;
 }
 
 
@@ -118,56 +136,285 @@ int FdOutStream::overrun(int itemSize, int nItems)
   return nItems;
 }
 
+// endBufferSegment() adds whatever has been written to the buffer since the
+// last segment to the chain.
+
+void FdOutStream::endBufferSegment()
+{
+  if (ptr == segmentEnd)
+    return;
+  copied += ptr - segmentEnd;
+  addSegment(segmentEnd, ptr - segmentEnd);
+  segmentEnd = ptr;
+}
+
+void FdOutStream::addSegment(const U8* data, int length)
+{
+  if (nSegments == MAX_SEGMENTS)
+    writeSegments();
+  segments[nSegments].data = data;
+  segments[nSegments].length = length;
+  nSegments++;
+  offset += length;
+}
+
+// writeSegments() sends the whole chain, coping with partial writes.  The
+// buffer isn't reused until flush(), so buffer segments stay valid while
+// this is called from addSegment().  In non-blocking mode, whatever the
+// socket won't take straight away is copied into the queue.
+
+void FdOutStream::writeSegments()
+{
+  int first = 0;
+
+  if (!backlogged && nSegments)
+    gettimeofday(&drainMark, 0);
+
+  if (blocking) {
+    while (queueEnd > queueStart || first < nSegments)
+      consume(writeWithTimeout(first, true), &first);
+    nSegments = 0;
+    return;
+  }
+
+  if (queueEnd > queueStart || first < nSegments)
+    consume(writeWithTimeout(first, false), &first);
+
+  while (first < nSegments) {
+    while (first < nSegments &&
+           queueEnd - queueStart + segments[first].length > maxQueued)
+      consume(writeWithTimeout(first, true), &first);
+    if (first < nSegments) {
+      addToQueue(segments[first].data, segments[first].length);
+      first++;
+    }
+  }
+  nSegments = 0;
+}
+
+// consume() removes bytes which have been written from the front of the
+// queue and then from the chain, starting at segment *first, and counts
+// them for kbitsPerSecond().
+
+void FdOutStream::consume(int length, int* first)
+{
+  int written = length;
+
+  if (queueEnd > queueStart) {
+    if (length < queueEnd - queueStart) {
+      queueStart += length;
+      length = 0;
+    } else {
+      length -= queueEnd - queueStart;
+      queueStart = queueEnd = 0;
+    }
+  }
+
+  while (length > 0) {
+    Segment* s = &segments[*first];
+    if (length >= s->length) {
+      length -= s->length;
+      (*first)++;
+    } else {
+      s->data += length;
+      s->length -= length;
+      length = 0;
+    }
+  }
+
+  countDrained(written, queueEnd > queueStart || *first < nSegments);
+}
+
+// countDrained() adds the bytes just written and the time since the last
+// write, or since there was something to send, to the figures for
+// kbitsPerSecond().  backlog says whether anything is still waiting.  Older
+// figures count for less as newer ones come in.
+
+void FdOutStream::countDrained(int length, bool backlog)
+{
+  struct timeval now;
+  gettimeofday(&now, 0);
+  unsigned int micros = ((now.tv_sec - drainMark.tv_sec) * 1000000 +
+                         now.tv_usec - drainMark.tv_usec);
+  drainMark = now;
+
+  if (backlogged) {
+    drainBytes += length;
+    drainMicros += micros;
+    lastBacklog = now;
+  } else {
+    freeBytes += length;
+    freeMicros += micros;
+  }
+  backlogged = backlog;
+
+  while (drainMicros > 2000000 || drainBytes > 1 << 28) {
+    drainMicros /= 2;
+    drainBytes /= 2;
+  }
+  while (freeMicros > 2000000 || freeBytes > 1 << 28) {
+    freeMicros /= 2;
+    freeBytes /= 2;
+  }
+}
+
+unsigned int FdOutStream::kbitsPerSecond()
+{
+  if (drainBytes) {
+    struct timeval now;
+    gettimeofday(&now, 0);
+    if (now.tv_sec - lastBacklog.tv_sec > 2)
+      drainBytes = drainMicros = 0;
+  }
+
+  double kbits;
+  if (drainBytes)
+    kbits = drainBytes * 8000.0 / (drainMicros ? drainMicros : 1);
+  else
+    kbits = freeBytes * 8000.0 / (freeMicros ? freeMicros : 1);
+  return kbits < 4e9 ? (unsigned int)kbits : 4000000000U;
+}
+
+void FdOutStream::addToQueue(const U8* data, int length)
+{
+  if (queueEnd + length > queueSize) {
+    if (queueStart > 0) {
+      memmove(queue, queue + queueStart, queueEnd - queueStart);
+      queueEnd -= queueStart;
+      queueStart = 0;
+    }
+    if (queueEnd + length > queueSize) {
+      int newSize = queueSize * 2;
+      if (newSize < queueEnd + length)
+        newSize = queueEnd + length;
+      U8* newQueue = new U8[newSize];
+      memcpy(newQueue, queue, queueEnd);
+      delete [] queue;
+      queue = newQueue;
+      queueSize = newSize;
+    }
+  }
+  memcpy(queue + queueEnd, data, length);
+  queueEnd += length;
+}
+
+void FdOutStream::setBlocking(bool blocking_, int maxQueued_)
+{
+  maxQueued = maxQueued_;
+  if (blocking_ == blocking)
+    return;
+
+#if defined(_WIN32)
+  u_long arg = blocking_ ? 0 : 1;
+  if (ioctlsocket(fd, FIONBIO, &arg) != 0)
+    throw SystemException("ioctlsocket", errno);
+#elif defined(__BEOS__) && !defined(__HAIKU__)
+  int arg = blocking_ ? 0 : 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_NONBLOCK, &arg, sizeof(arg)) < 0)
+    throw SystemException("setsockopt", errno);
+#else
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    throw SystemException("fcntl", errno);
+  flags = blocking_ ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+  if (fcntl(fd, F_SETFL, flags) < 0)
+    throw SystemException("fcntl", errno);
+#endif
+
+  blocking = blocking_;
+}
+
 //
-// writeWithTimeout() writes up to the given length in bytes from the given
-// buffer to the file descriptor.  If there is a timeout set and that timeout
-// expires, it throws a TimedOut exception.  Otherwise it returns the number of
-// bytes written.  It never attempts to write() unless select() indicates that
-// the fd is writable - this means it can be used on an fd which has been set
-// non-blocking.  It also has to cope with the annoying possibility of both
-// select() and write() returning EINTR.
+// waitUntilWritable() waits for the file descriptor to become writable,
+// throwing a TimedOut exception if there is a timeout set and it expires.
 //
 
-int FdOutStream::writeWithTimeout(const void* data, int length)
+void FdOutStream::waitUntilWritable()
 {
   int n;
 
   do {
-
-    do {
-      fd_set fds;
-      struct timeval tv;
-      struct timeval* tvp = &tv;
-
-      if (timeoutms != -1) {
-        tv.tv_sec = timeoutms / 1000;
-        tv.tv_usec = (timeoutms % 1000) * 1000;
-      } else {
-        tvp = 0;
-      }
-
-      FD_ZERO(&fds);
-      FD_SET(fd, &fds);
+    fd_set fds;
+    struct timeval tv;
+    struct timeval* tvp = &tv;
+
+    if (timeoutms != -1) {
+      tv.tv_sec = timeoutms / 1000;
+      tv.tv_usec = (timeoutms % 1000) * 1000;
+    } else {
+      tvp = 0;
+    }
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
 #ifdef _WIN32_WCE
-      // NB: This fixes a broken Winsock2 select() behaviour.  select()
-      // never returns for non-blocking sockets, unless they're already
-      // ready to be written to...
-      u_long zero = 0; ioctlsocket(fd, FIONBIO, &zero);
+    // NB: This fixes a broken Winsock2 select() behaviour.  select()
+    // never returns for non-blocking sockets, unless they're already
+    // ready to be written to...
+    u_long zero = 0; ioctlsocket(fd, FIONBIO, &zero);
 #endif
-      n = select(fd+1, 0, &fds, 0, tvp);
+    n = select(fd+1, 0, &fds, 0, tvp);
 #ifdef _WIN32_WCE
-      u_long one = 0; ioctlsocket(fd, FIONBIO, &one);
+    u_long one = 0; ioctlsocket(fd, FIONBIO, &one);
 #endif
-    } while (n < 0 && errno == EINTR);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) throw SystemException("select",errno);
 
-    if (n < 0) throw SystemException("select",errno);
+  if (n == 0) throw TimedOut();
+}
+
+//
+// writeWithTimeout() writes as much as it can of the queue followed by the
+// chain from segment first onwards, using writev() if there is more than one
+// piece.  If wait is true and there is a timeout set and that timeout
+// expires, it throws a TimedOut exception.  If wait is false it returns zero
+// when the fd would block.  Otherwise it returns the number of bytes written.
+// It never attempts to write() when waiting unless select() indicates that
+// the fd is writable - this means it can be used on an fd which has been set
+// non-blocking.  It also has to cope with the annoying possibility of both
+// select() and write() returning EINTR.
+//
 
-    if (n == 0) throw TimedOut();
+int FdOutStream::writeWithTimeout(int first, bool wait)
+{
+  Segment chain[MAX_SEGMENTS + 1];
+  int nChain = 0;
+
+  if (queueEnd > queueStart) {
+    chain[nChain].data = queue + queueStart;
+    chain[nChain].length = queueEnd - queueStart;
+    nChain++;
+  }
+  while (first < nSegments)
+    chain[nChain++] = segments[first++];
+
+#ifdef HAVE_WRITEV
+  struct iovec iov[MAX_SEGMENTS + 1];
+  for (int i = 0; i < nChain; i++) {
+    iov[i].iov_base = (char*)chain[i].data;
+    iov[i].iov_len = chain[i].length;
+  }
+#endif
+
+  int n;
+
+  do {
+
+    if (wait) waitUntilWritable();
 
     do {
-      n = ::write(fd, data, length);
+#ifdef HAVE_WRITEV
+      if (nChain > 1)
+        n = ::writev(fd, iov, nChain);
+      else
+#endif
+        n = ::write(fd, chain[0].data, chain[0].length);
     } while (n < 0 && (errno == EINTR));
-      
+
+    if (n < 0 && errno == EWOULDBLOCK && !wait)
+      return 0;
+
     // NB: This outer loop simply fixes a broken Winsock2 EWOULDBLOCK
     // condition, found only under Win98 (first edition), with slow
     // network connections.  Should in fact never ever happen...
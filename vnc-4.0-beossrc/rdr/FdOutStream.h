@@ -19,10 +19,36 @@
 //
 // FdOutStream streams to a file descriptor.
 //
+// Data is gathered as a chain of segments which is sent with a single
+// writev() when the stream is flushed.  Small items are copied into the
+// stream's buffer, and the buffer is a segment.  writeBytes() copies any
+// block which is smaller than the buffer.  A bigger one is added as a
+// segment of its own and flushed straight away, since the caller's data
+// may not last.  Large blocks given to writeBytesRef() are added as
+// segments without being copied, and stay in the chain until the next
+// flush.  The chain is only written early when it or the buffer is full.
+//
+// In non-blocking mode flush() only writes as much as the socket will take
+// straight away.  The rest is copied into a queue, which later flushes send
+// first.  The queue is limited to maxQueued bytes.  Past that limit, flush()
+// waits for the socket as it does in blocking mode.
+//
+// bytesCopied() and bytesReferenced() count the bytes which went through
+// the buffer and the bytes which were sent from where they were, since the
+// last resetCounters().
+//
+// kbitsPerSecond() estimates how fast the other end is taking data.  Once
+// the socket has stopped taking everything it's given, each byte it takes
+// is one which has left, so the bytes written after that and the time
+// taken give the rate of the connection.  If that hasn't happened for a
+// while, the figure is for the writes which went straight through, which
+// is very high.
+//
 
 #ifndef __RDR_FDOUTSTREAM_H__
 #define __RDR_FDOUTSTREAM_H__
 
+#include <sys/time.h>
 #include <rdr/OutStream.h>
 
 namespace rdr {
@@ -37,18 +63,64 @@ namespace rdr {
     void setTimeout(int timeoutms);
     int getFd() { return fd; }
 
+    // setBlocking() also sets the file descriptor blocking or non-blocking.
+    void setBlocking(bool blocking, int maxQueued=0);
+
+    // queuedBytes() returns the number of bytes flushed but not yet sent.
+    int queuedBytes() { return queueEnd - queueStart; }
+
     void flush();
     int length();
     void writeBytes(const void* data, int length);
+    void writeBytesRef(const void* data, int length);
+
+    int bytesCopied() { return copied; }
+    int bytesReferenced() { return referenced; }
+    void resetCounters() { copied = referenced = 0; }
+
+    unsigned int kbitsPerSecond();
 
   private:
     int overrun(int itemSize, int nItems);
-    int writeWithTimeout(const void* data, int length);
+    void endBufferSegment();
+    void addSegment(const U8* data, int length);
+    void writeSegments();
+    void consume(int length, int* first);
+    void countDrained(int length, bool backlog);
+    void addToQueue(const U8* data, int length);
+    void waitUntilWritable();
+    int writeWithTimeout(int first, bool wait);
     int fd;
     int timeoutms;
     int bufSize;
     int offset;
     U8* start;
+
+    enum { MAX_SEGMENTS = 64 };
+    struct Segment {
+      const U8* data;
+      int length;
+    };
+    Segment segments[MAX_SEGMENTS];
+    int nSegments;
+    U8* segmentEnd;
+    int copied;
+    int referenced;
+
+    bool blocking;
+    int maxQueued;
+    U8* queue;
+    int queueStart;
+    int queueEnd;
+    int queueSize;
+
+    struct timeval drainMark;
+    struct timeval lastBacklog;
+    bool backlogged;
+    unsigned int drainBytes;
+    unsigned int drainMicros;
+    unsigned int freeBytes;
+    unsigned int freeMicros;
   };
 
 }
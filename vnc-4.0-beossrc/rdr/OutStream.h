@@ -100,6 +100,14 @@ namespace rdr {
       }
     }
 
+    // writeBytesRef() is like writeBytes(), except that the stream may keep a
+    // pointer to the data instead of copying it.  The data must then stay
+    // unchanged until after the next flush().
+
+    virtual void writeBytesRef(const void* data, int length) {
+      writeBytes(data, length);
+    }
+
     // writeOpaqueN() writes a quantity without byte-swapping.
 
     inline void writeOpaque8( U8  u) { writeU8(u); }
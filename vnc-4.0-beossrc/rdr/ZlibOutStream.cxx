@@ -25,13 +25,15 @@ using namespace rdr;
 enum { DEFAULT_BUF_SIZE = 16384 };
 
 ZlibOutStream::ZlibOutStream(OutStream* os, int bufSize_, int compressLevel)
-  : underlying(os), bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+  : underlying(os), bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    compressionLevel(compressLevel), headerWritten(false)
 {
   zs = new z_stream;
   zs->zalloc    = Z_NULL;
   zs->zfree     = Z_NULL;
   zs->opaque    = Z_NULL;
-  if (deflateInit(zs, compressLevel) != Z_OK) {
+  if (deflateInit2(zs, compressLevel, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
     delete zs;
     throw Exception("ZlibOutStream: deflateInit failed");
   }
@@ -67,6 +69,9 @@ void ZlibOutStream::flush()
 
 //    fprintf(stderr,"zos flush: avail_in %d\n",zs->avail_in);
 
+  if (zs->avail_in != 0 && !headerWritten)
+    writeHeader();
+
   while (zs->avail_in != 0) {
 
     do {
@@ -90,6 +95,65 @@ void ZlibOutStream::flush()
   ptr = start;
 }
 
+void ZlibOutStream::reset()
+{
+  flush();
+  if (deflateReset(zs) != Z_OK)
+    throw Exception("ZlibOutStream: deflateReset failed");
+}
+
+// deflateParams() may have to compress what it has been given so far, so
+// it needs somewhere to put it.  Having nothing to compress isn't an error,
+// though zlib reports it as one.
+
+void ZlibOutStream::setCompressionLevel(int level)
+{
+  if (level == compressionLevel)
+    return;
+
+  flush();
+  underlying->check(1);
+  zs->next_out = underlying->getptr();
+  zs->avail_out = underlying->getend() - underlying->getptr();
+  int rc = deflateParams(zs, level, Z_DEFAULT_STRATEGY);
+  if (rc != Z_OK && rc != Z_BUF_ERROR)
+    throw Exception("ZlibOutStream: deflateParams failed");
+  underlying->setptr(zs->next_out);
+  compressionLevel = level;
+}
+
+void ZlibOutStream::writeSegment(const void* data, int length)
+{
+  reset();
+  if (!headerWritten)
+    writeHeader();
+  underlying->writeBytes(data, length);
+}
+
+// writeHeader() writes the two byte zlib header, the same as deflate() would
+// have written in zlib format.
+
+void ZlibOutStream::writeHeader()
+{
+  int levelFlags;
+  if (compressionLevel == Z_DEFAULT_COMPRESSION || compressionLevel == 6)
+    levelFlags = 2;
+  else if (compressionLevel < 2)
+    levelFlags = 0;
+  else if (compressionLevel < 6)
+    levelFlags = 1;
+  else
+    levelFlags = 3;
+
+  int header = (Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8;
+  header |= levelFlags << 6;
+  header += 31 - (header % 31);
+
+  underlying->writeU8(header >> 8);
+  underlying->writeU8(header & 0xff);
+  headerWritten = true;
+}
+
 int ZlibOutStream::overrun(int itemSize, int nItems)
 {
 //    fprintf(stderr,"ZlibOutStream overrun\n");
@@ -100,6 +164,8 @@ int ZlibOutStream::overrun(int itemSize, int nItems)
   while (end - ptr < itemSize) {
     zs->next_in = start;
     zs->avail_in = ptr - start;
+    if (!headerWritten)
+      writeHeader();
 
     do {
       underlying->check(1);
@@ -20,6 +20,21 @@
 // ZlibOutStream streams to a compressed data stream (underlying), compressing
 // with zlib on the fly.
 //
+// reset() flushes and then starts compressing afresh, with no reference to
+// the data which went before.  The compressed data which follows can then be
+// decompressed by any stream which is at a flush point, whatever it was
+// given before, which allows the same compressed data to be sent to several
+// clients.  To make this possible the compression is done in raw deflate
+// format, and the zlib header is written by ZlibOutStream itself.
+//
+// writeSegment() uses the same property to append data compressed by a
+// separate ZlibOutStream, for example one run by another thread.  That
+// stream should have been told to omitHeader(), reset() before its data was
+// written and flushed afterwards.
+//
+// setCompressionLevel() changes the level for the data which follows,
+// without starting afresh.
+//
 
 #ifndef __RDR_ZLIBOUTSTREAM_H__
 #define __RDR_ZLIBOUTSTREAM_H__
@@ -39,15 +54,23 @@ namespace rdr {
 
     void setUnderlying(OutStream* os);
     void flush();
+    void reset();
+    void omitHeader() { headerWritten = true; }
+    void setCompressionLevel(int level);
+    int getCompressionLevel() { return compressionLevel; }
+    void writeSegment(const void* data, int length);
     int length();
 
   private:
 
     int overrun(int itemSize, int nItems);
+    void writeHeader();
 
     OutStream* underlying;
     int bufSize;
     int offset;
+    int compressionLevel;
+    bool headerWritten;
     z_stream_s* zs;
     U8* start;
   };
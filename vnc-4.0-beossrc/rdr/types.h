@@ -24,6 +24,7 @@ namespace rdr {
   typedef unsigned char U8;
   typedef unsigned short U16;
   typedef unsigned int U32;
+  typedef unsigned long long U64;
   typedef signed char S8;
   typedef signed short S16;
   typedef signed int S32;
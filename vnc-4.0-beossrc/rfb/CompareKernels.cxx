@@ -0,0 +1,333 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- CompareKernels.cxx
+
+#include <string.h>
+#include <rfb/CpuFeatures.h>
+#include <rfb/CompareKernels.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Threading.h>
+#include <rfb/util.h>
+
+#ifdef RFB_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace rfb;
+
+static LogWriter vlog("CompareKernels");
+
+// rowDiffers() returns a bitmask of the blocks which differ in one scanline
+// of a row of blocks.  memcmp() is as quick as anything at this, so a
+// scanline which hasn't changed, as most haven't, is checked in one go.
+
+static inline rdr::U32 rowDiffers(const rdr::U8* oldRow,
+                                  const rdr::U8* newRow, int widthBytes,
+                                  int blockBytes)
+{
+  if (memcmp(oldRow, newRow, widthBytes) == 0)
+    return 0;
+
+  rdr::U32 mask = 0;
+  rdr::U32 bit = 1;
+  for (int x = 0; x < widthBytes; x += blockBytes, bit <<= 1) {
+    int n = min_vnc(blockBytes, widthBytes - x);
+    if (memcmp(oldRow + x, newRow + x, n) != 0)
+      mask |= bit;
+  }
+  return mask;
+}
+
+// finishBlock() compares the rest of a block a scanline at a time, and if
+// it finds a difference, copies the block from there down.  It returns true
+// if the block has changed.
+
+static inline bool finishBlock(rdr::U8* o, int oldStride, const rdr::U8* p,
+                               int newStride, int n, int height)
+{
+  for (int y = 0; y < height; y++) {
+    if (memcmp(o, p, n) != 0) {
+      for (; y < height; y++) {
+        memcpy(o, p, n);
+        o += oldStride;
+        p += newStride;
+      }
+      return true;
+    }
+    o += oldStride;
+    p += newStride;
+  }
+  return false;
+}
+
+// compareBlockRow() compares whole scanlines of the row of blocks until one
+// differs, which for an unchanged row is all of them.  From the first
+// scanline which differs, it takes the blocks left to right as the old
+// memcmp() loop did: a block which differs there is copied down to the
+// bottom, and any other one is finished with finishBlock().  Copying all
+// the changed blocks first and then comparing the others reads the same
+// memory, but is measurably slower.  A row which has changed right across
+// is simply copied a scanline at a time.
+
+rdr::U32 rfb::compareBlockRow(rdr::U8* oldPtr, int oldStride,
+                              const rdr::U8* newPtr, int newStride,
+                              int widthBytes, int height, int blockBytes)
+{
+  int nBlocks = (widthBytes + blockBytes - 1) / blockBytes;
+  rdr::U32 allBlocks = ((nBlocks >= compareMaxBlocksPerRow) ? 0xffffffffU
+                        : ((1U << nBlocks) - 1));
+  int y;
+  rdr::U32 changed = 0;
+
+  for (y = 0; y < height; y++) {
+    changed = rowDiffers(oldPtr, newPtr, widthBytes, blockBytes);
+    if (changed)
+      break;
+    oldPtr += oldStride;
+    newPtr += newStride;
+  }
+  if (!changed)
+    return 0;
+
+  if (changed == allBlocks) {
+    for (; y < height; y++) {
+      memcpy(oldPtr, newPtr, widthBytes);
+      oldPtr += oldStride;
+      newPtr += newStride;
+    }
+    return changed;
+  }
+
+  rdr::U32 bit = 1;
+  for (int x = 0; x < widthBytes; x += blockBytes, bit <<= 1) {
+    int n = min_vnc(blockBytes, widthBytes - x);
+    if (changed & bit) {
+      rdr::U8* o = oldPtr + x;
+      const rdr::U8* p = newPtr + x;
+      for (int y2 = y; y2 < height; y2++) {
+        memcpy(o, p, n);
+        o += oldStride;
+        p += newStride;
+      }
+    } else if (finishBlock(oldPtr + oldStride + x, oldStride,
+                           newPtr + newStride + x, newStride, n,
+                           height - y - 1)) {
+      changed |= bit;
+    }
+  }
+  return changed;
+}
+
+// A solidRow function checks that a scanline matches the pattern.  The
+// pattern starts afresh at the start of each scanline, which is always the
+// start of a pixel.
+
+typedef bool (*solidRowFnType)(const rdr::U8* row, int widthBytes,
+                               rdr::U32 pattern);
+
+static inline bool solidTail(const rdr::U8* row, int i, int widthBytes,
+                             rdr::U32 pattern)
+{
+  const rdr::U8* bytes = (const rdr::U8*)&pattern;
+  for (; i < widthBytes; i++)
+    if (row[i] != bytes[i & 3]) return false;
+  return true;
+}
+
+static bool solidRowC(const rdr::U8* row, int widthBytes, rdr::U32 pattern)
+{
+  int i = 0;
+  for (; i + 4 <= widthBytes; i += 4) {
+    rdr::U32 word;
+    memcpy(&word, row + i, 4);
+    if (word != pattern) return false;
+  }
+  return solidTail(row, i, widthBytes, pattern);
+}
+
+#ifdef RFB_HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static bool solidRowSSE2(const rdr::U8* row, int widthBytes, rdr::U32 pattern)
+{
+  __m128i pat = _mm_set1_epi32(pattern);
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 64 <= widthBytes; i += 64) {
+    __m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row+i)), pat);
+    __m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row+i+16)),
+                               pat);
+    __m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row+i+32)),
+                               pat);
+    __m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row+i+48)),
+                               pat);
+    acc = _mm_or_si128(acc, _mm_or_si128(_mm_or_si128(d0, d1),
+                                         _mm_or_si128(d2, d3)));
+  }
+  for (; i + 16 <= widthBytes; i += 16)
+    acc = _mm_or_si128(acc,
+                       _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row+i)),
+                                     pat));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+    return false;
+  return solidTail(row, i, widthBytes, pattern);
+}
+
+__attribute__((target("avx2")))
+static bool solidRowAVX2(const rdr::U8* row, int widthBytes, rdr::U32 pattern)
+{
+  __m256i pat = _mm256_set1_epi32(pattern);
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 128 <= widthBytes; i += 128) {
+    __m256i d0 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i*)(row+i)), pat);
+    __m256i d1 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i*)(row+i+32)), pat);
+    __m256i d2 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i*)(row+i+64)), pat);
+    __m256i d3 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i*)(row+i+96)), pat);
+    acc = _mm256_or_si256(acc, _mm256_or_si256(_mm256_or_si256(d0, d1),
+                                               _mm256_or_si256(d2, d3)));
+  }
+  for (; i + 32 <= widthBytes; i += 32)
+    acc = _mm256_or_si256(acc,
+            _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(row+i)),
+                             pat));
+  __m128i acc128 = _mm_or_si128(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+  for (; i + 16 <= widthBytes; i += 16)
+    acc128 = _mm_or_si128(acc128,
+               _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row+i)),
+                             _mm256_castsi256_si128(pat)));
+  if (!_mm_testz_si128(acc128, acc128))
+    return false;
+  return solidTail(row, i, widthBytes, pattern);
+}
+
+#endif
+
+// The solid row function is picked the first time it's needed, rather than
+// when the program starts, so that the UseSIMD parameter has been set by
+// then.  Several threads may get here at once, so the choice is made under
+// a lock, and solidRow is only set once, to its final value.
+
+static Mutex selectLock;
+static solidRowFnType solidRow = 0;
+
+static solidRowFnType selectKernel()
+{
+  Lock l(selectLock);
+  if (solidRow)
+    return solidRow;
+
+  solidRowFnType fn = solidRowC;
+  const char* name = "C";
+#ifdef RFB_HAVE_X86_SIMD
+  if (CpuFeatures::hasAVX2()) {
+    fn = solidRowAVX2;
+    name = "AVX2";
+  } else if (CpuFeatures::hasSSE2()) {
+    fn = solidRowSSE2;
+    name = "SSE2";
+  }
+#endif
+  vlog.info("using %s solid block check", name);
+  solidRow = fn;
+  return fn;
+}
+
+bool rfb::isSolidBlock(const rdr::U8* ptr, int stride, int widthBytes,
+                       int height, rdr::U32 pattern)
+{
+  solidRowFnType fn = solidRow;
+  if (!fn) fn = selectKernel();
+  for (int y = 0; y < height; y++) {
+    if (!(*fn)(ptr, widthBytes, pattern))
+      return false;
+    ptr += stride;
+  }
+  return true;
+}
+
+// The hash is built like xxHash64: four accumulators take alternate 8-byte
+// words of each scanline, so the multiplies can overlap, and are then mixed
+// together along with the size of the block.
+
+static const rdr::U64 hashPrime1 = 0x9E3779B185EBCA87ULL;
+static const rdr::U64 hashPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const rdr::U64 hashPrime3 = 0x165667B19E3779F9ULL;
+
+static inline rdr::U64 rotl64(rdr::U64 x, int n)
+{
+  return (x << n) | (x >> (64 - n));
+}
+
+static inline rdr::U64 hashRound(rdr::U64 acc, rdr::U64 word)
+{
+  return rotl64(acc + word * hashPrime2, 31) * hashPrime1;
+}
+
+static inline rdr::U64 loadWord(const rdr::U8* p)
+{
+  rdr::U64 w;
+  memcpy(&w, p, 8);
+  return w;
+}
+
+rdr::U64 rfb::hashBlock(const rdr::U8* ptr, int stride, int widthBytes,
+                        int height)
+{
+  rdr::U64 a = hashPrime1 + hashPrime2;
+  rdr::U64 b = hashPrime2;
+  rdr::U64 c = 0;
+  rdr::U64 d = 0 - hashPrime1;
+
+  for (int y = 0; y < height; y++) {
+    const rdr::U8* p = ptr;
+    int n = widthBytes;
+    while (n >= 32) {
+      a = hashRound(a, loadWord(p));
+      b = hashRound(b, loadWord(p + 8));
+      c = hashRound(c, loadWord(p + 16));
+      d = hashRound(d, loadWord(p + 24));
+      p += 32;
+      n -= 32;
+    }
+    while (n >= 8) {
+      a = hashRound(a, loadWord(p));
+      p += 8;
+      n -= 8;
+    }
+    if (n) {
+      rdr::U64 w = 0;
+      memcpy(&w, p, n);
+      b = hashRound(b, w);
+    }
+    ptr += stride;
+  }
+
+  rdr::U64 h = rotl64(a, 1) + rotl64(b, 7) + rotl64(c, 12) + rotl64(d, 18);
+  h = hashRound(h, ((rdr::U64)widthBytes << 32) | height);
+  h ^= h >> 33;
+  h *= hashPrime2;
+  h ^= h >> 29;
+  h *= hashPrime3;
+  h ^= h >> 32;
+  return h;
+}
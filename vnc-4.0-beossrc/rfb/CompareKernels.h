@@ -0,0 +1,63 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// CompareKernels.h - the inner loops of the framebuffer comparison done by
+// ComparingUpdateTracker.
+//
+// compareBlockRow() compares a horizontal row of blocks in the old copy of the
+// framebuffer with the same area in the new one, and at the same time copies
+// the new pixels of any block which has changed into the old copy.  It works
+// through the area a scanline at a time, checking all the blocks in a
+// scanline in one go, until it finds a difference, and then finishes off
+// each block in turn.  At most 32 blocks can be done in one call, and the
+// return value is a bitmask of the blocks which changed (bit 0 is the
+// leftmost block).  Only the last block may be narrower than blockBytes.
+//
+// hashBlock() works out a 64-bit hash of the pixels in a block, for keeping
+// track of changes without a copy of the old pixels.
+//
+// Both are plain C, since the time goes on reading the framebuffer rather
+// than on the arithmetic, and memcmp() is already as quick as anything at
+// comparing.
+//
+// isSolidBlock() returns true if every pixel in a block is the same colour.
+// The colour is given as a pattern of 4 bytes as they are in memory, which is
+// the pixel repeated for pixels of fewer than 4 bytes, so that rows can be
+// checked 16 or 32 bytes at a time.  The SSE2, AVX2 or plain C version is
+// picked the first time it's called, depending on what the processor can do.
+//
+
+#ifndef __RFB_COMPAREKERNELS_H__
+#define __RFB_COMPAREKERNELS_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  const int compareMaxBlocksPerRow = 32;
+
+  rdr::U32 compareBlockRow(rdr::U8* oldPtr, int oldStride,
+                           const rdr::U8* newPtr, int newStride,
+                           int widthBytes, int height, int blockBytes);
+
+  rdr::U64 hashBlock(const rdr::U8* ptr, int stride, int widthBytes,
+                     int height);
+
+  bool isSolidBlock(const rdr::U8* ptr, int stride, int widthBytes,
+                    int height, rdr::U32 pattern);
+}
+#endif
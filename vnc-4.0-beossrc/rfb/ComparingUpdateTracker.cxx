@@ -19,19 +19,25 @@
 #include <vector>
 #include <rdr/types.h>
 #include <rfb/Exception.h>
+#include <rfb/CompareKernels.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/CopyDetector.h>
+#include <rfb/ServerCore.h>
+#include <rfb/WorkerPool.h>
 
 using namespace rfb;
 
 ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer)
   : SimpleUpdateTracker(true), fb(buffer),
-    oldFb(fb->getPF(), 0, 0), firstCompare(true)
+    oldFb(fb->getPF(), 0, 0), firstCompare(true), useHashes(false),
+    tilesAcross(0), workers(0)
 {
     changed.assign_union(fb->getRect());
 }
 
 ComparingUpdateTracker::~ComparingUpdateTracker()
 {
+  delete workers;
 }
 
 
@@ -48,42 +54,308 @@ void ComparingUpdateTracker::flush_update(UpdateTracker &ut,
 }
 
 
-#define BLOCK_SIZE 16
+#define BLOCK_SIZE TileRegion::tileSize
 
 void ComparingUpdateTracker::compare()
 {
-  std::vector<Rect> rects;
   std::vector<Rect>::iterator i;
 
   if (firstCompare) {
     // NB: We leave the change region untouched on this iteration,
     // since in effect the entire framebuffer has changed.
-    oldFb.setSize(fb->width(), fb->height());
-    for (int y=0; y<fb->height(); y+=BLOCK_SIZE) {
-      Rect pos(0, y, fb->width(), min_vnc(fb->height(), y+BLOCK_SIZE));
-      int srcStride;
-      const rdr::U8* srcData = fb->getPixelsR(pos, &srcStride);
-      oldFb.imageRect(pos, srcData, srcStride);
+    useHashes = rfb::Server::compareHashes;
+    changedTiles.setSize(fb->width(), fb->height());
+    if (useHashes) {
+      tilesAcross = (fb->width() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      int tilesDown = (fb->height() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      tileHashes.assign(tilesAcross * tilesDown, 0);
+      rects.clear();
+      rects.push_back(fb->getRect());
+      compareRects(rects, 0);
+    } else {
+      oldFb.setSize(fb->width(), fb->height());
+      for (int y=0; y<fb->height(); y+=BLOCK_SIZE) {
+        Rect pos(0, y, fb->width(), min_vnc(fb->height(), y+BLOCK_SIZE));
+        int srcStride;
+        const rdr::U8* srcData = fb->getPixelsR(pos, &srcStride);
+        oldFb.imageRect(pos, srcData, srcStride);
+      }
     }
     firstCompare = false;
+  } else if (useHashes) {
+    compareHashes();
   } else {
+    if (copied.is_empty() && rfb::Server::detectCopies)
+      detectCopy(&oldFb, fb, changed, &copied, &copy_delta);
+
     copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
     for (i = rects.begin(); i != rects.end(); i++)
       oldFb.copyRect(*i, copy_delta);
 
     Region to_check = changed.union_(copied);
-    to_check.get_rects(&rects);
+    tileAlign(to_check).get_rects(&rects);
 
-    Region newChanged;
-    for (i = rects.begin(); i != rects.end(); i++)
-      compareRect(*i, &newChanged);
+    changedTiles.clear();
+    compareRects(rects, &changedTiles);
+    setChanged(changedTiles);
+  }
+}
+
+// setChanged() makes the changed region the tiles in newChanged, and takes
+// them out of the copied region.
+
+void ComparingUpdateTracker::setChanged(const TileRegion& newChanged)
+{
+  newChanged.get_rects(&rects);
+  changed.setOrderedRects(rects);
+  copied.assign_subtract(changed);
+}
+
+// Below this many pixels it isn't worth waking up the other threads.
+
+#define MIN_PARALLEL_AREA (256*256)
+
+// Jobs per thread.  Having several evens out the load when some parts of
+// the screen have more changes to record than others.
+
+#define JOBS_PER_THREAD 4
+
+// A CompareJob compares a list of horizontal bands, recording the changes in
+// its own tile region, since jobs may share words of the tracker's one.
+
+class rfb::CompareJob : public WorkerPool::Job {
+public:
+  CompareJob(ComparingUpdateTracker* tracker_, bool wantChanges_)
+    : tracker(tracker_), area(0), wantChanges(wantChanges_)
+  {
+    if (wantChanges)
+      changed.setSize(tracker->fb->width(), tracker->fb->height());
+  }
+  virtual void run() {
+    TileRegion* newChanged = wantChanges ? &changed : 0;
+    std::vector<Rect>::iterator i;
+    for (i = bands.begin(); i != bands.end(); i++) {
+      if (tracker->useHashes)
+        tracker->hashRect(*i, newChanged);
+      else
+        tracker->compareRect(*i, newChanged);
+    }
+  }
+  ComparingUpdateTracker* tracker;
+  std::vector<Rect> bands;
+  int area;
+  bool wantChanges;
+  TileRegion changed;
+};
+
+WorkerPool* ComparingUpdateTracker::getWorkerPool(int area)
+{
+  int nThreads = rfb::Server::compareThreads;
+  if (nThreads == 1 || area < MIN_PARALLEL_AREA)
+    return 0;
+
+  if (workers) {
+    if (nThreads < 1 || workers->getThreads() == nThreads)
+      return workers->getThreads() > 1 ? workers : 0;
+    delete workers;
+    workers = 0;
+  }
+  workers = new WorkerPool(nThreads);
+  return workers->getThreads() > 1 ? workers : 0;
+}
+
+// compareRects() compares the given rectangles, splitting them into bands of
+// whole rows of blocks which are spread across the worker threads.  Bands are
+// measured from the top of each rectangle, so the blocks are the same as when
+// comparing serially, and the jobs' regions are combined in order so the
+// result doesn't depend on which thread finished first.
+
+void ComparingUpdateTracker::compareRects(const std::vector<Rect>& rects,
+                                          TileRegion* newChanged)
+{
+  std::vector<Rect>::const_iterator i;
+
+  int area = 0;
+  for (i = rects.begin(); i != rects.end(); i++)
+    area += i->area();
+
+  WorkerPool* pool = getWorkerPool(area);
+  if (!pool) {
+    for (i = rects.begin(); i != rects.end(); i++) {
+      if (useHashes)
+        hashRect(*i, newChanged);
+      else
+        compareRect(*i, newChanged);
+    }
+    return;
+  }
+
+  int jobArea = area / (pool->getThreads() * JOBS_PER_THREAD) + 1;
+
+  std::vector<CompareJob*> jobs;
+  jobs.push_back(new CompareJob(this, newChanged != 0));
+
+  for (i = rects.begin(); i != rects.end(); i++) {
+    int width = i->width();
+    int bandHeight = (jobArea / width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bandHeight = max_vnc(bandHeight, 1) * BLOCK_SIZE;
+
+    for (int y = i->tl.y; y < i->br.y; y += bandHeight) {
+      Rect band(i->tl.x, y, i->br.x, min_vnc(i->br.y, y + bandHeight));
+      if (jobs.back()->area >= jobArea)
+        jobs.push_back(new CompareJob(this, newChanged != 0));
+      jobs.back()->bands.push_back(band);
+      jobs.back()->area += band.area();
+    }
+  }
+
+  std::vector<WorkerPool::Job*> poolJobs(jobs.begin(), jobs.end());
+  try {
+    pool->runJobs(&poolJobs[0], poolJobs.size());
+  } catch (rdr::Exception&) {
+    for (unsigned int j = 0; j < jobs.size(); j++)
+      delete jobs[j];
+    throw;
+  }
+
+  for (unsigned int j = 0; j < jobs.size(); j++) {
+    if (newChanged)
+      newChanged->assign_union(jobs[j]->changed);
+    delete jobs[j];
+  }
+}
+
+// compareHashes() is the hashing version of the comparison in compare().
+
+void ComparingUpdateTracker::compareHashes()
+{
+  bool copyAligned = (copy_delta.x % BLOCK_SIZE == 0 &&
+                      copy_delta.y % BLOCK_SIZE == 0);
+  bool trustCopy = !copied.is_empty() && !copyAligned;
+
+  Region to_check = changed;
+  if (!copied.is_empty() && copyAligned) {
+    shiftHashes();
+    to_check.assign_union(copied);
+  }
+
+  tileAlign(to_check).get_rects(&rects);
+  changedTiles.clear();
+  compareRects(rects, &changedTiles);
+
+  // Bring the hashes of the copied tiles up to date, without counting them
+  // as changed.  Tiles which were also in the changed region have just been
+  // done.
+
+  if (trustCopy) {
+    tileAlign(copied).subtract(tileAlign(changed)).get_rects(&rects);
+    compareRects(rects, 0);
+  }
+
+  setChanged(changedTiles);
+}
+
+// hashRect() hashes the tiles in r, which must be aligned to tile boundaries
+// (or the edge of the framebuffer), and adds the ones whose hash has changed
+// to newChanged.  newChanged can be null if the changes aren't wanted.
+
+void ComparingUpdateTracker::hashRect(const Rect& r, TileRegion* newChanged)
+{
+  if (!r.enclosed_by(fb->getRect())) {
+    fprintf(stderr,"ComparingUpdateTracker: rect outside fb (%d,%d-%d,%d)\n", r.tl.x, r.tl.y, r.br.x, r.br.y);
+    return;
+  }
+
+  int bytesPerPixel = fb->getPF().bpp/8;
+
+  for (int tileTop = r.tl.y; tileTop < r.br.y; tileTop += BLOCK_SIZE)
+  {
+    int tileBottom = min_vnc(tileTop+BLOCK_SIZE, r.br.y);
+    Rect pos(r.tl.x, tileTop, r.br.x, tileBottom);
+    int fbStride;
+    const rdr::U8* tilePtr = fb->getPixelsR(pos, &fbStride);
+    int strideBytes = fbStride * bytesPerPixel;
+    rdr::U64* hashPtr = &tileHashes[(tileTop / BLOCK_SIZE) * tilesAcross +
+                                    r.tl.x / BLOCK_SIZE];
+
+    for (int tileLeft = r.tl.x; tileLeft < r.br.x; tileLeft += BLOCK_SIZE)
+    {
+      int tileRight = min_vnc(tileLeft+BLOCK_SIZE, r.br.x);
+      rdr::U64 hash = hashBlock(tilePtr, strideBytes,
+                                (tileRight - tileLeft) * bytesPerPixel,
+                                tileBottom - tileTop);
+      if (hash != *hashPtr) {
+        *hashPtr = hash;
+        if (newChanged)
+          newChanged->add_tile(tileLeft / BLOCK_SIZE, tileTop / BLOCK_SIZE);
+      }
+      tilePtr += BLOCK_SIZE * bytesPerPixel;
+      hashPtr++;
+    }
+  }
+}
+
+// shiftHashes() moves the hashes of the tiles which are wholly inside the
+// copied region along by copy_delta, which is a whole number of tiles.  The
+// hashes of tiles only partly covered by the copy are left as they are, so
+// those tiles will most likely show up as changed.
+
+void ComparingUpdateTracker::shiftHashes()
+{
+  std::vector<rdr::U64> oldHashes(tileHashes);
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+  Rect fbRect = fb->getRect();
+
+  copied.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    for (int y = i->tl.y / BLOCK_SIZE; y * BLOCK_SIZE < i->br.y; y++) {
+      for (int x = i->tl.x / BLOCK_SIZE; x * BLOCK_SIZE < i->br.x; x++) {
+        Rect tile(x * BLOCK_SIZE, y * BLOCK_SIZE,
+                  (x + 1) * BLOCK_SIZE, (y + 1) * BLOCK_SIZE);
+        tile = tile.intersect(fbRect);
+        if (!tile.enclosed_by(*i))
+          continue;
+
+        // The source tile has to be whole, and the same shape.
+        Rect srcTile = tile.translate(copy_delta.negate());
+        int srcX = srcTile.tl.x / BLOCK_SIZE;
+        int srcY = srcTile.tl.y / BLOCK_SIZE;
+        Rect srcWhole(srcX * BLOCK_SIZE, srcY * BLOCK_SIZE,
+                      (srcX + 1) * BLOCK_SIZE, (srcY + 1) * BLOCK_SIZE);
+        if (!srcTile.enclosed_by(fbRect) ||
+            !srcWhole.intersect(fbRect).equals(srcTile))
+          continue;
+
+        tileHashes[y * tilesAcross + x] = oldHashes[srcY * tilesAcross + srcX];
+      }
+    }
+  }
+}
+
+// tileAlign() returns the region made up of the tiles which r touches.
 
-    copied.assign_subtract(newChanged);
-    changed = newChanged;
+Region ComparingUpdateTracker::tileAlign(const Region& r)
+{
+  std::vector<Rect>::iterator i;
+  r.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect tiles((i->tl.x / BLOCK_SIZE) * BLOCK_SIZE,
+               (i->tl.y / BLOCK_SIZE) * BLOCK_SIZE,
+               ((i->br.x + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE,
+               ((i->br.y + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE);
+    *i = tiles.intersect(fb->getRect());
   }
+  Region result;
+  result.setOrderedRects(rects);
+  return result;
 }
 
-void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
+// compareRect() compares the tiles in r, which must be aligned to tile
+// boundaries (or the edge of the framebuffer) like in hashRect(), and adds
+// the ones which have changed to newChanged.
+
+void ComparingUpdateTracker::compareRect(const Rect& r, TileRegion* newChanged)
 {
   if (!r.enclosed_by(fb->getRect())) {
     fprintf(stderr,"ComparingUpdateTracker: rect outside fb (%d,%d-%d,%d)\n", r.tl.x, r.tl.y, r.br.x, r.br.y);
@@ -91,11 +363,16 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
   }
 
   int bytesPerPixel = fb->getPF().bpp/8;
+  int blockBytes = BLOCK_SIZE * bytesPerPixel;
   int oldStride;
   rdr::U8* oldData = oldFb.getPixelsRW(r, &oldStride);
   int oldStrideBytes = oldStride * bytesPerPixel;
 
-  std::vector<Rect> changedBlocks;
+  // Each call to the compare kernel does up to compareMaxBlocksPerRow blocks
+  // of a row of blocks, comparing a whole scanline of them at a time.  Runs
+  // of adjacent changed blocks go into the list as a single rectangle.
+
+  const int chunkWidth = BLOCK_SIZE * compareMaxBlocksPerRow;
 
   for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE)
   {
@@ -108,44 +385,36 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
     rdr::U8* oldBlockPtr = oldData;
     int blockBottom = min_vnc(blockTop+BLOCK_SIZE, r.br.y);
 
-    for (int blockLeft = r.tl.x; blockLeft < r.br.x; blockLeft += BLOCK_SIZE)
+    for (int chunkLeft = r.tl.x; chunkLeft < r.br.x; chunkLeft += chunkWidth)
     {
-      const rdr::U8* newPtr = newBlockPtr;
-      rdr::U8* oldPtr = oldBlockPtr;
-
-      int blockRight = min_vnc(blockLeft+BLOCK_SIZE, r.br.x);
-      int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
-
-      for (int y = blockTop; y < blockBottom; y++)
-      {
-        if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
-        {
-          // A block has changed - copy the remainder to the oldFb
-          changedBlocks.push_back(Rect(blockLeft, blockTop,
-                                       blockRight, blockBottom));
-          for (int y2 = y; y2 < blockBottom; y2++)
-          {
-            memcpy(oldPtr, newPtr, blockWidthInBytes);
-            newPtr += newStrideBytes;
-            oldPtr += oldStrideBytes;
-          }
-          break;
-        }
+      int chunkRight = min_vnc(chunkLeft+chunkWidth, r.br.x);
+      int chunkWidthInBytes = (chunkRight-chunkLeft) * bytesPerPixel;
+
+      rdr::U32 changed = compareBlockRow(oldBlockPtr, oldStrideBytes,
+                                         newBlockPtr, newStrideBytes,
+                                         chunkWidthInBytes,
+                                         blockBottom - blockTop, blockBytes);
 
-        newPtr += newStrideBytes;
-        oldPtr += oldStrideBytes;
+      int blockLeft = chunkLeft;
+      while (changed) {
+        while (!(changed & 1)) {
+          changed >>= 1;
+          blockLeft += BLOCK_SIZE;
+        }
+        int runLeft = blockLeft;
+        while (changed & 1) {
+          changed >>= 1;
+          blockLeft += BLOCK_SIZE;
+        }
+        if (newChanged)
+          newChanged->add(Rect(runLeft, blockTop,
+                               min_vnc(blockLeft, chunkRight), blockBottom));
       }
 
-      oldBlockPtr += blockWidthInBytes;
-      newBlockPtr += blockWidthInBytes;
+      oldBlockPtr += chunkWidthInBytes;
+      newBlockPtr += chunkWidthInBytes;
     }
 
     oldData += oldStrideBytes * BLOCK_SIZE;
   }
-
-  if (!changedBlocks.empty()) {
-    Region temp;
-    temp.setOrderedRects(changedBlocks);
-    newChanged->assign_union(temp);
-  }
 }
@@ -20,16 +20,31 @@
 #define __RFB_COMPARINGUPDATETRACKER_H__
 
 #include <rfb/UpdateTracker.h>
+#include <rfb/TileRegion.h>
+#include <rdr/types.h>
 
 namespace rfb {
 
+  class WorkerPool;
+  class CompareJob;
+
   class ComparingUpdateTracker : public SimpleUpdateTracker {
   public:
     ComparingUpdateTracker(PixelBuffer* buffer);
     ~ComparingUpdateTracker();
 
     // compare() does the comparison and reduces its changed and copied regions
-    // as appropriate.
+    // as appropriate.  Normally it compares against a copy of the framebuffer
+    // as it was last time, but with the CompareHashes parameter set it keeps
+    // just a hash of each 16x16 tile instead.  Copies which move by a whole
+    // number of tiles move the hashes along with them, and are checked as
+    // usual.  Other copies can't be checked without the old pixels, so they
+    // are taken on trust and the hashes of the tiles they cover are updated.
+    //
+    // If nothing has been copied, the pixel comparison also looks for areas
+    // which have been scrolled or moved, and turns them into a copy (see
+    // rfb/CopyDetector.h).  This needs the old pixels, so it isn't done when
+    // keeping hashes.
 
     virtual void compare();
 
@@ -37,10 +52,27 @@ namespace rfb {
                               int maxArea);
     virtual void flush_update(UpdateTracker &info, const Region &cliprgn);
   private:
-    void compareRect(const Rect& r, Region* newchanged);
+    friend class CompareJob;
+    // The comparison is done on whole tiles, and the tiles found to have
+    // changed are marked in newChanged, which is turned into a Region once
+    // all the comparing is done.
+    void compareRect(const Rect& r, TileRegion* newChanged);
+    void compareRects(const std::vector<Rect>& rects, TileRegion* newChanged);
+    void compareHashes();
+    void hashRect(const Rect& r, TileRegion* newChanged);
+    void setChanged(const TileRegion& newChanged);
+    void shiftHashes();
+    Region tileAlign(const Region& r);
+    WorkerPool* getWorkerPool(int area);
     PixelBuffer* fb;
     ManagedPixelBuffer oldFb;
     bool firstCompare;
+    bool useHashes;
+    int tilesAcross;
+    std::vector<rdr::U64> tileHashes;
+    TileRegion changedTiles;
+    std::vector<Rect> rects; // Kept to save making a new list each time.
+    WorkerPool* workers;
   };
 
 }
@@ -28,6 +28,7 @@ using namespace rfb;
 ConnParams::ConnParams()
   : majorVersion(0), minorVersion(0), width(0), height(0), useCopyRect(false),
     supportsLocalCursor(false), supportsDesktopResize(false),
+    compressLevel(-1), qualityLevel(-1),
     name_(0), nEncodings_(0), encodings_(0),
     currentEncoding_(encodingRaw), verStrPos(0)
 {
@@ -87,6 +88,8 @@ void ConnParams::setEncodings(int nEncodings, const rdr::U32* encodings)
   nEncodings_ = nEncodings;
   useCopyRect = false;
   supportsLocalCursor = false;
+  compressLevel = -1;
+  qualityLevel = -1;
   currentEncoding_ = encodingRaw;
 
   for (int i = nEncodings-1; i >= 0; i--) {
@@ -98,7 +101,23 @@ void ConnParams::setEncodings(int nEncodings, const rdr::U32* encodings)
       supportsLocalCursor = true;
     else if (encodings[i] == pseudoEncodingDesktopSize)
       supportsDesktopResize = true;
+    else if (encodings[i] >= pseudoEncodingCompressLevel0 &&
+             encodings[i] <= pseudoEncodingCompressLevel9)
+      compressLevel = encodings[i] - pseudoEncodingCompressLevel0;
+    else if (encodings[i] >= pseudoEncodingQualityLevel0 &&
+             encodings[i] <= pseudoEncodingQualityLevel9)
+      qualityLevel = encodings[i] - pseudoEncodingQualityLevel0;
     else if (encodings[i] <= encodingMax && Encoder::supported(encodings[i]))
       currentEncoding_ = encodings[i];
   }
 }
+
+bool ConnParams::supportsEncoding(unsigned int encoding)
+{
+  if (encoding > encodingMax || !Encoder::supported(encoding))
+    return false;
+  for (int i = 0; i < nEncodings_; i++)
+    if (encodings_[i] == encoding)
+      return true;
+  return false;
+}
@@ -67,11 +67,23 @@ namespace rfb {
     int nEncodings() { return nEncodings_; }
     const rdr::U32* encodings() { return encodings_; }
     void setEncodings(int nEncodings, const rdr::U32* encodings);
+
+    // supportsEncoding() returns true if the client asked for the encoding
+    // and there's an encoder for it.
+    bool supportsEncoding(unsigned int encoding);
     bool useCopyRect;
 
     bool supportsLocalCursor;
     bool supportsDesktopResize;
 
+    // compressLevel is the Tight compression level (0 to 9) the client
+    // asked for with a pseudo-encoding, or -1 if it didn't.
+    int compressLevel;
+
+    // qualityLevel is the Tight JPEG quality level (0 to 9) the client asked
+    // for, or -1 if it didn't, in which case it mustn't be sent JPEG.
+    int qualityLevel;
+
   private:
 
     PixelFormat pf_;
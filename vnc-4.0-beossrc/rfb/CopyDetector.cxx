@@ -0,0 +1,339 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- CopyDetector.cxx
+
+#include <string.h>
+#include <map>
+#include <vector>
+#include <rdr/types.h>
+#include <rfb/CopyDetector.h>
+#include <rfb/LogWriter.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static LogWriter vlog("CopyDetector");
+
+// Length in pixels of the sampled segments.
+#define SEGMENT_LENGTH 32
+
+// Rows between samples, and the most samples taken.  Larger areas are
+// sampled more sparsely.
+#define SAMPLE_STEP_Y 8
+#define MAX_SAMPLES 4096
+
+// The first pass of the search looks at one row in this many, and if that
+// doesn't find anything the rest isn't searched.  This keeps the cost down
+// when the screen has changed without anything moving, such as with video.
+#define PROBE_STEP 16
+
+// Changed areas smaller than this aren't worth looking at.
+#define MIN_AREA (128*128)
+
+// An offset needs this many votes to be checked, and this many matching
+// blocks to be used.
+#define MIN_VOTES 8
+#define MIN_BLOCKS 4
+
+#define BLOCK_SIZE 16
+
+static const rdr::U64 hashBase = 0x100000001B3ULL;
+static const rdr::U64 hashMix = 0x9E3779B97F4A7C15ULL;
+
+struct Sample {
+  rdr::U64 hash;
+  int x, y;
+  bool used;
+  bool ambiguous;
+};
+
+// SampleTable is a small open-addressed hash table of the sampled segments.
+// A segment which turns up more than once is marked ambiguous, since it
+// can't say where anything came from.  Nearly every lookup is a miss, so a
+// bitmap small enough to stay in the cache is checked first.
+
+class SampleTable {
+public:
+  SampleTable(int nSamples) {
+    bits = 4;
+    while ((1 << bits) < nSamples * 2)
+      bits++;
+    table.resize(1 << bits);
+    for (unsigned int i = 0; i < table.size(); i++)
+      table[i].used = false;
+    mask = (1 << bits) - 1;
+    count = 0;
+    memset(filter, 0, sizeof(filter));
+  }
+
+  void insert(rdr::U64 hash, int x, int y) {
+    int i = index(hash);
+    while (table[i].used) {
+      if (table[i].hash == hash) {
+        table[i].ambiguous = true;
+        return;
+      }
+      i = (i + 1) & mask;
+    }
+    filter[filterIndex(hash) / 32] |= 1 << (filterIndex(hash) % 32);
+    table[i].hash = hash;
+    table[i].x = x;
+    table[i].y = y;
+    table[i].used = true;
+    table[i].ambiguous = false;
+    count++;
+  }
+
+  const Sample* find(rdr::U64 hash) const {
+    if (!(filter[filterIndex(hash) / 32] & (1 << (filterIndex(hash) % 32))))
+      return 0;
+    int i = index(hash);
+    while (table[i].used) {
+      if (table[i].hash == hash)
+        return table[i].ambiguous ? 0 : &table[i];
+      i = (i + 1) & mask;
+    }
+    return 0;
+  }
+
+  int count;
+
+private:
+  int index(rdr::U64 hash) const { return (int)((hash * hashMix) >> (64 - bits)); }
+  int filterIndex(rdr::U64 hash) const { return (int)(hash >> 48); }
+  std::vector<Sample> table;
+  rdr::U32 filter[65536 / 32];
+  int bits;
+  int mask;
+};
+
+template<class PIXEL_T>
+static inline rdr::U64 hashSegment(const PIXEL_T* p)
+{
+  rdr::U64 h = 0;
+  for (int i = 0; i < SEGMENT_LENGTH; i++)
+    h = h * hashBase + p[i];
+  return h;
+}
+
+template<class PIXEL_T>
+static inline bool isSolid(const PIXEL_T* p)
+{
+  for (int i = 1; i < SEGMENT_LENGTH; i++)
+    if (p[i] != p[0]) return false;
+  return true;
+}
+
+// sampleNew() hashes segments of the changed region of the new framebuffer
+// which really are different from the old one, skipping solid ones, which
+// would match anywhere.  It returns the bounding rectangle of the segments
+// which differ, widened to cover the rows between the samples.
+
+template<class PIXEL_T>
+static Rect sampleNew(PixelBuffer* oldFb, PixelBuffer* fb,
+                      const std::vector<Rect>& rects, int stepY,
+                      SampleTable* samples)
+{
+  Rect differs;
+  std::vector<Rect>::const_iterator i;
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (i->width() < SEGMENT_LENGTH)
+      continue;
+    int stride, oldStride;
+    const PIXEL_T* base = (const PIXEL_T*)fb->getPixelsR(*i, &stride);
+    const PIXEL_T* oldBase = (const PIXEL_T*)oldFb->getPixelsR(*i, &oldStride);
+    for (int y = i->tl.y; y < i->br.y; y += stepY) {
+      const PIXEL_T* row = base + (y - i->tl.y) * stride;
+      const PIXEL_T* oldRow = oldBase + (y - i->tl.y) * oldStride;
+      for (int x = i->tl.x; x + SEGMENT_LENGTH <= i->br.x;
+           x += SEGMENT_LENGTH) {
+        const PIXEL_T* p = row + (x - i->tl.x);
+        if (memcmp(p, oldRow + (x - i->tl.x),
+                   SEGMENT_LENGTH * sizeof(PIXEL_T)) == 0)
+          continue;
+        differs = differs.union_boundary(Rect(x, y - stepY + 1,
+                                              x + SEGMENT_LENGTH, y + stepY));
+        if (!isSolid(p))
+          samples->insert(hashSegment(p), x, y);
+      }
+    }
+  }
+  return differs;
+}
+
+// voteOld() runs a rolling hash along the rows of r in the old framebuffer,
+// and counts a vote for the offset to every sample it matches.  If probe is
+// true it does every PROBE_STEP'th row, otherwise all the others.
+
+template<class PIXEL_T>
+static void voteOld(PixelBuffer* oldFb, const Rect& r,
+                    const SampleTable& samples,
+                    std::map<rdr::U64, int>* votes, bool probe)
+{
+  if (r.width() < SEGMENT_LENGTH)
+    return;
+
+  rdr::U64 basePowN = 1;
+  for (int i = 0; i < SEGMENT_LENGTH; i++)
+    basePowN *= hashBase;
+
+  int stride;
+  const PIXEL_T* base = (const PIXEL_T*)oldFb->getPixelsR(r, &stride);
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    if (((y - r.tl.y) % PROBE_STEP == 0) != probe)
+      continue;
+    const PIXEL_T* p = base + (y - r.tl.y) * stride;
+    rdr::U64 h = hashSegment(p);
+    for (int x = r.tl.x; ; x++) {
+      const Sample* s = samples.find(h);
+      if (s && (s->x != x || s->y != y)) {
+        rdr::U64 key = ((rdr::U64)(rdr::U32)(s->x - x) << 32) |
+                       (rdr::U32)(s->y - y);
+        (*votes)[key]++;
+      }
+      if (x + SEGMENT_LENGTH >= r.br.x)
+        break;
+      h = h * hashBase - basePowN * p[0] + p[SEGMENT_LENGTH];
+      p++;
+    }
+  }
+}
+
+// blockMatches() checks whether the block at r in the new framebuffer is the
+// same as the one delta back from it in the old framebuffer.
+
+static bool blockMatches(PixelBuffer* oldFb, PixelBuffer* newFb,
+                         const Rect& r, const Point& delta)
+{
+  int bytesPerPixel = newFb->getPF().bpp / 8;
+  int oldStride, newStride;
+  const rdr::U8* oldPtr = oldFb->getPixelsR(r.translate(delta.negate()),
+                                            &oldStride);
+  const rdr::U8* newPtr = newFb->getPixelsR(r, &newStride);
+  int rowBytes = r.width() * bytesPerPixel;
+  for (int y = 0; y < r.height(); y++) {
+    if (memcmp(oldPtr, newPtr, rowBytes) != 0)
+      return false;
+    oldPtr += oldStride * bytesPerPixel;
+    newPtr += newStride * bytesPerPixel;
+  }
+  return true;
+}
+
+bool rfb::detectCopy(PixelBuffer* oldFb, PixelBuffer* newFb,
+                     const Region& changed, Region* copied, Point* delta)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+
+  changed.get_rects(&rects);
+  int area = 0;
+  for (i = rects.begin(); i != rects.end(); i++)
+    area += i->area();
+  if (area < MIN_AREA)
+    return false;
+
+  int stepY = SAMPLE_STEP_Y;
+  while (area / (SEGMENT_LENGTH * stepY) > MAX_SAMPLES)
+    stepY *= 2;
+
+  // Work out the votes for each offset.  Anything moved will have come
+  // from somewhere which has itself changed, so only the part of the old
+  // framebuffer where the samples differ needs to be searched.
+
+  SampleTable samples(min_vnc(area / (SEGMENT_LENGTH * stepY) + 1,
+                              MAX_SAMPLES));
+  std::map<rdr::U64, int> votes;
+  Rect searchRect;
+
+  switch (newFb->getPF().bpp) {
+  case 8:
+    searchRect = sampleNew<rdr::U8>(oldFb, newFb, rects, stepY, &samples);
+    break;
+  case 16:
+    searchRect = sampleNew<rdr::U16>(oldFb, newFb, rects, stepY, &samples);
+    break;
+  case 32:
+    searchRect = sampleNew<rdr::U32>(oldFb, newFb, rects, stepY, &samples);
+    break;
+  default:
+    return false;
+  }
+
+  searchRect = searchRect.intersect(changed.get_bounding_rect());
+  if (samples.count < MIN_VOTES || searchRect.area() < MIN_AREA)
+    return false;
+
+  for (int pass = 0; pass < 2; pass++) {
+    bool probe = (pass == 0);
+    switch (newFb->getPF().bpp) {
+    case 8:
+      voteOld<rdr::U8>(oldFb, searchRect, samples, &votes, probe);
+      break;
+    case 16:
+      voteOld<rdr::U16>(oldFb, searchRect, samples, &votes, probe);
+      break;
+    case 32:
+      voteOld<rdr::U32>(oldFb, searchRect, samples, &votes, probe);
+      break;
+    }
+    if (votes.empty())
+      return false;
+  }
+
+  std::map<rdr::U64, int>::iterator v, best = votes.end();
+  for (v = votes.begin(); v != votes.end(); v++) {
+    if (best == votes.end() || v->second > best->second)
+      best = v;
+  }
+  if (best == votes.end() || best->second < MIN_VOTES)
+    return false;
+
+  Point offset((int)(rdr::S32)(best->first >> 32),
+               (int)(rdr::S32)(best->first & 0xffffffff));
+
+  // Check the blocks of the changed region against the old pixels they
+  // would be copied from.  Only the area which differs can have been
+  // copied to.
+
+  Rect fbRect = newFb->getRect();
+  std::vector<Rect> matched;
+  changed.intersect(searchRect).get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    for (int y = i->tl.y; y < i->br.y; y += BLOCK_SIZE) {
+      for (int x = i->tl.x; x < i->br.x; x += BLOCK_SIZE) {
+        Rect block(x, y, min_vnc(x + BLOCK_SIZE, i->br.x),
+                   min_vnc(y + BLOCK_SIZE, i->br.y));
+        if (!block.translate(offset.negate()).enclosed_by(fbRect))
+          continue;
+        if (blockMatches(oldFb, newFb, block, offset))
+          matched.push_back(block);
+      }
+    }
+  }
+
+  vlog.debug("offset %d,%d: %d votes from %d samples, %d blocks match",
+             offset.x, offset.y, best->second, samples.count,
+             (int)matched.size());
+
+  if ((int)matched.size() < MIN_BLOCKS)
+    return false;
+
+  copied->setOrderedRects(matched);
+  *delta = offset;
+  return true;
+}
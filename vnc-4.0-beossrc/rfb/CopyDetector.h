@@ -0,0 +1,44 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// CopyDetector.h - finds areas of the screen which have been scrolled or
+// moved, so that they can be sent as CopyRects.
+//
+// detectCopy() looks at the changed region of the new framebuffer, and at the
+// old copy of the framebuffer kept by ComparingUpdateTracker, and tries to
+// find a single offset by which a good part of the changed region has been
+// moved.  It samples short horizontal segments of the new pixels, hashes
+// them, and then runs a rolling hash along every row of the old pixels in
+// the changed area, with each match casting a vote for the offset between the
+// two positions.  The winning offset is then checked block by block against
+// the real pixels, and the blocks which match exactly make up the copied
+// region.  It returns false if nothing worth copying was found.
+//
+
+#ifndef __RFB_COPYDETECTOR_H__
+#define __RFB_COPYDETECTOR_H__
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
+
+namespace rfb {
+
+  bool detectCopy(PixelBuffer* oldFb, PixelBuffer* newFb,
+                  const Region& changed, Region* copied, Point* delta);
+
+}
+#endif
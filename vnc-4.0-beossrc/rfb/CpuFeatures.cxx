@@ -0,0 +1,46 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- CpuFeatures.cxx
+
+#include <rfb/CpuFeatures.h>
+
+using namespace rfb;
+
+BoolParameter CpuFeatures::useSIMD
+("UseSIMD",
+ "Use the SSE2 and AVX2 instruction set extensions for comparing and "
+ "converting pixels, if the processor has them.  Turn this off to use the "
+ "plain C code, for example when measuring the difference",
+ true);
+
+bool CpuFeatures::hasSSE2()
+{
+#ifdef RFB_HAVE_X86_SIMD
+  return useSIMD && __builtin_cpu_supports("sse2");
+#else
+  return false;
+#endif
+}
+
+bool CpuFeatures::hasAVX2()
+{
+#ifdef RFB_HAVE_X86_SIMD
+  return useSIMD && __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,54 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// CpuFeatures.h - run time detection of the optional instruction set
+// extensions used by the pixel processing kernels.
+//
+// The SIMD kernels are only compiled in when the compiler is new enough to
+// generate them for a single function (GCC 4.9 and later on x86), so older
+// compilers (such as the GCC 2.95 used for BeOS) and other processors just get
+// the portable C versions.  RFB_HAVE_X86_SIMD is defined when the SIMD
+// versions are available.
+//
+
+#ifndef __RFB_CPUFEATURES_H__
+#define __RFB_CPUFEATURES_H__
+
+#include <rfb/Configuration.h>
+
+#if defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__i386__) || defined(__x86_64__))
+#define RFB_HAVE_X86_SIMD
+#endif
+
+namespace rfb {
+
+  class CpuFeatures {
+  public:
+    // hasSSE2() and hasAVX2() return true if the processor (and operating
+    // system, for AVX2's wider registers) supports the instructions, the
+    // kernels for them were compiled in, and the UseSIMD parameter hasn't
+    // turned them off.
+    static bool hasSSE2();
+    static bool hasAVX2();
+
+    static BoolParameter useSIMD;
+  };
+
+}
+#endif
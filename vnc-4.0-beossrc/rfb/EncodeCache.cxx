@@ -0,0 +1,131 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- EncodeCache.cxx
+
+#include <rfb/EncodeCache.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+static LogWriter vlog("EncodeCache");
+
+// Once the cache holds this much data, no more is added until it is cleared.
+
+#define MAX_CACHE_BYTES (32*1024*1024)
+
+#ifdef __RFB_THREADING_IMPL
+#define CACHE_LOCK Lock l(mutex)
+#else
+#define CACHE_LOCK
+#endif
+
+bool EncodeCache::Key::operator<(const Key& k) const
+{
+  if (y != k.y) return y < k.y;
+  if (x != k.x) return x < k.x;
+  if (w != k.w) return w < k.w;
+  if (h != k.h) return h < k.h;
+  if (encoding != k.encoding) return encoding < k.encoding;
+  if (settings != k.settings) return settings < k.settings;
+  return pfIndex < k.pfIndex;
+}
+
+EncodeCache::EncodeCache() : bytes(0), hits(0), misses(0)
+{
+}
+
+EncodeCache::~EncodeCache()
+{
+}
+
+// makeKey() fills in key, returning false if the pixel format hasn't been
+// seen since the last clear() (and addFormat is false).
+
+bool EncodeCache::makeKey(const Rect& r, const PixelFormat& pf,
+                          unsigned int encoding, int settings, Key* key,
+                          bool addFormat)
+{
+  key->x = r.tl.x;
+  key->y = r.tl.y;
+  key->w = r.width();
+  key->h = r.height();
+  key->encoding = encoding;
+  key->settings = settings;
+  for (key->pfIndex = 0; key->pfIndex < (int)formats.size(); key->pfIndex++) {
+    if (formats[key->pfIndex].equal(pf))
+      return true;
+  }
+  if (!addFormat)
+    return false;
+  formats.push_back(pf);
+  return true;
+}
+
+const EncodeCache::Entry* EncodeCache::find(const Rect& r,
+                                            const PixelFormat& pf,
+                                            unsigned int encoding,
+                                            int settings)
+{
+  CACHE_LOCK;
+  Key key;
+  if (makeKey(r, pf, encoding, settings, &key, false)) {
+    std::map<Key, Entry>::iterator i = entries.find(key);
+    if (i != entries.end()) {
+      hits++;
+      return &i->second;
+    }
+  }
+  misses++;
+  return 0;
+}
+
+void EncodeCache::add(const Rect& r, const PixelFormat& pf,
+                      unsigned int encoding, int settings, const Rect& actual,
+                      bool wroteAll, unsigned int encodingUsed,
+                      const rdr::U8* data, int length)
+{
+  CACHE_LOCK;
+  if (bytes + length > MAX_CACHE_BYTES)
+    return;
+  Key key;
+  makeKey(r, pf, encoding, settings, &key, true);
+
+  // Another thread may have encoded the same rectangle at the same time.  Its
+  // entry may already be in use, so keep it rather than replacing it.
+
+  std::pair<std::map<Key, Entry>::iterator, bool> added
+    = entries.insert(std::make_pair(key, Entry()));
+  if (!added.second)
+    return;
+  Entry& entry = added.first->second;
+  entry.actual = actual;
+  entry.wroteAll = wroteAll;
+  entry.encoding = encodingUsed;
+  entry.data.assign(data, data + length);
+  bytes += length;
+}
+
+void EncodeCache::clear()
+{
+  CACHE_LOCK;
+  if (hits)
+    vlog.debug("%d rects reused, %d encoded, %d bytes", hits, misses, bytes);
+  entries.clear();
+  formats.clear();
+  bytes = 0;
+  hits = misses = 0;
+}
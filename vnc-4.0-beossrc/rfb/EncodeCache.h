@@ -0,0 +1,95 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// EncodeCache - encoded rectangles shared between clients.
+//
+// When several clients have the same pixel format and encoding, as when a
+// class all watch one screen, each of them would otherwise encode the same
+// rectangles of the same framebuffer contents for themselves.  The server
+// keeps one EncodeCache for all its clients, and SMsgWriter::writeRects()
+// looks each rectangle up in it before encoding.  An entry is the data which
+// followed the rectangle header, along with the encoding actually used and
+// the part of the rectangle which was written.
+//
+// Entries are keyed on the rectangle, pixel format, encoding and the
+// encoder's settings (see Encoder::shareable()), and are only valid for the
+// framebuffer contents they were made from, so the server calls clear()
+// whenever the framebuffer changes.
+//
+
+#ifndef __RFB_ENCODECACHE_H__
+#define __RFB_ENCODECACHE_H__
+
+#include <map>
+#include <vector>
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+#include <rfb/PixelFormat.h>
+#include <rfb/Threading.h>
+
+namespace rfb {
+
+  class EncodeCache {
+  public:
+    EncodeCache();
+    ~EncodeCache();
+
+    struct Entry {
+      Rect actual;
+      bool wroteAll;
+      unsigned int encoding;
+      std::vector<rdr::U8> data;
+    };
+
+    // find() returns the entry for the given rectangle, or null if there
+    // isn't one.  The entry stays valid until clear() is called.
+
+    const Entry* find(const Rect& r, const PixelFormat& pf,
+                      unsigned int encoding, int settings);
+
+    // add() adds an entry, unless the cache is already full or already has
+    // an entry for the rectangle.
+
+    void add(const Rect& r, const PixelFormat& pf, unsigned int encoding,
+             int settings, const Rect& actual, bool wroteAll,
+             unsigned int encodingUsed, const rdr::U8* data, int length);
+
+    void clear();
+
+  private:
+    struct Key {
+      int x, y, w, h;
+      unsigned int encoding;
+      int settings;
+      int pfIndex;
+      bool operator<(const Key& k) const;
+    };
+
+    bool makeKey(const Rect& r, const PixelFormat& pf, unsigned int encoding,
+                 int settings, Key* key, bool addFormat);
+
+    std::map<Key, Entry> entries;
+    std::vector<PixelFormat> formats;
+    int bytes;
+    int hits, misses;
+#ifdef __RFB_THREADING_IMPL
+    Mutex mutex;
+#endif
+  };
+
+}
+#endif
@@ -36,6 +36,13 @@ namespace rfb {
     // rectangle which was updated.
     virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual)=0;
 
+    // shareable() returns true if the data written by writeRect() depends
+    // only on the pixels, the pixel format and the value returned by
+    // settings(), so that it can be sent to other clients (see
+    // EncodeCache.h).  writeRect() must then write a single rectangle.
+    virtual bool shareable() { return false; }
+    virtual int settings() { return 0; }
+
     static bool supported(unsigned int encoding);
     static Encoder* createEncoder(unsigned int encoding, SMsgWriter* writer);
     static void registerEncoder(unsigned int encoding,
@@ -0,0 +1,226 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- EncodingSelector.cxx
+
+#include <rfb/EncodingSelector.h>
+#include <rfb/ConnParams.h>
+#include <rfb/ImageGetter.h>
+#include <rfb/LogWriter.h>
+#include <rfb/ServerCore.h>
+#include <rfb/encodings.h>
+
+using namespace rfb;
+
+static LogWriter vlog("EncodingSelector");
+
+static const unsigned int candidates[EncodingSelector::nCandidates] = {
+  encodingRaw, encodingRRE, encodingHextile, encodingZRLE, encodingTight
+};
+
+// The starting guesses for each class (solid, two colours, up to 16
+// colours, more), as the fraction of the raw size sent and microseconds per
+// pixel.  RRE gives up and sends raw when it would be bigger.
+
+static const double startFraction[EncodingSelector::nClasses]
+                                 [EncodingSelector::nCandidates] = {
+  { 1.0, 0.002, 0.002, 0.001, 0.001 },
+  { 1.0, 0.2,   0.12,  0.04,  0.04  },
+  { 1.0, 0.6,   0.4,   0.12,  0.12  },
+  { 1.0, 1.0,   1.05,  0.6,   0.55  }
+};
+
+static const double startMicros[EncodingSelector::nClasses]
+                               [EncodingSelector::nCandidates] = {
+  { 0.002, 0.01, 0.01, 0.02, 0.01 },
+  { 0.002, 0.02, 0.03, 0.04, 0.04 },
+  { 0.002, 0.04, 0.05, 0.06, 0.06 },
+  { 0.002, 0.03, 0.06, 0.08, 0.10 }
+};
+
+static const char* classNames[EncodingSelector::nClasses] = {
+  "solid", "two colours", "few colours", "many colours"
+};
+
+// Every EXPLORE_EVERY rectangles of a class, one of no more than
+// EXPLORE_MAX_AREA pixels is sent with the encoding tried least, until each
+// has been tried EXPLORE_ENOUGH times.
+
+#define EXPLORE_EVERY 32
+#define EXPLORE_MAX_AREA 4096
+#define EXPLORE_ENOUGH 16
+
+// Up to SAMPLE_ROWS rows of up to SAMPLE_WIDTH pixels are looked at.
+
+#define SAMPLE_ROWS 8
+#define SAMPLE_WIDTH 256
+
+EncodingSelector::EncodingSelector(ConnParams* cp_)
+  : cp(cp_), lastClass(-1), lastCandidate(0), lastPixels(0)
+{
+  for (int c = 0; c < nClasses; c++) {
+    classCount[c] = 0;
+    for (int e = 0; e < nCandidates; e++) {
+      model[c][e].rawFraction = startFraction[c][e];
+      model[c][e].microsPerPixel = startMicros[c][e];
+      model[c][e].rects = 0;
+    }
+  }
+}
+
+void EncodingSelector::logStats()
+{
+  for (int c = 0; c < nClasses; c++) {
+    if (!classCount[c]) continue;
+    vlog.info("  %s: %d rects", classNames[c], classCount[c]);
+    for (int e = 0; e < nCandidates; e++) {
+      if (!model[c][e].rects) continue;
+      vlog.info("    %s: %d rects, %.3f of raw size, %.4f us/pixel",
+                encodingName(candidates[e]), model[c][e].rects,
+                model[c][e].rawFraction, model[c][e].microsPerPixel);
+    }
+  }
+}
+
+// classify() counts the colours in each of a few rows of r, giving up at
+// more than 16.  It goes by the middle count rather than the largest, so
+// that a small busy area doesn't make a mostly plain rectangle look busy.
+
+int EncodingSelector::classify(const Rect& r, ImageGetter* ig)
+{
+  int bpp = cp->pf().bpp;
+  int w = min_vnc(r.width(), SAMPLE_WIDTH);
+  int nRows = min_vnc(r.height(), SAMPLE_ROWS);
+  int rowColours[SAMPLE_ROWS];
+  rdr::U32 firstColour = 0;
+  bool allOneColour = true;
+
+  for (int row = 0; row < nRows; row++) {
+    int y = r.tl.y + (nRows > 1 ? row * (r.height() - 1) / (nRows - 1) : 0);
+    int x = r.tl.x + (nRows > 1 ? row * (r.width() - w) / (nRows - 1) : 0);
+    Rect segment(x, y, x + w, y + 1);
+
+    int stride;
+    const rdr::U8* data = ig->getImagePtr(segment, &stride);
+    if (!data) {
+      sampleBuf.resize(w * bpp / 8);
+      ig->getImage(&sampleBuf[0], segment);
+      data = &sampleBuf[0];
+    }
+
+    rdr::U32 colours[16];
+    int nColours = 0;
+    rdr::U32 prev = 0;
+    for (int i = 0; i < w && nColours <= 16; i++) {
+      rdr::U32 pix;
+      switch (bpp) {
+      case 8:  pix = data[i]; break;
+      case 16: pix = ((const rdr::U16*)data)[i]; break;
+      default: pix = ((const rdr::U32*)data)[i]; break;
+      }
+      if (i && pix == prev) continue;
+      prev = pix;
+      int j;
+      for (j = 0; j < nColours; j++)
+        if (colours[j] == pix) break;
+      if (j == nColours) {
+        if (nColours < 16)
+          colours[j] = pix;
+        nColours++;
+      }
+    }
+
+    if (row == 0) firstColour = colours[0];
+    if (nColours > 1 || colours[0] != firstColour) allOneColour = false;
+
+    // Keep the counts sorted, for the middle one.
+    int i = row;
+    for (; i > 0 && rowColours[i - 1] > nColours; i--)
+      rowColours[i] = rowColours[i - 1];
+    rowColours[i] = nColours;
+  }
+
+  int nColours = rowColours[nRows / 2];
+  if (allOneColour) return solid;
+  if (nColours <= 2) return twoColours;
+  if (nColours <= 16) return fewColours;
+  return manyColours;
+}
+
+unsigned int EncodingSelector::select(const Rect& r, ImageGetter* ig)
+{
+  lastClass = -1;
+  if (!rfb::Server::selectEncodings)
+    return cp->currentEncoding();
+
+  bool allowed[nCandidates];
+  int nAllowed = 0;
+  int e;
+  for (e = 0; e < nCandidates; e++) {
+    allowed[e] = cp->supportsEncoding(candidates[e]);
+    if (allowed[e]) nAllowed++;
+  }
+  if (nAllowed < 2)
+    return cp->currentEncoding();
+
+  int c = classify(r, ig);
+  int area = r.area();
+  double bytesPerPixel = cp->pf().bpp / 8;
+  double bytesPerMicro = rfb::Server::encodingCpuCost / 1000.0;
+
+  int best = -1, leastTried = -1;
+  double bestCost = 0;
+  for (e = 0; e < nCandidates; e++) {
+    if (!allowed[e]) continue;
+    double cost = (model[c][e].rawFraction * bytesPerPixel +
+                   model[c][e].microsPerPixel * bytesPerMicro);
+    if (best < 0 || cost < bestCost) {
+      best = e;
+      bestCost = cost;
+    }
+    if (leastTried < 0 || model[c][e].rects < model[c][leastTried].rects)
+      leastTried = e;
+  }
+
+  if (++classCount[c] % EXPLORE_EVERY == 0 && area <= EXPLORE_MAX_AREA &&
+      model[c][leastTried].rects < EXPLORE_ENOUGH)
+    best = leastTried;
+
+  lastClass = c;
+  lastCandidate = best;
+  lastPixels = area;
+  return candidates[best];
+}
+
+// record() moves the model a tenth of the way towards what was measured.
+// Small rectangles say little about the cost per pixel, so count for less.
+
+void EncodingSelector::record(int bytes, int micros)
+{
+  if (lastClass < 0 || lastPixels <= 0)
+    return;
+
+  Cost* cost = &model[lastClass][lastCandidate];
+  double rawBytes = (double)lastPixels * cp->pf().bpp / 8;
+  double weight = 0.1 * min_vnc(1.0, lastPixels / 1024.0);
+  bytes = max_vnc(bytes - 12, 0);
+
+  cost->rawFraction += weight * (bytes / rawBytes - cost->rawFraction);
+  cost->microsPerPixel += weight * ((double)micros / lastPixels -
+                                    cost->microsPerPixel);
+  cost->rects++;
+  lastClass = -1;
+}
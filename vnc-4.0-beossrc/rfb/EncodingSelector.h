@@ -0,0 +1,80 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- EncodingSelector.h
+//
+// An EncodingSelector chooses the encoding for each rectangle of an update
+// from those the client supports, rather than always using the client's
+// favourite.  It looks at a sample of the rectangle's pixels to put it into
+// one of a few classes by how many colours it has, and picks the encoding
+// which its model says will cost least for that class.
+//
+// The cost of an encoding is the bytes it sends plus the time it takes,
+// counted as EncodingCPUCost bytes per millisecond.  The model holds, for
+// each class and encoding, the bytes sent as a fraction of the raw size and
+// the time taken per pixel.  It starts off with rough guesses, and learns
+// from record() being told how each rectangle it chose actually went.  Now
+// and again a small rectangle is sent with an encoding which hasn't been
+// tried much, so that the model doesn't get stuck with its first guesses,
+// until every encoding has been tried a few times.
+
+#ifndef __RFB_ENCODINGSELECTOR_H__
+#define __RFB_ENCODINGSELECTOR_H__
+
+#include <vector>
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  class ConnParams;
+  class ImageGetter;
+
+  class EncodingSelector {
+  public:
+    EncodingSelector(ConnParams* cp);
+
+    // select() returns the encoding to use for r.
+    unsigned int select(const Rect& r, ImageGetter* ig);
+
+    // record() tells the model how many bytes, including the rectangle
+    // header, and microseconds the rectangle last given by select() took.
+    void record(int bytes, int micros);
+
+    void logStats();
+
+    enum { solid, twoColours, fewColours, manyColours, nClasses };
+    enum { nCandidates = 5 };
+
+  private:
+    int classify(const Rect& r, ImageGetter* ig);
+
+    ConnParams* cp;
+
+    struct Cost {
+      double rawFraction;
+      double microsPerPixel;
+      int rects;
+    };
+    Cost model[nClasses][nCandidates];
+    int classCount[nClasses];
+
+    int lastClass, lastCandidate, lastPixels;
+    std::vector<rdr::U8> sampleBuf;
+  };
+
+}
+#endif
@@ -24,6 +24,7 @@ using namespace rfb;
 
 #define EXTRA_ARGS ImageGetter* ig
 #define GET_IMAGE_INTO_BUF(r,buf) ig->getImage(buf, r);
+#define GET_IMAGE_PTR(r,stride) ig->getImagePtr(r, stride)
 #define BPP 8
 #include <rfb/hextileEncode.h>
 #undef BPP
@@ -26,6 +26,7 @@ namespace rfb {
   public:
     static Encoder* create(SMsgWriter* writer);
     virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual);
+    virtual bool shareable() { return true; }
     virtual ~HextileEncoder();
   private:
     HextileEncoder(SMsgWriter* writer);
@@ -0,0 +1,265 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <rfb/CpuFeatures.h>
+#include <rfb/HextileKernels.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Threading.h>
+
+#ifdef RFB_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace rfb;
+
+static LogWriter vlog("HextileKernels");
+
+// The C versions are templates on the pixel type, so that the inner loops
+// don't have to switch on the pixel size.  A row which is all the tile's
+// first pixel, as most are, gives the other masks without comparing again.
+
+template<class PIXEL>
+static void tileMasksC(const rdr::U8* data, int stride, int w, int h,
+                       HextileMasks* masks)
+{
+  const rdr::U32 full = (1 << w) - 1;
+  const PIXEL* row = (const PIXEL*)data;
+  const PIXEL* prevRow = 0;
+  PIXEL first = row[0];
+  bool prevAllFirst = false;
+  for (int y = 0; y < h; y++) {
+    rdr::U32 left = 0, above = 0, same = 0;
+    int x;
+    for (x = 0; x < w; x++)
+      same |= (rdr::U32)(row[x] == first) << x;
+    bool allFirst = (same == full);
+    if (allFirst) {
+      left = full & ~1;
+    } else {
+      for (x = 1; x < w; x++)
+        left |= (rdr::U32)(row[x] == row[x-1]) << x;
+    }
+    if (prevRow) {
+      if (allFirst && prevAllFirst) {
+        above = full;
+      } else {
+        for (x = 0; x < w; x++)
+          above |= (rdr::U32)(row[x] == prevRow[x]) << x;
+      }
+    }
+    masks->left[y] = left;
+    masks->above[y] = above;
+    masks->first[y] = same;
+    prevAllFirst = allFirst;
+    prevRow = row;
+    row = (const PIXEL*)((const rdr::U8*)row + stride);
+  }
+}
+
+template<class PIXEL>
+static void matchMasksC(const rdr::U8* data, int stride, int w, int h,
+                        rdr::U32 pixel, rdr::U16* match)
+{
+  for (int y = 0; y < h; y++) {
+    const PIXEL* row = (const PIXEL*)(data + y * stride);
+    rdr::U32 same = 0;
+    for (int x = 0; x < w; x++)
+      same |= (rdr::U32)(row[x] == (PIXEL)pixel) << x;
+    match[y] = same;
+  }
+}
+
+static void tileMasksC(const rdr::U8* data, int stride, int w, int h,
+                       int bytesPerPixel, HextileMasks* masks)
+{
+  switch (bytesPerPixel) {
+  case 1:  tileMasksC<rdr::U8>(data, stride, w, h, masks);  break;
+  case 2:  tileMasksC<rdr::U16>(data, stride, w, h, masks); break;
+  default: tileMasksC<rdr::U32>(data, stride, w, h, masks); break;
+  }
+}
+
+static void matchMasksC(const rdr::U8* data, int stride, int w, int h,
+                        int bytesPerPixel, rdr::U32 pixel, rdr::U16* match)
+{
+  switch (bytesPerPixel) {
+  case 1:  matchMasksC<rdr::U8>(data, stride, w, h, pixel, match);  break;
+  case 2:  matchMasksC<rdr::U16>(data, stride, w, h, pixel, match); break;
+  default: matchMasksC<rdr::U32>(data, stride, w, h, pixel, match); break;
+  }
+}
+
+#ifdef RFB_HAVE_X86_SIMD
+
+// The SSE2 versions only do full width tiles.  A row is one to four
+// registers, and the row shifted right by a pixel, for comparing each pixel
+// with the one to its left, comes from shifting the first register and from
+// loads a pixel back for the others, so nothing outside the row is read.
+// rowEqual() turns the comparison of two rows into a bitmask.
+
+__attribute__((target("sse2")))
+static inline rdr::U32 rowEqual(const __m128i* a, const __m128i* b,
+                                int bytesPerPixel)
+{
+  switch (bytesPerPixel) {
+  case 1:
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a[0], b[0]));
+  case 2:
+    return _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a[0], b[0]),
+                                             _mm_cmpeq_epi16(a[1], b[1])));
+  default:
+    return (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a[0], b[0]))) |
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a[1], b[1])))
+            << 4 |
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a[2], b[2])))
+            << 8 |
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a[3], b[3])))
+            << 12);
+  }
+}
+
+__attribute__((target("sse2")))
+static inline __m128i broadcast(rdr::U32 pixel, int bytesPerPixel)
+{
+  switch (bytesPerPixel) {
+  case 1:  return _mm_set1_epi8((char)pixel);
+  case 2:  return _mm_set1_epi16((short)pixel);
+  default: return _mm_set1_epi32((int)pixel);
+  }
+}
+
+__attribute__((target("sse2")))
+static void tileMasksSSE2(const rdr::U8* data, int stride, int w, int h,
+                          int bytesPerPixel, HextileMasks* masks)
+{
+  if (w != 16) {
+    tileMasksC(data, stride, w, h, bytesPerPixel, masks);
+    return;
+  }
+
+  int nRegs = bytesPerPixel;
+  rdr::U32 firstPixel = (bytesPerPixel == 1 ? *data :
+                         bytesPerPixel == 2 ? *(const rdr::U16*)data :
+                         *(const rdr::U32*)data);
+  __m128i first[4], row[4], prevRow[4], shifted[4];
+  for (int i = 0; i < 4; i++)
+    first[i] = broadcast(firstPixel, bytesPerPixel);
+
+  for (int y = 0; y < h; y++) {
+    const rdr::U8* p = data + y * stride;
+    for (int i = 0; i < nRegs; i++)
+      row[i] = _mm_loadu_si128((const __m128i*)(p + i * 16));
+    switch (bytesPerPixel) {
+    case 1:  shifted[0] = _mm_slli_si128(row[0], 1); break;
+    case 2:  shifted[0] = _mm_slli_si128(row[0], 2); break;
+    default: shifted[0] = _mm_slli_si128(row[0], 4); break;
+    }
+    for (int i = 1; i < nRegs; i++)
+      shifted[i] = _mm_loadu_si128((const __m128i*)(p + i * 16 -
+                                                    bytesPerPixel));
+
+    masks->left[y] = rowEqual(row, shifted, bytesPerPixel) & 0xfffe;
+    masks->above[y] = y ? rowEqual(row, prevRow, bytesPerPixel) : 0;
+    masks->first[y] = rowEqual(row, first, bytesPerPixel);
+    for (int i = 0; i < nRegs; i++)
+      prevRow[i] = row[i];
+  }
+}
+
+__attribute__((target("sse2")))
+static void matchMasksSSE2(const rdr::U8* data, int stride, int w, int h,
+                           int bytesPerPixel, rdr::U32 pixel,
+                           rdr::U16* match)
+{
+  if (w != 16) {
+    matchMasksC(data, stride, w, h, bytesPerPixel, pixel, match);
+    return;
+  }
+
+  int nRegs = bytesPerPixel;
+  __m128i pix[4], row[4];
+  for (int i = 0; i < 4; i++)
+    pix[i] = broadcast(pixel, bytesPerPixel);
+
+  for (int y = 0; y < h; y++) {
+    const rdr::U8* p = data + y * stride;
+    for (int i = 0; i < nRegs; i++)
+      row[i] = _mm_loadu_si128((const __m128i*)(p + i * 16));
+    match[y] = rowEqual(row, pix, bytesPerPixel);
+  }
+}
+
+#endif
+
+typedef void (*tileMasksFnType)(const rdr::U8* data, int stride, int w,
+                                int h, int bytesPerPixel,
+                                HextileMasks* masks);
+typedef void (*matchMasksFnType)(const rdr::U8* data, int stride, int w,
+                                 int h, int bytesPerPixel, rdr::U32 pixel,
+                                 rdr::U16* match);
+
+// The kernels are picked the first time one is needed, rather than when the
+// program starts, so that the UseSIMD parameter has been set by then.  Any of
+// the update threads may get here first, so the choice is made under a lock,
+// and each pointer is only set once, to its final value.
+
+static Mutex selectLock;
+static tileMasksFnType tileMasks = 0;
+static matchMasksFnType matchMasks = 0;
+
+static void selectKernels()
+{
+  Lock l(selectLock);
+  if (tileMasks)
+    return;
+
+  tileMasksFnType tm = tileMasksC;
+  matchMasksFnType mm = matchMasksC;
+  const char* name = "C";
+#ifdef RFB_HAVE_X86_SIMD
+  if (CpuFeatures::hasSSE2()) {
+    tm = tileMasksSSE2;
+    mm = matchMasksSSE2;
+    name = "SSE2";
+  }
+#endif
+  vlog.info("using %s Hextile tile analysis", name);
+  matchMasks = mm;
+  tileMasks = tm;
+}
+
+void rfb::hextileTileMasks(const rdr::U8* data, int stride, int w, int h,
+                           int bytesPerPixel, HextileMasks* masks)
+{
+  tileMasksFnType fn = tileMasks;
+  if (!fn) {
+    selectKernels();
+    fn = tileMasks;
+  }
+  (*fn)(data, stride, w, h, bytesPerPixel, masks);
+}
+
+void rfb::hextileMatchMasks(const rdr::U8* data, int stride, int w, int h,
+                            int bytesPerPixel, rdr::U32 pixel,
+                            rdr::U16* match)
+{
+  matchMasksFnType fn = matchMasks;
+  if (!fn) {
+    selectKernels();
+    fn = matchMasks;
+  }
+  (*fn)(data, stride, w, h, bytesPerPixel, pixel, match);
+}
@@ -0,0 +1,73 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// HextileKernels.h - the pixel comparisons behind the Hextile encoder's
+// tile classification and subrectangle search.
+//
+// hextileTileMasks() compares every pixel of a tile of up to 16x16 pixels
+// with its neighbours, giving for each row a bitmask of the pixels which are
+// the same as the one to their left, one of those the same as the one above,
+// and one of those the same as the tile's first pixel (bit 0 is the leftmost
+// pixel).  hextileMatchMasks() gives the masks of the pixels which are the
+// same as a given one.  From these the encoder can count colours and find
+// subrectangles with bit operations, without going back to the pixels or
+// overwriting them.
+//
+// Full width tiles are done with SSE2 if the processor has it, and the rest
+// in plain C.  Pixels are compared as they are in memory, so the pixel given
+// to hextileMatchMasks() must be of bytesPerPixel bytes (1, 2 or 4).
+//
+
+#ifndef __RFB_HEXTILEKERNELS_H__
+#define __RFB_HEXTILEKERNELS_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  struct HextileMasks {
+    rdr::U16 left[16];
+    rdr::U16 above[16];
+    rdr::U16 first[16];
+  };
+
+  void hextileTileMasks(const rdr::U8* data, int stride, int w, int h,
+                        int bytesPerPixel, HextileMasks* masks);
+
+  void hextileMatchMasks(const rdr::U8* data, int stride, int w, int h,
+                         int bytesPerPixel, rdr::U32 pixel,
+                         rdr::U16* match);
+
+  // hextileCountBits() counts the bits set in a row mask, and
+  // hextileLowestBit() gives the index of the lowest one, which must exist.
+
+  inline int hextileCountBits(rdr::U32 x) {
+    x = x - ((x >> 1) & 0x5555);
+    x = (x & 0x3333) + ((x >> 2) & 0x3333);
+    x = (x + (x >> 4)) & 0x0f0f;
+    return (x + (x >> 8)) & 0x1f;
+  }
+
+  inline int hextileLowestBit(rdr::U32 x) {
+    static const rdr::U8 position[32] = {
+      0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+      31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+    };
+    return position[((x & (0 - x)) * 0x077CB531U) >> 27];
+  }
+}
+#endif
@@ -18,6 +18,7 @@
 #ifndef __RFB_IMAGEGETTER_H__
 #define __RFB_IMAGEGETTER_H__
 
+#include <rdr/types.h>
 #include <rfb/Rect.h>
 
 namespace rfb {
@@ -25,6 +26,25 @@ namespace rfb {
   public:
     virtual void getImage(void* imageBuf,
                           const Rect& r, int stride=0) = 0;
+
+    // getImagePtr() returns a pointer to the pixels of the given rectangle
+    // where they already are in the format getImage() would give, setting
+    // stride to the distance between rows in pixels.  The pixels must not
+    // be altered.  If they would need translating, it returns 0 and
+    // getImage() has to be used instead.
+    virtual const rdr::U8* getImagePtr(const Rect& r, int* stride) {
+      return 0;
+    }
+
+    // getSourcePtr() returns a pointer to the pixels of the given rectangle
+    // before they are translated, setting stride to the distance between
+    // rows in bytes and bytesPerPixel to the size of a pixel.  Pixels which
+    // are the same there come out the same from getImage().  It returns 0 if
+    // there is no such buffer.
+    virtual const rdr::U8* getSourcePtr(const Rect& r, int* stride,
+                                        int* bytesPerPixel) {
+      return 0;
+    }
   };
 }
 #endif
@@ -0,0 +1,773 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+#include <rfb/CpuFeatures.h>
+#include <rfb/JpegCompressor.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Threading.h>
+
+#ifdef RFB_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace rfb;
+
+static LogWriter vlog("JpegCompressor");
+
+// The order in which the coefficients of a block are sent, as indexes into
+// the block in its natural order.
+
+static const int zigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// The example quantization tables from Annex K of the JPEG standard, for
+// luminance and chrominance, in natural order.
+
+static const int baseQuant[2][64] = {
+  { 16,  11,  10,  16,  24,  40,  51,  61,
+    12,  12,  14,  19,  26,  58,  60,  55,
+    14,  13,  16,  24,  40,  57,  69,  56,
+    14,  17,  22,  29,  51,  87,  80,  62,
+    18,  22,  37,  56,  68, 109, 103,  77,
+    24,  35,  55,  64,  81, 104, 113,  92,
+    49,  64,  78,  87, 103, 121, 120, 101,
+    72,  92,  95,  98, 112, 100, 103,  99 },
+  { 17,  18,  24,  47,  99,  99,  99,  99,
+    18,  21,  26,  66,  99,  99,  99,  99,
+    24,  26,  56,  99,  99,  99,  99,  99,
+    47,  66,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99 }
+};
+
+// The example Huffman tables from Annex K, as the number of codes of each
+// length from 1 to 16 bits followed by the symbols in order of code.
+// Luminance DC, chrominance DC, luminance AC and chrominance AC.
+
+static const rdr::U8 dcBits[2][16] = {
+  { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+  { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 }
+};
+
+static const rdr::U8 dcValues[12] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const rdr::U8 acBits[2][16] = {
+  { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+  { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 }
+};
+
+static const rdr::U8 acValues[2][162] = {
+  { 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa },
+  { 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa }
+};
+
+// The code and its length in bits for each symbol of each table, made from
+// the tables above when the first JpegCompressor is made.
+
+struct HuffTable {
+  rdr::U16 code[256];
+  rdr::U8 size[256];
+};
+
+static HuffTable dcTable[2];
+static HuffTable acTable[2];
+
+// nBits gives the number of bits in a coefficient, or the difference
+// between two DC coefficients, which is never more than 2047.
+
+static rdr::U8 nBits[2048];
+
+static void makeTable(const rdr::U8* bits, const rdr::U8* values,
+                      HuffTable* table)
+{
+  memset(table, 0, sizeof(*table));
+  int code = 0;
+  int k = 0;
+  for (int len = 1; len <= 16; len++) {
+    for (int i = 0; i < bits[len-1]; i++, k++) {
+      table->code[values[k]] = code++;
+      table->size[values[k]] = len;
+    }
+    code <<= 1;
+  }
+}
+
+static void makeTables()
+{
+  for (int i = 0; i < 2; i++) {
+    makeTable(dcBits[i], dcValues, &dcTable[i]);
+    makeTable(acBits[i], acValues[i], &acTable[i]);
+  }
+  for (int v = 1; v < 2048; v++)
+    nBits[v] = nBits[v / 2] + 1;
+}
+
+// The floating point DCT is the one by Arai, Agui and Nakajima, as in the
+// IJG library, which leaves each coefficient multiplied by a factor for its
+// row and one for its column.  Those are taken out when quantizing, by
+// multiplying by the divisors set up by setQuality().
+
+static const double aanScale[8] = {
+  1.0, 1.387039845, 1.306562965, 1.175875602,
+  1.0, 0.785694958, 0.541196100, 0.275899379
+};
+
+//
+// The kernels.
+//
+// convertRow() turns n pixels of 32 bits, with eight bit components at the
+// given shifts, into Y, Cb and Cr, using the JFIF formulas with 14 bits of
+// fraction.  fdctQuantize() takes an 8x8 block of samples, level shifts
+// them, and gives its quantized coefficients in natural order.  The SSE2
+// versions give exactly the same results as the C ones.
+//
+
+#define FIX(x) ((int)((x) * 16384 + 0.5))
+
+static const int yR = FIX(0.29900), yG = FIX(0.58700), yB = FIX(0.11400);
+static const int cbR = -FIX(0.16874), cbG = -FIX(0.33126), cbB = 8192;
+static const int crR = 8192, crG = -FIX(0.41869), crB = -FIX(0.08131);
+static const int yRound = 8192;
+static const int cRound = (128 << 14) + 8192;
+
+static void convertRowC(const rdr::U32* pixels, int n, int rShift,
+                        int gShift, int bShift, rdr::U8* y, rdr::U8* cb,
+                        rdr::U8* cr)
+{
+  for (int i = 0; i < n; i++) {
+    int r = (pixels[i] >> rShift) & 0xff;
+    int g = (pixels[i] >> gShift) & 0xff;
+    int b = (pixels[i] >> bShift) & 0xff;
+    int cbv = (cbR * r + cbG * g + cbB * b + cRound) >> 14;
+    int crv = (crR * r + crG * g + crB * b + cRound) >> 14;
+    y[i] = (yR * r + yG * g + yB * b + yRound) >> 14;
+    cb[i] = cbv > 255 ? 255 : cbv;
+    cr[i] = crv > 255 ? 255 : crv;
+  }
+}
+
+#define DCT_PASS(d0, d1, d2, d3, d4, d5, d6, d7, T, ADD, SUB, MUL, K)      \
+  {                                                                         \
+    T tmp0 = ADD(d0, d7), tmp7 = SUB(d0, d7);                               \
+    T tmp1 = ADD(d1, d6), tmp6 = SUB(d1, d6);                               \
+    T tmp2 = ADD(d2, d5), tmp5 = SUB(d2, d5);                               \
+    T tmp3 = ADD(d3, d4), tmp4 = SUB(d3, d4);                               \
+    T tmp10 = ADD(tmp0, tmp3), tmp13 = SUB(tmp0, tmp3);                     \
+    T tmp11 = ADD(tmp1, tmp2), tmp12 = SUB(tmp1, tmp2);                     \
+    d0 = ADD(tmp10, tmp11);                                                 \
+    d4 = SUB(tmp10, tmp11);                                                 \
+    T z1 = MUL(ADD(tmp12, tmp13), K(0.707106781f));                         \
+    d2 = ADD(tmp13, z1);                                                    \
+    d6 = SUB(tmp13, z1);                                                    \
+    tmp10 = ADD(tmp4, tmp5);                                                \
+    tmp11 = ADD(tmp5, tmp6);                                                \
+    tmp12 = ADD(tmp6, tmp7);                                                \
+    T z5 = MUL(SUB(tmp10, tmp12), K(0.382683433f));                         \
+    T z2 = ADD(MUL(tmp10, K(0.541196100f)), z5);                            \
+    T z4 = ADD(MUL(tmp12, K(1.306562965f)), z5);                            \
+    T z3 = MUL(tmp11, K(0.707106781f));                                     \
+    T z11 = ADD(tmp7, z3), z13 = SUB(tmp7, z3);                             \
+    d5 = ADD(z13, z2);                                                      \
+    d3 = SUB(z13, z2);                                                      \
+    d1 = ADD(z11, z4);                                                      \
+    d7 = SUB(z11, z4);                                                      \
+  }
+
+#define F_ADD(a, b) ((a) + (b))
+#define F_SUB(a, b) ((a) - (b))
+#define F_MUL(a, b) ((a) * (b))
+#define F_K(k) (k)
+
+// Coefficients are rounded by adding a half and truncating, with an offset
+// to keep the sum positive, and AC ones are limited to what a baseline
+// Huffman table can code.
+
+static void fdctQuantizeC(const rdr::U8* in, int stride,
+                          const float* divisors, rdr::S16* out)
+{
+  float b[64];
+  int i;
+  for (i = 0; i < 8; i++)
+    for (int j = 0; j < 8; j++)
+      b[i*8 + j] = (float)in[i * stride + j] - 128;
+
+  for (i = 0; i < 8; i++) {
+    float* r = &b[i*8];
+    DCT_PASS(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7],
+             float, F_ADD, F_SUB, F_MUL, F_K);
+  }
+  for (i = 0; i < 8; i++) {
+    float* c = &b[i];
+    DCT_PASS(c[0], c[8], c[16], c[24], c[32], c[40], c[48], c[56],
+             float, F_ADD, F_SUB, F_MUL, F_K);
+  }
+
+  for (i = 0; i < 64; i++)
+    out[i] = (int)(b[i] * divisors[i] + 16384.5f) - 16384;
+  for (i = 1; i < 64; i++) {
+    if (out[i] > 1023) out[i] = 1023;
+    else if (out[i] < -1023) out[i] = -1023;
+  }
+}
+
+#ifdef RFB_HAVE_X86_SIMD
+
+// The SSE2 colour conversion does eight pixels at a time.  Each component
+// is pulled out into a 32-bit lane, red and green are put together as a
+// pair of 16-bit values for _mm_madd_epi16(), and blue is done on its own.
+
+__attribute__((target("sse2")))
+static inline __m128i convert4(__m128i rg, __m128i b, __m128i kRG,
+                               __m128i kB, __m128i round)
+{
+  return _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rg, kRG),
+                                                    _mm_madd_epi16(b, kB)),
+                                      round), 14);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pair(int a, int b)
+{
+  return _mm_set1_epi32((a & 0xffff) | (b << 16));
+}
+
+__attribute__((target("sse2")))
+static void convertRowSSE2(const rdr::U32* pixels, int n, int rShift,
+                           int gShift, int bShift, rdr::U8* y, rdr::U8* cb,
+                           rdr::U8* cr)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i rs = _mm_cvtsi32_si128(rShift);
+  const __m128i gs = _mm_cvtsi32_si128(gShift);
+  const __m128i bs = _mm_cvtsi32_si128(bShift);
+  const __m128i kYRG = pair(yR, yG), kYB = _mm_set1_epi32(yB);
+  const __m128i kCbRG = pair(cbR, cbG), kCbB = _mm_set1_epi32(cbB);
+  const __m128i kCrRG = pair(crR, crG), kCrB = _mm_set1_epi32(crB);
+  const __m128i kYRound = _mm_set1_epi32(yRound);
+  const __m128i kCRound = _mm_set1_epi32(cRound);
+
+  int i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i rg[2], b[2];
+    for (int j = 0; j < 2; j++) {
+      __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i + j * 4));
+      __m128i r = _mm_and_si128(_mm_srl_epi32(p, rs), mask);
+      __m128i g = _mm_and_si128(_mm_srl_epi32(p, gs), mask);
+      b[j] = _mm_and_si128(_mm_srl_epi32(p, bs), mask);
+      rg[j] = _mm_or_si128(r, _mm_slli_epi32(g, 16));
+    }
+    __m128i yv = _mm_packs_epi32(convert4(rg[0], b[0], kYRG, kYB, kYRound),
+                                 convert4(rg[1], b[1], kYRG, kYB, kYRound));
+    __m128i cbv = _mm_packs_epi32(convert4(rg[0], b[0], kCbRG, kCbB,
+                                           kCRound),
+                                  convert4(rg[1], b[1], kCbRG, kCbB,
+                                           kCRound));
+    __m128i crv = _mm_packs_epi32(convert4(rg[0], b[0], kCrRG, kCrB,
+                                           kCRound),
+                                  convert4(rg[1], b[1], kCrRG, kCrB,
+                                           kCRound));
+    _mm_storel_epi64((__m128i*)(y + i), _mm_packus_epi16(yv, yv));
+    _mm_storel_epi64((__m128i*)(cb + i), _mm_packus_epi16(cbv, cbv));
+    _mm_storel_epi64((__m128i*)(cr + i), _mm_packus_epi16(crv, crv));
+  }
+  convertRowC(pixels + i, n - i, rShift, gShift, bShift,
+              y + i, cb + i, cr + i);
+}
+
+// The SSE2 DCT does the columns of each half of the block at once, with a
+// row of four in each register, then turns the block round a 4x4 quarter
+// at a time and does the same again for the rows, and turns it back.
+
+#define V_ADD(a, b) _mm_add_ps(a, b)
+#define V_SUB(a, b) _mm_sub_ps(a, b)
+#define V_MUL(a, b) _mm_mul_ps(a, b)
+#define V_K(k) _mm_set1_ps(k)
+
+__attribute__((target("sse2")))
+static inline void dctColumns(__m128 v[8][2])
+{
+  for (int h = 0; h < 2; h++) {
+    DCT_PASS(v[0][h], v[1][h], v[2][h], v[3][h],
+             v[4][h], v[5][h], v[6][h], v[7][h],
+             __m128, V_ADD, V_SUB, V_MUL, V_K);
+  }
+}
+
+__attribute__((target("sse2")))
+static inline void transpose(__m128 v[8][2])
+{
+  for (int i = 0; i < 2; i++) {
+    for (int h = 0; h < 2; h++)
+      _MM_TRANSPOSE4_PS(v[i*4][h], v[i*4+1][h], v[i*4+2][h], v[i*4+3][h]);
+  }
+  for (int k = 0; k < 4; k++) {
+    __m128 tmp = v[k][1];
+    v[k][1] = v[k+4][0];
+    v[k+4][0] = tmp;
+  }
+}
+
+__attribute__((target("sse2")))
+static void fdctQuantizeSSE2(const rdr::U8* in, int stride,
+                             const float* divisors, rdr::S16* out)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 level = _mm_set1_ps(128);
+  __m128 v[8][2];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    __m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)
+                                                  (in + i * stride)), zero);
+    v[i][0] = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s, zero)),
+                         level);
+    v[i][1] = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s, zero)),
+                         level);
+  }
+
+  // The C version does the rows first, and the order changes the rounding
+  // a little, so do the same.
+  transpose(v);
+  dctColumns(v);
+  transpose(v);
+  dctColumns(v);
+
+  const __m128 offset = _mm_set1_ps(16384.5f);
+  const __m128i unoffset = _mm_set1_epi32(16384);
+  const __m128i acMax = _mm_set1_epi16(1023);
+  const __m128i acMin = _mm_set1_epi16(-1023);
+  for (i = 0; i < 8; i++) {
+    __m128i q[2];
+    for (int h = 0; h < 2; h++) {
+      __m128 d = _mm_loadu_ps(divisors + i * 8 + h * 4);
+      q[h] = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v[i][h], d),
+                                                       offset)),
+                           unoffset);
+    }
+    __m128i row = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(q[0], q[1]),
+                                              acMax), acMin);
+    _mm_storeu_si128((__m128i*)(out + i * 8), row);
+  }
+  out[0] = (int)(_mm_cvtss_f32(v[0][0]) * divisors[0] + 16384.5f) - 16384;
+}
+
+#endif
+
+typedef void (*convertRowFnType)(const rdr::U32* pixels, int n, int rShift,
+                                 int gShift, int bShift, rdr::U8* y,
+                                 rdr::U8* cb, rdr::U8* cr);
+typedef void (*fdctQuantizeFnType)(const rdr::U8* in, int stride,
+                                   const float* divisors, rdr::S16* out);
+
+static convertRowFnType convertRowFn = 0;
+static fdctQuantizeFnType fdctQuantizeFn = 0;
+
+static void selectKernels()
+{
+  convertRowFnType cr = convertRowC;
+  fdctQuantizeFnType fq = fdctQuantizeC;
+  const char* name = "C";
+#ifdef RFB_HAVE_X86_SIMD
+  if (CpuFeatures::hasSSE2()) {
+    cr = convertRowSSE2;
+    fq = fdctQuantizeSSE2;
+    name = "SSE2";
+  }
+#endif
+  convertRowFn = cr;
+  fdctQuantizeFn = fq;
+  vlog.info("using %s JPEG colour conversion and DCT", name);
+}
+
+//
+// JpegCompressor
+//
+
+// The tables and kernels are set up by the first JpegCompressor, rather than
+// when the program starts, so that the UseSIMD parameter has been set by
+// then.  Compressors for different connections can be made at the same time
+// by the update threads, so this is done under a lock, which every
+// constructor takes so that it sees the finished tables.  There's one
+// compressor per connection at most, so that costs nothing.
+
+static Mutex setupLock;
+static bool setupDone = false;
+
+JpegCompressor::JpegCompressor()
+  : mos(65536), quality_(-1), subsample(true), swap(false), direct(false),
+    bitBuf(0), bitCount(0)
+{
+  Lock l(setupLock);
+  if (!setupDone) {
+    makeTables();
+    selectKernels();
+    setupDone = true;
+  }
+}
+
+// setQuality() scales the example tables as the IJG library does, so that
+// quality 50 gives them as they are.  Colour is only kept at full size for
+// the highest qualities.
+
+void JpegCompressor::setQuality(int quality)
+{
+  if (quality < 1) quality = 1;
+  if (quality > 100) quality = 100;
+  if (quality == quality_) return;
+  quality_ = quality;
+  subsample = (quality < 90);
+
+  int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  for (int t = 0; t < 2; t++) {
+    for (int i = 0; i < 64; i++) {
+      int q = (baseQuant[t][i] * scale + 50) / 100;
+      if (q < 1) q = 1;
+      if (q > 255) q = 255;
+      quant[t][i] = q;
+      divisors[t][i] = (float)(1.0 / (q * aanScale[i / 8] * aanScale[i % 8] *
+                                      8.0));
+    }
+  }
+}
+
+void JpegCompressor::writeHeaders(int w, int h)
+{
+  static const rdr::U8 app0[18] = {
+    0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0
+  };
+  int t, i;
+
+  mos.writeU16(0xffd8);
+  mos.writeBytes(app0, sizeof(app0));
+
+  mos.writeU16(0xffdb);
+  mos.writeU16(2 + 2 * 65);
+  for (t = 0; t < 2; t++) {
+    mos.writeU8(t);
+    for (i = 0; i < 64; i++)
+      mos.writeU8(quant[t][zigzag[i]]);
+  }
+
+  mos.writeU16(0xffc0);
+  mos.writeU16(17);
+  mos.writeU8(8);
+  mos.writeU16(h);
+  mos.writeU16(w);
+  mos.writeU8(3);
+  for (i = 0; i < 3; i++) {
+    mos.writeU8(i + 1);
+    mos.writeU8(i == 0 && subsample ? 0x22 : 0x11);
+    mos.writeU8(i == 0 ? 0 : 1);
+  }
+
+  mos.writeU16(0xffc4);
+  mos.writeU16(2 + 2 * (17 + 12) + 2 * (17 + 162));
+  for (t = 0; t < 2; t++) {
+    mos.writeU8(t);
+    mos.writeBytes(dcBits[t], 16);
+    mos.writeBytes(dcValues, 12);
+    mos.writeU8(0x10 | t);
+    mos.writeBytes(acBits[t], 16);
+    mos.writeBytes(acValues[t], 162);
+  }
+
+  mos.writeU16(0xffda);
+  mos.writeU16(12);
+  mos.writeU8(3);
+  for (i = 0; i < 3; i++) {
+    mos.writeU8(i + 1);
+    mos.writeU8(i == 0 ? 0x00 : 0x11);
+  }
+  mos.writeU8(0);
+  mos.writeU8(63);
+  mos.writeU8(0);
+}
+
+// setFormat() works out how convertRow() is to get a row of pixels into
+// the form the kernel wants.  Pixels of 32 bits with a whole byte for each
+// component can go straight in, with the shifts changed if they're the
+// other way round from ours.  Others are first made into 32-bit pixels,
+// with each component scaled to eight bits by a table.
+
+void JpegCompressor::setFormat(const PixelFormat& pf)
+{
+  rdr::U32 endianTest = 1;
+  bool nativeBigEndian = *(rdr::U8*)(&endianTest) != 1;
+
+  pf_ = pf;
+  swap = (pf.bpp > 8 && pf.bigEndian != nativeBigEndian);
+  direct = (pf.bpp == 32 && pf.redMax == 255 && pf.greenMax == 255 &&
+            pf.blueMax == 255 && pf.redShift % 8 == 0 &&
+            pf.greenShift % 8 == 0 && pf.blueShift % 8 == 0);
+
+  if (direct) {
+    shift[0] = swap ? 24 - pf.redShift : pf.redShift;
+    shift[1] = swap ? 24 - pf.greenShift : pf.greenShift;
+    shift[2] = swap ? 24 - pf.blueShift : pf.blueShift;
+    return;
+  }
+
+  const int max[3] = { pf.redMax, pf.greenMax, pf.blueMax };
+  for (int c = 0; c < 3; c++) {
+    scale[c].resize(max[c] + 1);
+    for (int v = 0; v <= max[c]; v++)
+      scale[c][v] = (v * 255 + max[c] / 2) / max[c];
+  }
+}
+
+void JpegCompressor::convertRow(const rdr::U8* pixels, int w, rdr::U8* y,
+                                rdr::U8* cb, rdr::U8* cr)
+{
+  if (direct) {
+    (*convertRowFn)((const rdr::U32*)pixels, w, shift[0], shift[1],
+                    shift[2], y, cb, cr);
+    return;
+  }
+
+  rgbRow.resize(w);
+  for (int x = 0; x < w; x++) {
+    rdr::U32 p;
+    switch (pf_.bpp) {
+    case 8:
+      p = pixels[x];
+      break;
+    case 16:
+      p = ((const rdr::U16*)pixels)[x];
+      if (swap) p = ((p & 0xff) << 8) | (p >> 8);
+      break;
+    default:
+      p = ((const rdr::U32*)pixels)[x];
+      if (swap)
+        p = ((p >> 24) | ((p & 0x00ff0000) >> 8) |
+             ((p & 0x0000ff00) << 8) | (p << 24));
+      break;
+    }
+    rgbRow[x] = ((scale[0][(p >> pf_.redShift) & pf_.redMax] << 16) |
+                 (scale[1][(p >> pf_.greenShift) & pf_.greenMax] << 8) |
+                 scale[2][(p >> pf_.blueShift) & pf_.blueMax]);
+  }
+  (*convertRowFn)(&rgbRow[0], w, 16, 8, 0, y, cb, cr);
+}
+
+// The bits are sent most significant first, with a zero byte after any
+// byte of all ones, so that it isn't taken for a marker.  A block can't
+// come to more than MAX_BLOCK_BYTES, so the space for it is made sure of
+// first, and then the bytes go straight into the buffer.
+
+#define MAX_BLOCK_BYTES 512
+
+#define PUT_BITS(code, size)                                                \
+  {                                                                         \
+    bitBuf = (bitBuf << (size)) | (code);                                   \
+    bitCount += (size);                                                     \
+    while (bitCount >= 8) {                                                 \
+      bitCount -= 8;                                                        \
+      rdr::U8 byte = bitBuf >> bitCount;                                    \
+      *out++ = byte;                                                        \
+      if (byte == 0xff)                                                     \
+        *out++ = 0;                                                         \
+    }                                                                       \
+  }
+
+// The last byte is padded with ones.
+
+void JpegCompressor::flushBits()
+{
+  mos.check(2);
+  rdr::U8* out = mos.getptr();
+  if (bitCount)
+    PUT_BITS((1 << (8 - bitCount)) - 1, 8 - bitCount);
+  mos.setptr(out);
+  bitBuf = 0;
+}
+
+void JpegCompressor::encodeBlock(const rdr::U8* samples, int stride,
+                                 int component)
+{
+  rdr::S16 coef[64];
+  int t = component ? 1 : 0;
+  (*fdctQuantizeFn)(samples, stride, divisors[t], coef);
+
+  const HuffTable& dc = dcTable[t];
+  const HuffTable& ac = acTable[t];
+  rdr::U32 bitBuf = this->bitBuf;
+  int bitCount = this->bitCount;
+  mos.check(MAX_BLOCK_BYTES);
+  rdr::U8* out = mos.getptr();
+
+  int diff = coef[0] - lastDC[component];
+  lastDC[component] = coef[0];
+  int bits = diff;
+  if (diff < 0) {
+    diff = -diff;
+    bits--;
+  }
+  int n = nBits[diff];
+  PUT_BITS(dc.code[n], dc.size[n]);
+  if (n)
+    PUT_BITS(bits & ((1 << n) - 1), n);
+
+  int run = 0;
+  for (int k = 1; k < 64; k++) {
+    int value = coef[zigzag[k]];
+    if (value == 0) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      PUT_BITS(ac.code[0xf0], ac.size[0xf0]);
+      run -= 16;
+    }
+    bits = value;
+    if (value < 0) {
+      value = -value;
+      bits--;
+    }
+    n = nBits[value];
+    int symbol = (run << 4) | n;
+    PUT_BITS(ac.code[symbol], ac.size[symbol]);
+    PUT_BITS(bits & ((1 << n) - 1), n);
+    run = 0;
+  }
+  if (run)
+    PUT_BITS(ac.code[0], ac.size[0]);
+
+  mos.setptr(out);
+  this->bitBuf = bitBuf;
+  this->bitCount = bitCount;
+}
+
+// compress() goes through the image a row of MCUs (minimum coded units) at
+// a time, converting it into a plane for each component, filled out to a
+// whole number of MCUs by repeating the last column and row, and halving
+// the colour planes if need be.
+
+void JpegCompressor::compress(const rdr::U8* data, int stride, int w, int h,
+                              const PixelFormat& pf, int quality)
+{
+  setQuality(quality);
+  setFormat(pf);
+  mos.clear();
+  writeHeaders(w, h);
+
+  int mcuSize = subsample ? 16 : 8;
+  int paddedW = (w + mcuSize - 1) / mcuSize * mcuSize;
+  int planeSize = paddedW * mcuSize;
+  rows.resize(planeSize * 3 + planeSize / 2);
+  rdr::U8* plane[3];
+  for (int c = 0; c < 3; c++)
+    plane[c] = &rows[planeSize * c];
+  rdr::U8* halved[2] = { &rows[planeSize * 3],
+                         &rows[planeSize * 3 + planeSize / 4] };
+  int pixelBytes = pf.bpp / 8;
+
+  lastDC[0] = lastDC[1] = lastDC[2] = 0;
+  bitBuf = 0;
+  bitCount = 0;
+
+  for (int y0 = 0; y0 < h; y0 += mcuSize) {
+    int i, x, c;
+    for (i = 0; i < mcuSize; i++) {
+      int offset = i * paddedW;
+      if (y0 + i < h) {
+        convertRow(data + (y0 + i) * stride * pixelBytes, w,
+                   plane[0] + offset, plane[1] + offset, plane[2] + offset);
+        for (c = 0; c < 3; c++)
+          memset(plane[c] + offset + w, plane[c][offset + w - 1],
+                 paddedW - w);
+      } else {
+        for (c = 0; c < 3; c++)
+          memcpy(plane[c] + offset, plane[c] + offset - paddedW, paddedW);
+      }
+    }
+
+    if (subsample) {
+      for (c = 0; c < 2; c++) {
+        for (i = 0; i < 8; i++) {
+          const rdr::U8* in = plane[c+1] + i * 2 * paddedW;
+          rdr::U8* out = halved[c] + i * paddedW / 2;
+          for (x = 0; x < paddedW / 2; x++)
+            out[x] = (in[x*2] + in[x*2+1] + in[x*2+paddedW] +
+                      in[x*2+paddedW+1] + 1 + (x & 1)) >> 2;
+        }
+      }
+      for (x = 0; x < paddedW; x += 16) {
+        encodeBlock(plane[0] + x, paddedW, 0);
+        encodeBlock(plane[0] + x + 8, paddedW, 0);
+        encodeBlock(plane[0] + 8 * paddedW + x, paddedW, 0);
+        encodeBlock(plane[0] + 8 * paddedW + x + 8, paddedW, 0);
+        encodeBlock(halved[0] + x / 2, paddedW / 2, 1);
+        encodeBlock(halved[1] + x / 2, paddedW / 2, 2);
+      }
+    } else {
+      for (x = 0; x < paddedW; x += 8)
+        for (c = 0; c < 3; c++)
+          encodeBlock(plane[c] + x, paddedW, c);
+    }
+  }
+
+  flushBits();
+  mos.writeU16(0xffd9);
+}
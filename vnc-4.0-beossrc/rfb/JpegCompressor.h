@@ -0,0 +1,82 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// JpegCompressor - a baseline JPEG encoder, for the Tight encoding's JPEG
+// subencoding.
+//
+// The pixels are converted to YCbCr, with the colour halved both ways
+// (4:2:0) unless the quality is high, and each 8x8 block goes through a
+// floating point DCT, is quantized with the example tables from the JPEG
+// standard scaled for the quality in the same way as the IJG library does,
+// and is Huffman coded with the standard's example tables.  The result is a
+// complete JFIF image.  The colour conversion and the DCT are done with SSE2
+// if the processor has it.
+//
+
+#ifndef __RFB_JPEGCOMPRESSOR_H__
+#define __RFB_JPEGCOMPRESSOR_H__
+
+#include <vector>
+#include <rdr/MemOutStream.h>
+#include <rfb/PixelFormat.h>
+
+namespace rfb {
+
+  class JpegCompressor {
+  public:
+    JpegCompressor();
+
+    // compress() encodes w by h true colour pixels in the given format,
+    // stride pixels apart from one row to the next, with a quality from 1
+    // to 100.  The pixels must be in the format's byte order.
+    void compress(const rdr::U8* data, int stride, int w, int h,
+                  const PixelFormat& pf, int quality);
+
+    const rdr::U8* data() { return (const rdr::U8*)mos.data(); }
+    int length() { return mos.length(); }
+
+  private:
+    void setQuality(int quality);
+    void writeHeaders(int w, int h);
+    void setFormat(const PixelFormat& pf);
+    void convertRow(const rdr::U8* pixels, int w, rdr::U8* y, rdr::U8* cb,
+                    rdr::U8* cr);
+    void encodeBlock(const rdr::U8* samples, int stride, int component);
+    void flushBits();
+
+    rdr::MemOutStream mos;
+    int quality_;
+    bool subsample;
+    rdr::U8 quant[2][64];
+    float divisors[2][64];
+
+    PixelFormat pf_;
+    bool swap;
+    bool direct;
+    int shift[3];
+    std::vector<rdr::U8> scale[3];
+    int lastDC[3];
+    rdr::U32 bitBuf;
+    int bitCount;
+
+    // Rows of one line of MCUs, each component at full size, and the
+    // colour components halved.
+    std::vector<rdr::U8> rows;
+    std::vector<rdr::U32> rgbRow;
+  };
+
+}
+#endif
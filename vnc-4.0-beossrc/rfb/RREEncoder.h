@@ -27,6 +27,7 @@ namespace rfb {
   public:
     static Encoder* create(SMsgWriter* writer);
     virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual);
+    virtual bool shareable() { return true; }
     virtual ~RREEncoder();
   private:
     RREEncoder(SMsgWriter* writer);
@@ -42,9 +42,27 @@ bool RawEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
   int y = r.tl.y;
   int w = r.width();
   int h = r.height();
+  int bytesPerRow = w * (writer->bpp() / 8);
+
+  // If the pixels need no translating, send them straight from the
+  // framebuffer.  They are written by reference, so the rows can all go out
+  // together when the update is flushed.
+
+  int stride;
+  const rdr::U8* pixels = ig->getImagePtr(r, &stride);
+  if (pixels) {
+    int strideBytes = stride * (writer->bpp() / 8);
+    writer->startRect(r, encodingRaw);
+    for (; h > 0; h--) {
+      writer->getOutStream()->writeBytesRef(pixels, bytesPerRow);
+      pixels += strideBytes;
+    }
+    writer->endRect();
+    return true;
+  }
+
   int nPixels;
   rdr::U8* imageBuf = writer->getImageBuf(w, w*h, &nPixels);
-  int bytesPerRow = w * (writer->bpp() / 8);
   writer->startRect(r, encodingRaw);
   while (h > 0) {
     int nRows = nPixels / w;
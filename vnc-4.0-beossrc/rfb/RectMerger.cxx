@@ -0,0 +1,131 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- RectMerger.cxx
+
+#include <rfb/RectMerger.h>
+
+using namespace rfb;
+
+RectMerger::RectMerger() : limit(0), limitIsRect(true)
+{
+}
+
+// allowed() returns true if r may be added to the changed region.  When the
+// limit is a single rectangle it contains everything within the bounds of
+// the changed region, so there's no need to check.
+
+bool RectMerger::allowed(const Rect& r)
+{
+  return limitIsRect || Region(r).subtract(*limit).is_empty();
+}
+
+int RectMerger::area(const std::vector<Span>& spans, int height)
+{
+  int a = 0;
+  for (unsigned int i = 0; i < spans.size(); i++)
+    a += (spans[i].x2 - spans[i].x1) * height;
+  return a;
+}
+
+// fillGaps() joins up spans in a band from y1 to y2 which overlap or touch,
+// and those whose gap is no bigger than one rectangle is worth.
+
+void RectMerger::fillGaps(std::vector<Span>* spans, int y1, int y2,
+                          int rectCost)
+{
+  if (spans->empty()) return;
+  int n = 0;
+  for (unsigned int i = 1; i < spans->size(); i++) {
+    Span& last = (*spans)[n];
+    const Span& s = (*spans)[i];
+    int gap = s.x1 - last.x2;
+    if (gap <= 0 || (gap * (y2 - y1) <= rectCost &&
+                     allowed(Rect(last.x2, y1, s.x1, y2)))) {
+      if (s.x2 > last.x2) last.x2 = s.x2;
+    } else {
+      (*spans)[++n] = s;
+    }
+  }
+  spans->resize(n + 1);
+}
+
+void RectMerger::merge(Region* changed, const Region& limit_, int rectCost)
+{
+  if (rectCost <= 0 || changed->numRects() < 2)
+    return;
+
+  limit = &limit_;
+  limitIsRect = (limit->numRects() == 1);
+
+  changed->get_rects(&rects);
+  planned.clear();
+
+  // band holds the spans from bandY1 to bandY2, which may already be several
+  // bands merged.  Each band in turn is read into next and tried joined on.
+
+  unsigned int i = 0;
+  int bandY1 = 0, bandY2 = 0;
+  band.clear();
+
+  while (i < rects.size()) {
+    int y1 = rects[i].tl.y, y2 = rects[i].br.y;
+    next.clear();
+    for (; i < rects.size() && rects[i].tl.y == y1; i++) {
+      Span s = { rects[i].tl.x, rects[i].br.x };
+      next.push_back(s);
+    }
+    fillGaps(&next, y1, y2, rectCost);
+
+    if (!band.empty()) {
+      // The joined band covers both, and anything between them.
+      joined.clear();
+      unsigned int a = 0, b = 0;
+      while (a < band.size() || b < next.size()) {
+        if (b == next.size() || (a < band.size() && band[a].x1 <= next[b].x1))
+          joined.push_back(band[a++]);
+        else
+          joined.push_back(next[b++]);
+      }
+      fillGaps(&joined, bandY1, y2, rectCost);
+
+      int added = (area(joined, y2 - bandY1) - area(band, bandY2 - bandY1)
+                   - area(next, y2 - y1));
+      int saved = band.size() + next.size() - joined.size();
+      bool ok = saved > 0 && added <= saved * rectCost;
+      for (unsigned int j = 0; ok && !limitIsRect && j < joined.size(); j++)
+        ok = allowed(Rect(joined[j].x1, bandY1, joined[j].x2, y2));
+
+      if (ok) {
+        band.swap(joined);
+        bandY2 = y2;
+        continue;
+      }
+
+      for (unsigned int j = 0; j < band.size(); j++)
+        planned.push_back(Rect(band[j].x1, bandY1, band[j].x2, bandY2));
+    }
+
+    band.swap(next);
+    bandY1 = y1;
+    bandY2 = y2;
+  }
+
+  for (unsigned int j = 0; j < band.size(); j++)
+    planned.push_back(Rect(band[j].x1, bandY1, band[j].x2, bandY2));
+
+  changed->setOrderedRects(planned);
+}
@@ -0,0 +1,62 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- RectMerger.h
+//
+// A RectMerger cuts down the number of rectangles a changed region is sent
+// as, by filling in the gaps between nearby ones.  Each rectangle of an
+// update costs something beyond its pixels: a 12-byte header, a fresh walk
+// over its tiles by the encoder, and for ZRLE a length and a zlib flush.  So
+// when the changes are scattered, as they are when typing, it can be cheaper
+// to send some unchanged pixels as well.
+//
+// merge() reckons each rectangle to cost rectCost pixels, and only fills in
+// gaps where that adds no more pixels than the rectangles saved are worth,
+// and only inside limit, which must contain the changed region.  The gaps
+// between rectangles in the same band are looked at first, then each band is
+// tried merged with the one below.  The result is still in y-x banded order,
+// so the region's rectangles are exactly the ones which were planned.
+
+#ifndef __RFB_RECTMERGER_H__
+#define __RFB_RECTMERGER_H__
+
+#include <vector>
+#include <rfb/Region.h>
+
+namespace rfb {
+
+  class RectMerger {
+  public:
+    RectMerger();
+
+    void merge(Region* changed, const Region& limit, int rectCost);
+
+  private:
+    struct Span { int x1, x2; };
+    void fillGaps(std::vector<Span>* spans, int y1, int y2, int rectCost);
+    bool allowed(const Rect& r);
+    int area(const std::vector<Span>& spans, int height);
+
+    const Region* limit;
+    bool limitIsRect;
+
+    // Kept between calls to save making new lists each time.
+    std::vector<Rect> rects, planned;
+    std::vector<Span> band, next, joined;
+  };
+
+}
+#endif
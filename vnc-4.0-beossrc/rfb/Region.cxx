@@ -23,56 +23,110 @@
 // rects member allocated so that there is space for at least one rectangle.
 //
 
+#include <algorithm>
 #include <rfb/Region.h>
+#include <rfb/UpdateArena.h>
 #include <Xregion/Xregion.h>
 #include <Xregion/region.h>
 #include <assert.h>
 #include <stdio.h>
 
-// A _RectRegion must never be passed as a return parameter to the Xlib region
-// operations.  This is because for efficiency its "rects" member has not been
-// allocated with Xmalloc.  It is however safe to pass it as an input
-// parameter.
+// The Xlib region code allocates from the current UpdateArena, if there is
+// one.  Each Region makes its own arena (or none) the current one while it is
+// being changed, so that it never gets memory from anywhere else.
 
-class _RectRegion {
+extern "C" void* rfbRegionAlloc(size_t size)
+{
+  rfb::UpdateArena* arena = rfb::UpdateArena::current();
+  return arena ? arena->alloc(size) : malloc(size);
+}
+
+extern "C" void* rfbRegionRealloc(void* ptr, size_t size)
+{
+  rfb::UpdateArena* arena = rfb::UpdateArena::current();
+  if (arena && (!ptr || arena->owns(ptr)))
+    return arena->realloc(ptr, size);
+  return realloc(ptr, size);
+}
+
+extern "C" void rfbRegionFree(void* ptr)
+{
+  rfb::UpdateArena* arena = rfb::UpdateArena::current();
+  if (arena && arena->owns(ptr))
+    arena->free(ptr);
+  else
+    free(ptr);
+}
+
+class UseArena {
 public:
-  _RectRegion(const rfb::Rect& r) {
-    region.rects = &region.extents;
-    region.numRects = 1;
-    region.extents.x1 = r.tl.x;
-    region.extents.y1 = r.tl.y;
-    region.extents.x2 = r.br.x;
-    region.extents.y2 = r.br.y;
-    region.size = 1;
-    if (r.is_empty())
-      region.numRects = 0;
-  }
-  REGION region;
+  UseArena(rfb::UpdateArena* arena_)
+    : arena(arena_), previous(rfb::UpdateArena::current()) {
+    if (arena != previous)
+      rfb::UpdateArena::setCurrent(arena);
+  }
+  ~UseArena() {
+    if (arena != previous)
+      rfb::UpdateArena::setCurrent(previous);
+  }
+private:
+  rfb::UpdateArena* arena;
+  rfb::UpdateArena* previous;
 };
 
+// regionOp() sets dest to the result of op on a and b.  If dest isn't in an
+// arena but there is a current one, the result is worked out in a temporary
+// region in the arena and copied back, so that dest's rectangles are only
+// reallocated if it needs more of them.
+
+typedef int (*RegionOpFn)(Region, Region, Region);
+
+static void regionOp(RegionOpFn op, Region a, Region b, Region dest,
+                     rfb::UpdateArena* destArena)
+{
+  if (destArena || !rfb::UpdateArena::current()) {
+    UseArena use(destArena);
+    op(a, b, dest);
+    return;
+  }
+
+  Region temp = XCreateRegion();
+  op(a, b, temp);
+  {
+    UseArena use(0);
+    XUnionRegion(temp, temp, dest);
+  }
+  XDestroyRegion(temp);
+}
 
-rfb::Region::Region() {
+rfb::Region::Region() : arena(UpdateArena::current()) {
+  if (arena) arena->liveObjects++;
   xrgn = XCreateRegion();
   assert(xrgn);
 }
 
-rfb::Region::Region(const Rect& r) {
+rfb::Region::Region(const Rect& r) : arena(UpdateArena::current()) {
+  if (arena) arena->liveObjects++;
   xrgn = XCreateRegion();
   assert(xrgn);
   reset(r);
 }
 
-rfb::Region::Region(const rfb::Region& r) {
+rfb::Region::Region(const rfb::Region& r) : arena(UpdateArena::current()) {
+  if (arena) arena->liveObjects++;
   xrgn = XCreateRegion();
   assert(xrgn);
   XUnionRegion(xrgn, r.xrgn, xrgn);
 }
 
 rfb::Region::~Region() {
+  UseArena use(arena);
   XDestroyRegion(xrgn);
+  if (arena) arena->liveObjects--;
 }
 
 rfb::Region& rfb::Region::operator=(const rfb::Region& r) {
+  UseArena use(arena);
   clear();
   XUnionRegion(xrgn, r.xrgn, xrgn);
   return *this;
@@ -102,73 +156,230 @@ void rfb::Region::translate(const Point& delta) {
   XOffsetRegion(xrgn, delta.x, delta.y);
 }
 
+// RegionBuilder fills in an Xlib region from boxes given in y-x banded order,
+// in one pass.  Boxes in a band which overlap or touch are merged, and a band
+// is merged into the one above if they meet and have the same boxes, so the
+// result is the same as the Xlib code would have made.  add() returns false
+// if a box is out of order, after which the region is left empty.
+
+class RegionBuilder {
+public:
+  RegionBuilder(Region rgn_) : rgn(rgn_), prevBand(-1), curBand(0) {
+    rgn->numRects = 0;
+  }
+
+  bool add(short x1, short y1, short x2, short y2) {
+    if (x1 >= x2 || y1 >= y2) return true;
+    if (rgn->numRects > curBand) {
+      BOX* band = &rgn->rects[curBand];
+      BOX* last = &rgn->rects[rgn->numRects-1];
+      if (y1 == band->y1 && y2 == band->y2) {
+        if (x1 < last->x1) return fail();
+        if (x1 <= last->x2) {
+          if (x2 > last->x2) last->x2 = x2;
+          return true;
+        }
+      } else if (y1 >= band->y2) {
+        endBand();
+      } else {
+        return fail();
+      }
+    }
+    if (rgn->numRects == rgn->size && !grow()) return false;
+    BOX* box = &rgn->rects[rgn->numRects++];
+    box->x1 = x1;
+    box->y1 = y1;
+    box->x2 = x2;
+    box->y2 = y2;
+    return true;
+  }
+
+  void finish() {
+    endBand();
+    BOX* extents = &rgn->extents;
+    if (!rgn->numRects) {
+      extents->x1 = extents->y1 = extents->x2 = extents->y2 = 0;
+      return;
+    }
+    extents->x1 = rgn->rects[0].x1;
+    extents->x2 = rgn->rects[0].x2;
+    for (int i = 1; i < rgn->numRects; i++) {
+      if (rgn->rects[i].x1 < extents->x1) extents->x1 = rgn->rects[i].x1;
+      if (rgn->rects[i].x2 > extents->x2) extents->x2 = rgn->rects[i].x2;
+    }
+    extents->y1 = rgn->rects[0].y1;
+    extents->y2 = rgn->rects[rgn->numRects-1].y2;
+  }
+
+private:
+  void endBand() {
+    int n = rgn->numRects - curBand;
+    if (n && prevBand >= 0 && curBand - prevBand == n &&
+        rgn->rects[prevBand].y2 == rgn->rects[curBand].y1) {
+      BOX* prev = &rgn->rects[prevBand];
+      BOX* cur = &rgn->rects[curBand];
+      int i;
+      for (i = 0; i < n; i++)
+        if (prev[i].x1 != cur[i].x1 || prev[i].x2 != cur[i].x2) break;
+      if (i == n) {
+        for (i = 0; i < n; i++)
+          prev[i].y2 = cur[i].y2;
+        rgn->numRects = curBand;
+        return;
+      }
+    }
+    if (n) prevBand = curBand;
+    curBand = rgn->numRects;
+  }
+
+  bool grow() {
+    long size = rgn->size < 8 ? 16 : rgn->size * 2;
+    BOX* rects = (BOX*)Xrealloc((char*)rgn->rects, size * sizeof(BOX));
+    if (!rects) {
+      fprintf(stderr,"Xrealloc failed\n");
+      return fail();
+    }
+    rgn->rects = rects;
+    rgn->size = size;
+    return true;
+  }
+
+  bool fail() {
+    rgn->numRects = 0;
+    curBand = 0;
+    prevBand = -1;
+    return false;
+  }
+
+  Region rgn;
+  int prevBand;
+  int curBand;
+};
+
+static bool rectTopLeftLess(const rfb::Rect& a, const rfb::Rect& b) {
+  return a.tl.y < b.tl.y || (a.tl.y == b.tl.y && a.tl.x < b.tl.x);
+}
+
 void rfb::Region::setOrderedRects(const std::vector<Rect>& rects) {
-  clear();
+  UseArena use(arena);
+  RegionBuilder builder(xrgn);
   std::vector<Rect>::const_iterator i;
   for (i=rects.begin(); i != rects.end(); i++) {
-    _RectRegion rr(*i);
-    XUnionRegion(xrgn, &rr.region, xrgn);
+    if (!builder.add(i->tl.x, i->tl.y, i->br.x, i->br.y)) {
+      setRects(rects);
+      return;
+    }
   }
+  builder.finish();
 }
 
-void rfb::Region::setExtentsAndOrderedRects(const ShortRect* extents,
-                                            int nRects, const ShortRect* rects)
-{
-  if (xrgn->size < nRects)
-  {
-    BOX* prevRects = xrgn->rects;
-    xrgn->rects = (BOX*)Xrealloc((char*)xrgn->rects, nRects * sizeof(BOX));
-    if (!xrgn->rects) {
-      fprintf(stderr,"Xrealloc failed\n");
-      Xfree(prevRects);
-      return;
-    }
-    xrgn->size = nRects;
+// setRects() sweeps down the rectangles sorted by their tops and lefts,
+// keeping a list of those which cover the current band sorted by their left
+// edges, and merges the list into the band's boxes.  Each band ends at the
+// next top or bottom edge, and the builder joins up those which turn out the
+// same.
+
+void rfb::Region::setRects(const std::vector<Rect>& rects) {
+  UseArena use(arena);
+  int n = rects.size();
+  Rect* sorted = (Rect*)Xmalloc(n * sizeof(Rect) + 1);
+  const Rect** active = (const Rect**)Xmalloc(2 * n * sizeof(Rect*) + 1);
+  if (!sorted || !active) {
+    fprintf(stderr,"Xmalloc failed\n");
+    if (active) Xfree((char*)active);
+    if (sorted) Xfree((char*)sorted);
+    clear();
+    return;
   }
 
-  xrgn->numRects = nRects;
-  xrgn->extents.x1 = extents->x1;
-  xrgn->extents.y1 = extents->y1;
-  xrgn->extents.x2 = extents->x2;
-  xrgn->extents.y2 = extents->y2;
-  for (int i = 0; i < nRects; i++) {
-    xrgn->rects[i].x1 = rects[i].x1;
-    xrgn->rects[i].y1 = rects[i].y1;
-    xrgn->rects[i].x2 = rects[i].x2;
-    xrgn->rects[i].y2 = rects[i].y2;
+  int nSorted = 0, i;
+  bool inOrder = true;
+  for (i = 0; i < n; i++) {
+    if (rects[i].is_empty()) continue;
+    if (nSorted && rectTopLeftLess(rects[i], sorted[nSorted-1]))
+      inOrder = false;
+    sorted[nSorted++] = rects[i];
   }
+  if (!inOrder)
+    std::sort(sorted, sorted + nSorted, rectTopLeftLess);
+
+  // The active list is in one half of the buffer, and is merged with the
+  // rectangles starting at each band into the other half.
+  const Rect** cur = active;
+  const Rect** other = active + n;
+  int nCur = 0;
+
+  RegionBuilder builder(xrgn);
+  int next = 0;
+  int y1 = nSorted ? sorted[0].tl.y : 0;
+  while (nCur || next < nSorted) {
+    if (!nCur && sorted[next].tl.y > y1)
+      y1 = sorted[next].tl.y;
+
+    int nOther = 0;
+    i = 0;
+    while (i < nCur || (next < nSorted && sorted[next].tl.y == y1)) {
+      const Rect* r;
+      if (i < nCur && (next == nSorted || sorted[next].tl.y != y1 ||
+                       cur[i]->tl.x <= sorted[next].tl.x))
+        r = cur[i++];
+      else
+        r = &sorted[next++];
+      if (r->br.y > y1)
+        other[nOther++] = r;
+    }
+    const Rect** swap = cur; cur = other; other = swap;
+    nCur = nOther;
+    if (!nCur) continue;
+
+    int y2 = next < nSorted ? sorted[next].tl.y : cur[0]->br.y;
+    for (i = 0; i < nCur; i++)
+      if (cur[i]->br.y < y2) y2 = cur[i]->br.y;
+
+    for (i = 0; i < nCur; i++)
+      builder.add(cur[i]->tl.x, y1, cur[i]->br.x, y2);
+    y1 = y2;
+  }
+  builder.finish();
+
+  Xfree((char*)active);
+  Xfree((char*)sorted);
 }
 
 void rfb::Region::copyFrom(const rfb::Region& r) {
+  UseArena use(arena);
   XUnionRegion(r.xrgn, r.xrgn, xrgn);
 }
 
 void rfb::Region::assign_intersect(const rfb::Region& r) {
-  XIntersectRegion(xrgn, r.xrgn, xrgn);
+  regionOp(XIntersectRegion, xrgn, r.xrgn, xrgn, arena);
 }
 
 void rfb::Region::assign_union(const rfb::Region& r) {
-  XUnionRegion(xrgn, r.xrgn, xrgn);
+  regionOp(XUnionRegion, xrgn, r.xrgn, xrgn, arena);
 }
 
 void rfb::Region::assign_subtract(const rfb::Region& r) {
-  XSubtractRegion(xrgn, r.xrgn, xrgn);
+  regionOp(XSubtractRegion, xrgn, r.xrgn, xrgn, arena);
 }
 
 rfb::Region rfb::Region::intersect(const rfb::Region& r) const {
   rfb::Region ret;
+  UseArena use(ret.arena);
   XIntersectRegion(xrgn, r.xrgn, ret.xrgn);
   return ret;
 }
 
 rfb::Region rfb::Region::union_(const rfb::Region& r) const {
   rfb::Region ret;
+  UseArena use(ret.arena);
   XUnionRegion(xrgn, r.xrgn, ret.xrgn);
   return ret;
 }
 
 rfb::Region rfb::Region::subtract(const rfb::Region& r) const {
   rfb::Region ret;
+  UseArena use(ret.arena);
   XSubtractRegion(xrgn, r.xrgn, ret.xrgn);
   return ret;
 }
@@ -181,8 +392,26 @@ int rfb::Region::numRects() const {
   return xrgn->numRects;
 }
 
+int rfb::Region::numRects(int maxArea, int maxWidth) const {
+  if (!maxArea && !maxWidth) return xrgn->numRects;
+  int n = 0;
+  for (int i = 0; i < xrgn->numRects; i++) {
+    int height = xrgn->rects[i].y2 - xrgn->rects[i].y1;
+    int x = xrgn->rects[i].x1;
+    do {
+      int w = xrgn->rects[i].x2 - x;
+      if (maxWidth && w > maxWidth) w = maxWidth;
+      int h = maxArea / w;
+      n += h ? (height + h - 1) / h : 1;
+      x += w;
+    } while (x < xrgn->rects[i].x2);
+  }
+  return n;
+}
+
 bool rfb::Region::get_rects(std::vector<Rect>* rects,
-                            bool left2right, bool topdown, int maxArea) const
+                            bool left2right, bool topdown, int maxArea,
+                            int maxWidth) const
 {
   int nRects = xrgn->numRects;
   int xInc = left2right ? 1 : -1;
@@ -206,16 +435,22 @@ bool rfb::Region::get_rects(std::vector<Rect>* rects,
       i = firstInNextBand - yInc;
 
     while (nRectsInBand > 0) {
-      int y = xrgn->rects[i].y1;
-      int h = maxArea / (xrgn->rects[i].x2 - xrgn->rects[i].x1);
-      if (!h) h = xrgn->rects[i].y2 - y;
+      int x = xrgn->rects[i].x1;
       do {
-        if (h > xrgn->rects[i].y2 - y)
-          h = xrgn->rects[i].y2 - y;
-        Rect r(xrgn->rects[i].x1, y, xrgn->rects[i].x2, y+h);
-        rects->push_back(r);
-        y += h;
-      } while (y < xrgn->rects[i].y2);
+        int w = xrgn->rects[i].x2 - x;
+        if (maxWidth && w > maxWidth) w = maxWidth;
+        int y = xrgn->rects[i].y1;
+        int h = maxArea / w;
+        if (!h) h = xrgn->rects[i].y2 - y;
+        do {
+          if (h > xrgn->rects[i].y2 - y)
+            h = xrgn->rects[i].y2 - y;
+          Rect r(x, y, x+w, y+h);
+          rects->push_back(r);
+          y += h;
+        } while (y < xrgn->rects[i].y2);
+        x += w;
+      } while (x < xrgn->rects[i].x2);
       i += xInc;
       nRectsInBand--;
     }
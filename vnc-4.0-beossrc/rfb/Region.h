@@ -28,9 +28,7 @@ struct _XRegion;
 
 namespace rfb {
 
-  struct ShortRect {
-    short x1, y1, x2, y2;
-  };
+  class UpdateArena;
 
   class Region {
   public:
@@ -49,9 +47,12 @@ namespace rfb {
     void clear();
     void reset(const Rect& r);
     void translate(const rfb::Point& delta);
+    // setOrderedRects() is quickest given rectangles in y-x banded order,
+    // that is sorted by top edge and then left edge, with those which share
+    // a top edge also sharing a bottom edge.  Others are passed on to
+    // setRects(), which takes rectangles in any order, overlapping or not.
     void setOrderedRects(const std::vector<Rect>& rects);
-    void setExtentsAndOrderedRects(const ShortRect* extents, int nRects,
-                                   const ShortRect* rects);
+    void setRects(const std::vector<Rect>& rects);
     void copyFrom(const Region& r);
 
     void assign_intersect(const Region& r);
@@ -66,10 +67,16 @@ namespace rfb {
 
     bool equals(const Region& b) const;
     int numRects() const;
+    // numRects(maxArea, maxWidth) counts the rectangles get_rects() gives
+    // with maxArea and maxWidth.
+    int numRects(int maxArea, int maxWidth=0) const;
     bool is_empty() const { return numRects() == 0; }
 
+    // get_rects() splits rectangles wider than maxWidth into pieces side by
+    // side, and those of more than maxArea pixels into strips, unless they're
+    // zero.
     bool get_rects(std::vector<Rect>* rects, bool left2right=true,
-                   bool topdown=true, int maxArea=0) const;
+                   bool topdown=true, int maxArea=0, int maxWidth=0) const;
     Rect get_bounding_rect() const;
 
     void debug_print(const char *prefix) const;
@@ -77,6 +84,10 @@ namespace rfb {
   protected:
 
     struct _XRegion* xrgn;
+
+    // arena is the UpdateArena which was current when the region was made,
+    // if any, and holds its rectangles.
+    UpdateArena* arena;
   };
 
 };
@@ -16,14 +16,23 @@
  * USA.
  */
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <sys/time.h>
 #include <rdr/OutStream.h>
+#include <rdr/MemOutStream.h>
+#include <rdr/Exception.h>
 #include <rfb/msgTypes.h>
 #include <rfb/ColourMap.h>
+#include <rfb/CompareKernels.h>
 #include <rfb/ConnParams.h>
 #include <rfb/UpdateTracker.h>
+#include <rfb/EncodeCache.h>
 #include <rfb/SMsgWriter.h>
 #include <rfb/LogWriter.h>
+#include <rfb/ServerCore.h>
+#include <rfb/hextileConstants.h>
+#include <rfb/util.h>
 
 using namespace rfb;
 
@@ -32,30 +41,46 @@ static LogWriter vlog("SMsgWriter");
 SMsgWriter::SMsgWriter(ConnParams* cp_, rdr::OutStream* os_)
   : imageBufIdealSize(0), cp(cp_), os(os_), lenBeforeRect(0),
     currentEncoding(0), updatesSent(0), rawBytesEquivalent(0),
-    imageBuf(0), imageBufSize(0)
+    imageBuf(0), imageBufSize(0), encodeCache(0), captureOS(0),
+    clientKbps(0), selector(cp_), allowLossy(true)
 {
+  lossyTime.tv_sec = lossyTime.tv_usec = 0;
   for (unsigned int i = 0; i <= encodingMax; i++) {
     encoders[i] = 0;
     bytesSent[i] = 0;
     rectsSent[i] = 0;
+    encodeMicros[i] = 0;
   }
 }
 
 SMsgWriter::~SMsgWriter()
 {
   vlog.info("framebuffer updates %d",updatesSent);
+  int zlibLevel = getZlibLevel();
   int bytes = 0;
   for (unsigned int i = 0; i <= encodingMax; i++) {
-    delete encoders[i];
     if (i != encodingCopyRect)
       bytes += bytesSent[i];
     if (rectsSent[i])
-      vlog.info("  %s rects %d, bytes %d",
-                encodingName(i), rectsSent[i], bytesSent[i]);
+      vlog.info("  %s rects %d, bytes %d, encoding time %d ms",
+                encodingName(i), rectsSent[i], bytesSent[i],
+                getEncodeMillis(i));
+    delete encoders[i];
   }
   vlog.info("  raw bytes equivalent %d, compression ratio %f",
           rawBytesEquivalent, (double)rawBytesEquivalent / bytes);
+  if (zlibLevel >= 0)
+    vlog.info("  zlib level %d", zlibLevel);
+  selector.logStats();
   delete [] imageBuf;
+  delete captureOS;
+}
+
+int SMsgWriter::getZlibLevel()
+{
+  if (!encoders[encodingZRLE])
+    return -1;
+  return encoders[encodingZRLE]->settings();
 }
 
 void SMsgWriter::writeSetColourMapEntries(int firstColour, int nColours,
@@ -101,25 +126,217 @@ void SMsgWriter::writeFramebufferUpdate(const UpdateInfo& ui, ImageGetter* ig,
 void SMsgWriter::writeRects(const UpdateInfo& ui, ImageGetter* ig,
                             Region* updatedRegion)
 {
-  std::vector<Rect> rects;
   std::vector<Rect>::const_iterator i;
   updatedRegion->copyFrom(ui.changed);
   updatedRegion->assign_union(ui.copied);
 
+  // Whatever is sent is exact unless the encoder says otherwise, and copies
+  // take any inexact pixels with them.
+
+  allowLossy = !ui.lossless;
+  if (!lossyRegion.is_empty()) {
+    Region moved(ui.copied);
+    moved.translate(ui.copy_delta.negate());
+    moved.assign_intersect(lossyRegion);
+    moved.translate(ui.copy_delta);
+    lossyRegion.assign_subtract(ui.copied);
+    lossyRegion.assign_subtract(ui.changed);
+    for (i = ui.solid.begin(); i != ui.solid.end(); i++)
+      lossyRegion.assign_subtract(Region(*i));
+    lossyRegion.assign_union(moved);
+  }
+
   ui.copied.get_rects(&rects, ui.copy_delta.x <= 0, ui.copy_delta.y <= 0);
   for (i = rects.begin(); i != rects.end(); i++)
     writeCopyRect(*i, i->tl.x - ui.copy_delta.x, i->tl.y - ui.copy_delta.y);
 
-  ui.changed.get_rects(&rects);
+  for (i = ui.solid.begin(); i != ui.solid.end(); i++) {
+    writeSolidRect(*i, ig);
+    updatedRegion->assign_union(Region(*i));
+  }
+
+  ui.changed.get_rects(&rects, true, true, ui.maxRectArea, ui.maxRectWidth);
   for (i = rects.begin(); i != rects.end(); i++) {
     Rect actual;
-    if (!writeRect(*i, ig, &actual)) {
+    if (!writeSharedRect(*i, ig, &actual)) {
       updatedRegion->assign_subtract(*i);
       updatedRegion->assign_union(actual);
     }
   }
 }
 
+// The search for areas of a single colour goes a block of SOLID_BLOCK by
+// SOLID_BLOCK pixels at a time.  When a block is all one colour, the area is
+// grown a block at a time, first to the right and then down, and also first
+// down and then to the right, and the larger of the two is kept if it is at
+// least SolidRectMinArea pixels.
+
+#define SOLID_BLOCK 16
+
+void SMsgWriter::findSolidRects(UpdateInfo* ui, ImageGetter* ig)
+{
+  ui->solid.clear();
+  if (rfb::Server::solidRectMinArea <= 0) return;
+  unsigned int minArea = rfb::Server::solidRectMinArea;
+
+  // ZRLE already sends a tile of a single colour in a byte or two, so
+  // looking is only worth it if there's RRE or Hextile to send them with.
+  if (!cp->supportsEncoding(encodingRRE) &&
+      !cp->supportsEncoding(encodingHextile))
+    return;
+
+  ui->changed.get_rects(&rects);
+  std::vector<Rect>::const_iterator i;
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (i->area() >= minArea)
+      findSolidRects(*i, ig, minArea, &ui->solid);
+  }
+
+  if (!ui->solid.empty()) {
+    Region solid;
+    solid.setRects(ui->solid);
+    ui->changed.assign_subtract(solid);
+  }
+}
+
+static inline rdr::U32 solidPattern(const rdr::U8* pixel, int bytesPerPixel)
+{
+  rdr::U8 bytes[4];
+  for (int i = 0; i < 4; i++)
+    bytes[i] = pixel[i % bytesPerPixel];
+  rdr::U32 pattern;
+  memcpy(&pattern, bytes, 4);
+  return pattern;
+}
+
+// SolidSearch is the rectangle being searched, where its pixels are, and
+// which of its blocks are already part of an area found.  blocks() gives the
+// area of blocks bx1 <= x < bx2 and by1 <= y < by2, and isSolid() checks that
+// none of them are done and they're all the given colour.
+
+struct SolidSearch {
+  Rect r;
+  const rdr::U8* base;
+  int stride;
+  int bytesPerPixel;
+  const rdr::U8* done;
+  int nx;
+
+  const rdr::U8* pixels(const Rect& b) const {
+    return (base + (b.tl.y - r.tl.y) * stride +
+            (b.tl.x - r.tl.x) * bytesPerPixel);
+  }
+  Rect blocks(int bx1, int by1, int bx2, int by2) const {
+    return Rect(r.tl.x + bx1 * SOLID_BLOCK, r.tl.y + by1 * SOLID_BLOCK,
+                min_vnc(r.tl.x + bx2 * SOLID_BLOCK, r.br.x),
+                min_vnc(r.tl.y + by2 * SOLID_BLOCK, r.br.y));
+  }
+  bool isSolid(int bx1, int by1, int bx2, int by2, rdr::U32 pattern) const {
+    for (int y = by1; y < by2; y++)
+      for (int x = bx1; x < bx2; x++)
+        if (done[y * nx + x]) return false;
+    Rect b = blocks(bx1, by1, bx2, by2);
+    return isSolidBlock(pixels(b), stride, b.width() * bytesPerPixel,
+                        b.height(), pattern);
+  }
+};
+
+void SMsgWriter::findSolidRects(const Rect& r, ImageGetter* ig,
+                                unsigned int minArea,
+                                std::vector<Rect>* solid)
+{
+  SolidSearch s;
+  s.r = r;
+  s.base = ig->getSourcePtr(r, &s.stride, &s.bytesPerPixel);
+  if (!s.base || s.bytesPerPixel > 4 || 4 % s.bytesPerPixel) return;
+
+  int nx = (r.width() + SOLID_BLOCK - 1) / SOLID_BLOCK;
+  int ny = (r.height() + SOLID_BLOCK - 1) / SOLID_BLOCK;
+  blockDone.assign(nx * ny, 0);
+  s.done = &blockDone[0];
+  s.nx = nx;
+
+  for (int by = 0; by < ny; by++) {
+    for (int bx = 0; bx < nx; bx++) {
+      if (blockDone[by * nx + bx]) continue;
+      Rect block = s.blocks(bx, by, bx + 1, by + 1);
+      rdr::U32 pattern = solidPattern(s.pixels(block), s.bytesPerPixel);
+      if (!s.isSolid(bx, by, bx + 1, by + 1, pattern)) continue;
+
+      // Right, then down.
+      int rx = bx + 1;
+      while (rx < nx && s.isSolid(rx, by, rx + 1, by + 1, pattern))
+        rx++;
+      int ry = by + 1;
+      while (ry < ny && s.isSolid(bx, ry, rx, ry + 1, pattern))
+        ry++;
+
+      // Down, then right.  The blocks down to ry are already known to be
+      // solid, and if it goes no further this can't be any bigger.
+      int dy = ry;
+      while (dy < ny && s.isSolid(bx, dy, bx + 1, dy + 1, pattern))
+        dy++;
+      if (dy > ry) {
+        int dx = bx + 1;
+        while (dx < nx && s.isSolid(dx, by, dx + 1, dy, pattern))
+          dx++;
+        if (s.blocks(bx, by, dx, dy).area() >
+            s.blocks(bx, by, rx, ry).area()) {
+          rx = dx;
+          ry = dy;
+        }
+      }
+
+      Rect found = s.blocks(bx, by, rx, ry);
+      if (found.area() < minArea) continue;
+
+      solid->push_back(found);
+      for (int y = by; y < ry; y++)
+        for (int x = bx; x < rx; x++)
+          blockDone[y * nx + x] = 1;
+    }
+  }
+}
+
+// writeSolidRect() writes a rectangle of a single colour, as RRE with no
+// subrectangles or as Hextile with only the first tile's background given.
+
+void SMsgWriter::writeSolidRect(const Rect& r, ImageGetter* ig)
+{
+  bool rre = cp->supportsEncoding(encodingRRE);
+  rdr::U8 pixel[4];
+  ig->getImage(pixel, Rect(r.tl.x, r.tl.y, r.tl.x + 1, r.tl.y + 1));
+  int bytesPerPixel = bpp() / 8;
+
+  if (rre) {
+    startRect(r, encodingRRE);
+    os->writeU32(0);
+    os->writeBytes(pixel, bytesPerPixel);
+  } else {
+    startRect(r, encodingHextile);
+    int nTiles = (((r.width() + 15) / 16) * ((r.height() + 15) / 16));
+    os->writeU8(hextileBgSpecified);
+    os->writeBytes(pixel, bytesPerPixel);
+    for (int i = 1; i < nTiles; i++)
+      os->writeU8(0);
+  }
+  endRect();
+}
+
+
+void SMsgWriter::addLossyRect(const Rect& r)
+{
+  lossyRegion.assign_union(Region(r));
+  gettimeofday(&lossyTime, 0);
+}
+
+int SMsgWriter::lossyMillis()
+{
+  struct timeval now;
+  gettimeofday(&now, 0);
+  return ((now.tv_sec - lossyTime.tv_sec) * 1000 +
+          (now.tv_usec - lossyTime.tv_usec) / 1000);
+}
 
 bool SMsgWriter::needFakeUpdate()
 {
@@ -133,12 +350,95 @@ bool SMsgWriter::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
 
 bool SMsgWriter::writeRect(const Rect& r, unsigned int encoding,
                            ImageGetter* ig, Rect* actual)
+{
+  return getEncoder(encoding)->writeRect(r, ig, actual);
+}
+
+Encoder* SMsgWriter::getEncoder(unsigned int encoding)
 {
   if (!encoders[encoding]) {
     encoders[encoding] = Encoder::createEncoder(encoding, this);
     assert(encoders[encoding]);
   }
-  return encoders[encoding]->writeRect(r, ig, actual);
+  return encoders[encoding];
+}
+
+// writeSharedRect() is writeRect() using the EncodeCache, if there is one.
+// If the rectangle isn't in the cache, the encoder's output is captured so
+// that it can be added.  The 12 byte rectangle header isn't kept, apart from
+// the encoding, since an encoder may fall back to another one (e.g. RRE to
+// Raw).
+
+// encodeRect() writes r with the given encoder, and tells the selector how
+// many bytes and how long it took.  The time counts against the encoding
+// chosen, even if the encoder falls back to another.
+
+bool SMsgWriter::encodeRect(Encoder* encoder, unsigned int encoding,
+                            const Rect& r, ImageGetter* ig, Rect* actual)
+{
+  int lenBefore = os->length();
+  struct timeval before, after;
+  gettimeofday(&before, 0);
+  bool wroteAll = encoder->writeRect(r, ig, actual);
+  gettimeofday(&after, 0);
+  int micros = ((after.tv_sec - before.tv_sec) * 1000000 +
+                after.tv_usec - before.tv_usec);
+  encodeMicros[encoding] += micros;
+  selector.record(os->length() - lenBefore, micros);
+  return wroteAll;
+}
+
+bool SMsgWriter::writeSharedRect(const Rect& r, ImageGetter* ig, Rect* actual)
+{
+  unsigned int encoding = selector.select(r, ig);
+  Encoder* encoder = getEncoder(encoding);
+
+  if (!encodeCache || !cp->pf().trueColour || !encoder->shareable())
+    return encodeRect(encoder, encoding, r, ig, actual);
+
+  int settings = encoder->settings();
+  const EncodeCache::Entry* entry = encodeCache->find(r, cp->pf(), encoding,
+                                                      settings);
+  // The cache isn't cleared in the middle of an update, so the stream can
+  // send the data straight from the cache.
+
+  if (entry) {
+    startRect(entry->actual, entry->encoding);
+    if (!entry->data.empty())
+      os->writeBytesRef(&entry->data[0], entry->data.size());
+    endRect();
+    *actual = entry->actual;
+    return entry->wroteAll;
+  }
+
+  if (!captureOS)
+    captureOS = new rdr::MemOutStream;
+  captureOS->clear();
+
+  rdr::OutStream* realOS = os;
+  bool wroteAll;
+  os = captureOS;
+  try {
+    wroteAll = encodeRect(encoder, encoding, r, ig, actual);
+  } catch (rdr::Exception&) {
+    os = realOS;
+    throw;
+  }
+  os = realOS;
+
+  const rdr::U8* data = (const rdr::U8*)captureOS->data();
+  int length = captureOS->length();
+  os->writeBytes(data, length);
+
+  // Encoders only set actual if they didn't write the whole rectangle.
+
+  if (length >= 12) {
+    unsigned int encodingUsed = ((data[8] << 24) | (data[9] << 16) |
+                                 (data[10] << 8) | data[11]);
+    encodeCache->add(r, cp->pf(), encoding, settings, wroteAll ? r : *actual,
+                     wroteAll, encodingUsed, data + 12, length - 12);
+  }
+  return wroteAll;
 }
 
 void SMsgWriter::writeCopyRect(const Rect& r, int srcX, int srcY)
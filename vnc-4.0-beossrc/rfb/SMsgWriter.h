@@ -22,11 +22,15 @@
 #ifndef __RFB_SMSGWRITER_H__
 #define __RFB_SMSGWRITER_H__
 
+#include <vector>
+#include <sys/time.h>
 #include <rdr/types.h>
 #include <rfb/encodings.h>
 #include <rfb/Encoder.h>
+#include <rfb/EncodingSelector.h>
+#include <rfb/Region.h>
 
-namespace rdr { class OutStream; }
+namespace rdr { class OutStream; class MemOutStream; }
 
 namespace rfb {
 
@@ -34,8 +38,8 @@ namespace rfb {
   class ConnParams;
   class ImageGetter;
   class ColourMap;
-  class Region;
   class UpdateInfo;
+  class EncodeCache;
 
   class WriteSetCursorCallback {
   public:
@@ -96,6 +100,31 @@ namespace rfb {
     virtual void writeRects(const UpdateInfo& update, ImageGetter* ig,
                             Region* updatedRegion);
 
+    // findSolidRects() looks for large areas of a single colour in the
+    // changed region of an update, and moves them to its list of solid
+    // rectangles.  writeRects() sends each of those as one rectangle of that
+    // colour, which is much cheaper than having an encoder go through all of
+    // its pixels.  Since it changes the number of rectangles, it must be
+    // called before writeFramebufferUpdateStart().
+    void findSolidRects(UpdateInfo* update, ImageGetter* ig);
+
+    // setEncodeCache() gives the writer a cache of encoded rectangles shared
+    // with other clients, which writeRects() will use for encoders which are
+    // shareable().  Null means don't share.
+    void setEncodeCache(EncodeCache* cache) { encodeCache = cache; }
+    EncodeCache* getEncodeCache() { return encodeCache; }
+
+    // The writer keeps track of which areas of the client's screen are only
+    // approximately right.  An encoder which sends a rectangle lossily calls
+    // addLossyRect(), which it may only do if lossyAllowed(), and writeRects()
+    // takes out of the lossy region whatever it sends again and moves it
+    // with copies.  lossyMillis() gives the time since a rectangle was last
+    // sent lossily.
+    void addLossyRect(const Rect& r);
+    bool lossyAllowed() { return allowLossy; }
+    const Region& getLossyRegion() { return lossyRegion; }
+    int lossyMillis();
+
     // To construct a framebuffer update you can call
     // writeFramebufferUpdateStart(), followed by a number of writeCopyRect()s
     // and writeRect()s, finishing with writeFramebufferUpdateEnd().  If you
@@ -120,6 +149,12 @@ namespace rfb {
     // setOutStream() changes the OutStream on the fly.
     virtual void setOutStream(rdr::OutStream* os);
 
+    // The connection tells the writer how fast the client is taking data
+    // (see FdOutStream::kbitsPerSecond()), for encoders which can trade
+    // compression against speed.  Zero means it isn't known.
+    void setClientKbitsPerSecond(unsigned int kbps) { clientKbps = kbps; }
+    unsigned int clientKbitsPerSecond() { return clientKbps; }
+
     ConnParams* getConnParams() { return cp; }
     rdr::OutStream* getOutStream() { return os; }
     rdr::U8* getImageBuf(int required, int requested=0, int* nPixels=0);
@@ -128,8 +163,16 @@ namespace rfb {
     int getUpdatesSent()           { return updatesSent; }
     int getRectsSent(int encoding) { return rectsSent[encoding]; }
     int getBytesSent(int encoding) { return bytesSent[encoding]; }
+    int getEncodeMillis(int encoding) {
+      return (int)(encodeMicros[encoding] / 1000);
+    }
     int getRawBytesEquivalent()    { return rawBytesEquivalent; }
 
+    // getZlibLevel() gives the level ZRLE is compressing at for this client,
+    // which may be adjusting it to suit the connection, or -1 if ZRLE hasn't
+    // been used.
+    int getZlibLevel();
+
     int imageBufIdealSize;
 
   protected:
@@ -138,6 +181,14 @@ namespace rfb {
     virtual void startMsg(int type)=0;
     virtual void endMsg()=0;
 
+    Encoder* getEncoder(unsigned int encoding);
+    bool writeSharedRect(const Rect& r, ImageGetter* ig, Rect* actual);
+    bool encodeRect(Encoder* encoder, unsigned int encoding, const Rect& r,
+                    ImageGetter* ig, Rect* actual);
+    void findSolidRects(const Rect& r, ImageGetter* ig, unsigned int minArea,
+                        std::vector<Rect>* solid);
+    void writeSolidRect(const Rect& r, ImageGetter* ig);
+
     ConnParams* cp;
     rdr::OutStream* os;
 
@@ -147,10 +198,25 @@ namespace rfb {
     int updatesSent;
     int bytesSent[encodingMax+1];
     int rectsSent[encodingMax+1];
+    rdr::U64 encodeMicros[encodingMax+1];
     int rawBytesEquivalent;
 
     rdr::U8* imageBuf;
     int imageBufSize;
+
+    EncodeCache* encodeCache;
+    rdr::MemOutStream* captureOS;
+    unsigned int clientKbps;
+
+    // selector chooses the encoding for each rectangle writeRects() sends.
+    EncodingSelector selector;
+
+    Region lossyRegion;
+    struct timeval lossyTime;
+    bool allowLossy;
+
+    std::vector<Rect> rects; // Kept between calls to writeRects().
+    std::vector<rdr::U8> blockDone; // For findSolidRects().
   };
 }
 #endif
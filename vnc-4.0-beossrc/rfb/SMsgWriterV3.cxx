@@ -128,7 +128,9 @@ void SMsgWriterV3::writeFramebufferUpdateEnd()
     startMsg(msgTypeFramebufferUpdate);
     os->pad(1);
     os->writeU16(nRectsInUpdate);
-    os->writeBytes(updateOS->data(), updateOS->length());
+    // clear() keeps the data, and nothing else is written to updateOS
+    // before endMsg() flushes it.
+    os->writeBytesRef(updateOS->data(), updateOS->length());
     updateOS->clear();
   }
 
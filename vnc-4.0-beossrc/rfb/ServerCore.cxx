@@ -35,6 +35,17 @@ rfb::IntParameter rfb::Server::clientWaitTimeMillis
  "The number of milliseconds to wait for a client which is no longer "
  "responding",
  20000);
+rfb::IntParameter rfb::Server::clientQueueKBytes
+("ClientQueueKBytes",
+ "The number of kilobytes of output which may be queued for a client which "
+ "is slow to read it, before the server waits for the client (0 = always "
+ "wait)",
+ 16384);
+rfb::IntParameter rfb::Server::clientQueueHighWaterKBytes
+("ClientQueueHighWaterKBytes",
+ "Don't start a new update for a client while more than this many kilobytes "
+ "of output are still queued for it",
+ 256);
 rfb::StringParameter rfb::Server::sec_types
 ("SecurityTypes",
  "Specify which security scheme to use for incoming connections (None, VncAuth)",
@@ -47,6 +58,70 @@ rfb::BoolParameter rfb::Server::compareFB
 ("CompareFB",
  "Perform pixel comparison on framebuffer to reduce unnecessary updates",
  true);
+rfb::BoolParameter rfb::Server::detectCopies
+("DetectCopies",
+ "Look for areas of the screen which have been scrolled or moved, and send "
+ "them to clients as copies",
+ true);
+rfb::BoolParameter rfb::Server::compareHashes
+("CompareHashes",
+ "Keep a hash of each 16x16 tile instead of a copy of the framebuffer for "
+ "the pixel comparison, to save memory",
+ false);
+rfb::IntParameter rfb::Server::compareThreads
+("CompareThreads",
+ "Number of threads to use for the framebuffer comparison (0 = one per "
+ "processor, 1 = just the server thread)",
+ 1);
+rfb::IntParameter rfb::Server::updateThreads
+("UpdateThreads",
+ "Number of threads to use for encoding and writing updates to the clients "
+ "(0 = one per processor, 1 = just the server thread)",
+ 1);
+rfb::IntParameter rfb::Server::rectOverhead
+("RectOverhead",
+ "What each rectangle of an update is reckoned to cost, in pixels.  Nearby "
+ "changed rectangles are merged when the unchanged pixels sent between them "
+ "cost less than the rectangles saved (0 = never merge)",
+ 256);
+rfb::IntParameter rfb::Server::maxRectArea
+("MaxRectArea",
+ "Send changed rectangles of more than this many pixels in strips, so that "
+ "the client can start on the first while the rest are encoded "
+ "(0 = never split)",
+ 1048576);
+rfb::BoolParameter rfb::Server::selectEncodings
+("SelectEncodings",
+ "Choose the encoding for each rectangle from those the client supports, "
+ "by what its pixels look like, rather than always using the client's "
+ "preferred one",
+ true);
+rfb::IntParameter rfb::Server::encodingCpuCost
+("EncodingCPUCost",
+ "How many bytes sent are worth a millisecond of encoding time, when "
+ "choosing encodings (0 = only count bytes)",
+ 1000);
+rfb::IntParameter rfb::Server::solidRectMinArea
+("SolidRectMinArea",
+ "Areas of a single colour of at least this many pixels are picked out of "
+ "updates and sent as one rectangle each (0 = don't look for them)",
+ 2048);
+rfb::IntParameter rfb::Server::losslessRefreshDelay
+("LosslessRefreshDelay",
+ "Areas sent lossily (as JPEG) are sent again exactly once nothing has been "
+ "sent lossily for this many milliseconds (0 = never)",
+ 500);
+rfb::IntParameter rfb::Server::pacingRoundTrips
+("PacingRoundTrips",
+ "Keep each update to about what the client's connection carries in this "
+ "many round trips, sending the areas nearest the pointer first and the rest "
+ "in later updates (0 = send everything at once)",
+ 2);
+rfb::BoolParameter rfb::Server::shareEncodings
+("ShareEncodings",
+ "Encode rectangles once for all clients with the same pixel format and "
+ "encoding, rather than for each client separately",
+ true);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
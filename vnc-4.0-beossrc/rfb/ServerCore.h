@@ -34,9 +34,23 @@ namespace rfb {
 
     static IntParameter idleTimeout;
     static IntParameter clientWaitTimeMillis;
+    static IntParameter clientQueueKBytes;
+    static IntParameter clientQueueHighWaterKBytes;
     static StringParameter sec_types;
     static StringParameter rev_sec_types;
     static BoolParameter compareFB;
+    static BoolParameter detectCopies;
+    static BoolParameter compareHashes;
+    static IntParameter compareThreads;
+    static IntParameter updateThreads;
+    static IntParameter rectOverhead;
+    static IntParameter maxRectArea;
+    static BoolParameter selectEncodings;
+    static IntParameter encodingCpuCost;
+    static IntParameter solidRectMinArea;
+    static IntParameter losslessRefreshDelay;
+    static IntParameter pacingRoundTrips;
+    static BoolParameter shareEncodings;
     static BoolParameter protocol3_3;
     static BoolParameter alwaysShared;
     static BoolParameter neverShared;
@@ -0,0 +1,77 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SnapshotPixelBuffer.cxx
+
+#include <rfb/SnapshotPixelBuffer.h>
+#include <rfb/Region.h>
+
+using namespace rfb;
+
+SnapshotPixelBuffer::SnapshotPixelBuffer(PixelBuffer* source_)
+  : ManagedPixelBuffer(source_->getPF(), source_->width(), source_->height()),
+    source(source_), refCount(0)
+{
+  setColourMap(source->getColourMap(), false);
+  tilesAcross = (width_ + tileSize - 1) / tileSize;
+  tilesDown = (height_ + tileSize - 1) / tileSize;
+  valid.resize(tilesAcross * tilesDown, false);
+}
+
+SnapshotPixelBuffer::~SnapshotPixelBuffer()
+{
+}
+
+void SnapshotPixelBuffer::invalidate(const Region& changed)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  changed.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect r = i->intersect(getRect());
+    if (r.is_empty()) continue;
+    for (int ty = r.tl.y / tileSize; ty <= (r.br.y - 1) / tileSize; ty++) {
+      for (int tx = r.tl.x / tileSize; tx <= (r.br.x - 1) / tileSize; tx++)
+        valid[ty * tilesAcross + tx] = false;
+    }
+  }
+}
+
+int SnapshotPixelBuffer::update(const Region& region)
+{
+  int nCopied = 0;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  region.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect r = i->intersect(getRect());
+    if (r.is_empty()) continue;
+    for (int ty = r.tl.y / tileSize; ty <= (r.br.y - 1) / tileSize; ty++) {
+      for (int tx = r.tl.x / tileSize; tx <= (r.br.x - 1) / tileSize; tx++) {
+        if (valid[ty * tilesAcross + tx]) continue;
+        Rect tile(tx * tileSize, ty * tileSize,
+                  (tx + 1) * tileSize, (ty + 1) * tileSize);
+        tile = tile.intersect(getRect());
+        int stride;
+        const rdr::U8* data = source->getPixelsR(tile, &stride);
+        imageRect(tile, data, stride);
+        valid[ty * tilesAcross + tx] = true;
+        nCopied++;
+      }
+    }
+  }
+  return nCopied;
+}
@@ -0,0 +1,67 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SnapshotPixelBuffer.h
+//
+// A SnapshotPixelBuffer holds a copy of parts of another PixelBuffer, so that
+// updates can be encoded from it by other threads while the original goes on
+// changing.  It is divided into tiles, and update() only copies the tiles
+// which are needed and have changed since they were last copied, so the
+// parts of the screen which stay the same are only copied once.
+//
+// The owner must call invalidate() with every region which changes in the
+// original.  A snapshot counts the references to it, and must not be
+// updated while anyone still holds one.  acquire() and release() are not
+// thread safe, so should only be called by the thread which owns the
+// snapshot.
+
+#ifndef __RFB_SNAPSHOTPIXELBUFFER_H__
+#define __RFB_SNAPSHOTPIXELBUFFER_H__
+
+#include <vector>
+#include <rfb/PixelBuffer.h>
+
+namespace rfb {
+
+  class SnapshotPixelBuffer : public ManagedPixelBuffer {
+  public:
+    SnapshotPixelBuffer(PixelBuffer* source);
+    virtual ~SnapshotPixelBuffer();
+
+    // invalidate() marks the tiles touching the given region as needing to
+    // be copied again.
+    void invalidate(const Region& changed);
+
+    // update() copies any tiles touching the given region which are out of
+    // date, and returns the number of tiles copied.
+    int update(const Region& region);
+
+    void acquire() { refCount++; }
+    void release() { refCount--; }
+    bool inUse() const { return refCount > 0; }
+
+    enum { tileSize = 64 };
+
+  private:
+    PixelBuffer* source;
+    int tilesAcross, tilesDown;
+    std::vector<bool> valid;
+    int refCount;
+  };
+
+};
+
+#endif
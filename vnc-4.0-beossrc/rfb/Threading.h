@@ -28,4 +28,8 @@
 #include <rfb/win32/Threading_win32.h>
 #endif
 
+#if defined(__BEOS__) || defined(__HAIKU__)
+#include <rfb/Threading_beos.h>
+#endif
+
 #endif // __RFB_THREADING_H__
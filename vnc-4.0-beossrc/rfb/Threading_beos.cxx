@@ -0,0 +1,132 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- Threading_beos.cxx
+
+#include <rfb/Threading.h>
+
+#ifdef __RFB_THREADING_IMPL
+
+#include <rdr/Exception.h>
+
+using namespace rfb;
+
+Mutex::Mutex()
+{
+  sem = create_sem(1, "rfb::Mutex");
+  if (sem < B_OK)
+    throw rdr::SystemException("create_sem", sem);
+}
+
+Mutex::~Mutex()
+{
+  delete_sem(sem);
+}
+
+void Mutex::enter()
+{
+  while (acquire_sem(sem) == B_INTERRUPTED)
+    ;
+}
+
+void Mutex::exit()
+{
+  release_sem(sem);
+}
+
+
+Condition::Condition(Mutex* m) : mutex(m), waiters(0)
+{
+  sem = create_sem(0, "rfb::Condition");
+  if (sem < B_OK)
+    throw rdr::SystemException("create_sem", sem);
+}
+
+Condition::~Condition()
+{
+  delete_sem(sem);
+}
+
+void Condition::wait()
+{
+  waiters++;
+  mutex->exit();
+  while (acquire_sem(sem) == B_INTERRUPTED)
+    ;
+  mutex->enter();
+}
+
+void Condition::signal()
+{
+  if (waiters > 0) {
+    waiters--;
+    release_sem(sem);
+  }
+}
+
+void Condition::broadcast()
+{
+  if (waiters > 0) {
+    release_sem_etc(sem, waiters, 0);
+    waiters = 0;
+  }
+}
+
+
+Thread::Thread(const char* name_) : thread(-1)
+{
+  name.buf = strDup(name_ ? name_ : "rfb::Thread");
+}
+
+Thread::~Thread()
+{
+}
+
+int32 Thread::threadProc(void* data)
+{
+  ((Thread*)data)->run();
+  return 0;
+}
+
+void Thread::start()
+{
+  thread_info info;
+  int32 priority = B_NORMAL_PRIORITY;
+  if (get_thread_info(find_thread(NULL), &info) == B_OK)
+    priority = info.priority;
+  thread = spawn_thread(threadProc, name.buf, priority, this);
+  if (thread < B_OK)
+    throw rdr::SystemException("spawn_thread", thread);
+  resume_thread(thread);
+}
+
+void Thread::join()
+{
+  if (thread < B_OK) return;
+  status_t exitValue;
+  wait_for_thread(thread, &exitValue);
+  thread = -1;
+}
+
+int Thread::cpuCount()
+{
+  system_info info;
+  if (get_system_info(&info) != B_OK || info.cpu_count < 1)
+    return 1;
+  return info.cpu_count;
+}
+
+#endif
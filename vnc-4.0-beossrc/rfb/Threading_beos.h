@@ -0,0 +1,109 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- Threading_beos.h
+// BeOS and Haiku implementation of the general purpose threading interface,
+// using kernel semaphores and threads.  BeOS R5 doesn't have pthreads, so we
+// use the native calls on both.
+
+#ifndef __RFB_THREADING_BEOS_H__
+#define __RFB_THREADING_BEOS_H__
+
+#include <OS.h>
+#include <TLS.h>
+#include <rfb/util.h>
+
+#define __RFB_THREADING_IMPL BeOS
+
+namespace rfb {
+
+  class Mutex {
+  public:
+    Mutex();
+    ~Mutex();
+    friend class Lock;
+    friend class Condition;
+  protected:
+    void enter();
+    void exit();
+    sem_id sem;
+  };
+
+  class Lock {
+  public:
+    Lock(const Mutex& m) : mutex((Mutex*)&m) {mutex->enter();}
+    ~Lock() {mutex->exit();}
+  protected:
+    Mutex* mutex;
+  };
+
+  // A Condition is always used with its Mutex locked.  wait() releases the
+  // Mutex while it is blocked and reacquires it before returning.
+
+  class Condition {
+  public:
+    Condition(Mutex* m);
+    ~Condition();
+    void wait();
+    void signal();
+    void broadcast();
+  protected:
+    Mutex* mutex;
+    sem_id sem;
+    int waiters;
+  };
+
+  // Derive from Thread and implement run().  start() creates the BeOS thread,
+  // at the same priority as the thread calling start(), and join() waits for
+  // it to finish.
+
+  class Thread {
+  public:
+    Thread(const char* name_=0);
+    virtual ~Thread();
+
+    virtual void run() = 0;
+
+    void start();
+    void join();
+
+    const char* getName() const {return name.buf;}
+
+    // cpuCount() returns the number of processors in the machine.
+    static int cpuCount();
+
+  protected:
+    static int32 threadProc(void* data);
+    thread_id thread;
+    CharArray name;
+  };
+
+  // A ThreadLocal holds a pointer which is separate for each thread, and is
+  // initially null.  The kernel only has a few slots for these, so they
+  // should be static.
+
+  class ThreadLocal {
+  public:
+    ThreadLocal() : index(tls_allocate()) {}
+    void* get() const { return tls_get(index); }
+    void set(void* value) { tls_set(index, value); }
+  protected:
+    int32 index;
+  };
+
+}
+
+#endif // __RFB_THREADING_BEOS_H__
@@ -0,0 +1,289 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <rdr/OutStream.h>
+#include <rfb/ImageGetter.h>
+#include <rfb/encodings.h>
+#include <rfb/ConnParams.h>
+#include <rfb/SMsgWriter.h>
+#include <rfb/TightEncoder.h>
+#include <rfb/JpegCompressor.h>
+#include <rfb/Configuration.h>
+
+using namespace rfb;
+
+IntParameter tightCompressLevel("TightCompressLevel",
+                                "Tight compression level (0-9) for clients "
+                                "which don't ask for one",6);
+IntParameter tightJpegQuality("JPEGQuality",
+                              "JPEG quality (1-100) for Tight rectangles "
+                              "which look like photographs, for clients "
+                              "which allow JPEG (0 = never use JPEG, -1 = "
+                              "go by the quality level the client asks for)",
+                              -1);
+
+#define BPP 8
+#include <rfb/tightEncode.h>
+#undef BPP
+#define BPP 16
+#include <rfb/tightEncode.h>
+#undef BPP
+#define BPP 32
+#include <rfb/tightEncode.h>
+#undef BPP
+
+// What each compression level does.  The gradient filter isn't used below
+// level 5.
+
+static const TightConf tightConf[10] = {
+  //  mono  gradient  zlib levels for     gradient   colours
+  //  min   min       full mono idx grad  thresholds divisor
+  {    6,   4096,   { 0,   0,   0,   0 },   0,   0,   4 },
+  {    6,   4096,   { 1,   1,   1,   1 },   0,   0,   8 },
+  {    8,   4096,   { 2,   3,   3,   2 },   0,   0,  24 },
+  {   12,   4096,   { 3,   5,   5,   3 },   0,   0,  32 },
+  {   12,   4096,   { 4,   6,   6,   4 },   0,   0,  32 },
+  {   12,   4096,   { 5,   7,   7,   4 }, 150, 380,  32 },
+  {   16,   4096,   { 6,   7,   7,   4 }, 170, 420,  48 },
+  {   16,   4096,   { 7,   8,   8,   5 }, 180, 450,  64 },
+  {   32,   8192,   { 8,   9,   9,   6 }, 190, 475,  64 },
+  {   32,   8192,   { 9,   9,   9,   6 }, 200, 500,  96 }
+};
+
+// The JPEG quality for each of the client's quality levels, as TightVNC
+// has them.
+
+static const int jpegQualityForLevel[10] = {
+  5, 10, 15, 25, 37, 50, 60, 70, 75, 80
+};
+
+Encoder* TightEncoder::create(SMsgWriter* writer)
+{
+  return new TightEncoder(writer);
+}
+
+TightEncoder::TightEncoder(SMsgWriter* writer_)
+  : writer(writer_), conf_(&tightConf[6]), palette_(new TightPalette),
+    dataStream(0), dataLen(0), jpeg(0), jpegQuality_(0), sentLossy(false)
+{
+  for (int i = 0; i < 4; i++) {
+    zos[i] = 0;
+    zosLevel[i] = -1;
+  }
+}
+
+TightEncoder::~TightEncoder()
+{
+  for (int i = 0; i < 4; i++)
+    delete zos[i];
+  delete palette_;
+  delete jpeg;
+}
+
+void TightEncoder::setFormat()
+{
+  const PixelFormat& pf = writer->getConnParams()->pf();
+  rdr::U32 endianTest = 1;
+  bool nativeBigEndian = *(rdr::U8*)(&endianTest) != 1;
+
+  format_.trueColour = pf.trueColour;
+  format_.swap = (pf.bpp > 8 && pf.bigEndian != nativeBigEndian);
+  format_.pack24 = (pf.bpp == 32 && pf.depth == 24 && pf.trueColour &&
+                    pf.redMax == 255 && pf.greenMax == 255 &&
+                    pf.blueMax == 255);
+  format_.redMax = pf.redMax;
+  format_.greenMax = pf.greenMax;
+  format_.blueMax = pf.blueMax;
+  format_.redShift = pf.redShift;
+  format_.greenShift = pf.greenShift;
+  format_.blueShift = pf.blueShift;
+}
+
+// JPEG is only for true colour clients which have asked for a quality
+// level, and not when the writer wants the rectangle sent exactly.  Eight
+// bit colour is too coarse for it to be worth while.
+
+void TightEncoder::setJpegQuality()
+{
+  const ConnParams* cp = writer->getConnParams();
+  jpegQuality_ = 0;
+  if (cp->qualityLevel < 0 || !format_.trueColour || writer->bpp() == 8 ||
+      !writer->lossyAllowed())
+    return;
+
+  int quality = tightJpegQuality;
+  if (quality < 0)
+    quality = jpegQualityForLevel[cp->qualityLevel];
+  if (quality > 100)
+    quality = 100;
+  jpegQuality_ = quality;
+}
+
+rdr::OutStream* TightEncoder::getOutStream()
+{
+  return writer->getOutStream();
+}
+
+int* TightEncoder::getGradientBuf(int width)
+{
+  gradientBuf.resize(6 * (width + 1));
+  return &gradientBuf[0];
+}
+
+void TightEncoder::writeFill()
+{
+  getOutStream()->writeU8(tightFill << 4);
+}
+
+// A stream whose zlib level has changed is replaced by a new one, whose
+// data starts with a zlib header, and the client is told to reset its end.
+
+void TightEncoder::writeControl(int stream, int filter)
+{
+  int level = conf_->zlibLevel[stream];
+  int control = stream << 4;
+
+  if (zos[stream] && zosLevel[stream] != level) {
+    delete zos[stream];
+    zos[stream] = 0;
+    control |= 1 << stream;
+  }
+  if (!zos[stream]) {
+    zos[stream] = new rdr::ZlibOutStream(0, 0, level);
+    zosLevel[stream] = level;
+  }
+
+  rdr::OutStream* os = getOutStream();
+  if (filter == tightFilterCopy) {
+    os->writeU8(control);
+  } else {
+    os->writeU8(control | (tightExplicitFilter << 4));
+    os->writeU8(filter);
+  }
+}
+
+rdr::OutStream* TightEncoder::startData(int stream, int len)
+{
+  dataStream = stream;
+  dataLen = len;
+  if (len < tightMinToCompress)
+    return getOutStream();
+
+  mos.clear();
+  zos[stream]->setUnderlying(&mos);
+  return zos[stream];
+}
+
+// endData() sends the length of the compressed data and then the data.
+
+void TightEncoder::endData()
+{
+  if (dataLen < tightMinToCompress)
+    return;
+
+  zos[dataStream]->flush();
+  writeCompactLength(mos.length());
+  getOutStream()->writeBytes(mos.data(), mos.length());
+}
+
+// writeCompactLength() sends a length in one to three bytes, seven bits at
+// a time, least significant first, with the top bit set if there's more.
+
+void TightEncoder::writeCompactLength(int len)
+{
+  rdr::OutStream* os = getOutStream();
+  if (len < 0x80) {
+    os->writeU8(len);
+  } else if (len < 0x4000) {
+    os->writeU8((len & 0x7f) | 0x80);
+    os->writeU8(len >> 7);
+  } else {
+    os->writeU8((len & 0x7f) | 0x80);
+    os->writeU8(((len >> 7) & 0x7f) | 0x80);
+    os->writeU8(len >> 14);
+  }
+}
+
+// The JPEG data goes with its length, but without going through zlib.
+
+bool TightEncoder::writeJpeg(const rdr::U8* data, int w, int h, int stride)
+{
+  if (!jpeg)
+    jpeg = new JpegCompressor;
+  jpeg->compress(data, stride, w, h, writer->getConnParams()->pf(),
+                 jpegQuality_);
+  if (jpeg->length() >= 1 << 22)
+    return false;
+
+  rdr::OutStream* os = getOutStream();
+  os->writeU8(tightJpeg << 4);
+  writeCompactLength(jpeg->length());
+  os->writeBytes(jpeg->data(), jpeg->length());
+  sentLossy = true;
+  return true;
+}
+
+bool TightEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
+{
+  int level = writer->getConnParams()->compressLevel;
+  if (level < 0)
+    level = tightCompressLevel;
+  if (level < 0) level = 0;
+  if (level > 9) level = 9;
+  conf_ = &tightConf[level];
+  setFormat();
+  setJpegQuality();
+  sentLossy = false;
+
+  // The update is normally split up so that rectangles fit already (see
+  // UpdateInfo::maxRectWidth).  If not, the rest is left for the next update.
+
+  Rect t = r;
+  if (t.width() > tightMaxWidth)
+    t.br.x = t.tl.x + tightMaxWidth;
+  int maxRows = tightMaxPixels / t.width();
+  if (t.height() > maxRows)
+    t.br.y = t.tl.y + maxRows;
+
+  int stride;
+  const rdr::U8* data = ig->getImagePtr(t, &stride);
+  if (!data) {
+    rdr::U8* buf = writer->getImageBuf(t.area());
+    ig->getImage(buf, t);
+    data = buf;
+    stride = t.width();
+  }
+
+  writer->startRect(t, encodingTight);
+  switch (writer->bpp()) {
+  case 8:
+    tightEncode8(data, t.width(), t.height(), stride, this);
+    break;
+  case 16:
+    tightEncode16((const rdr::U16*)data, t.width(), t.height(), stride, this);
+    break;
+  case 32:
+    tightEncode32((const rdr::U32*)data, t.width(), t.height(), stride, this);
+    break;
+  }
+  writer->endRect();
+  if (sentLossy)
+    writer->addLossyRect(t);
+
+  if (t.equals(r))
+    return true;
+  *actual = t;
+  return false;
+}
@@ -0,0 +1,136 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// TightEncoder - the Tight encoding, as used by TightVNC.
+//
+// A rectangle of one colour is sent as a fill.  Otherwise, if it has few
+// enough colours, it is sent as a palette and then a bitmap (two colours) or
+// a byte per pixel, and if not, as the pixels themselves, or as what is
+// left of them after predicting each from its neighbours (the gradient
+// filter) if the picture looks smooth enough for that to pay.  Each kind of
+// data goes through its own one of four zlib streams, which keep going from
+// one rectangle to the next.
+//
+// How hard it tries is set by the compression level the client asks for
+// with a pseudo-encoding, or by the TightCompressLevel parameter.  When the
+// level changes, each stream is started afresh with the new zlib level the
+// next time it is used, telling the client to reset its end of it.
+//
+// A client which asks for a JPEG quality level may be sent rectangles which
+// look like photographs as JPEG instead, with the quality given by the
+// JPEGQuality parameter or worked out from the client's level.  The writer
+// is told which rectangles were sent that way, so that they can be sent
+// again exactly later on.
+//
+
+#ifndef __RFB_TIGHTENCODER_H__
+#define __RFB_TIGHTENCODER_H__
+
+#include <vector>
+#include <rdr/MemOutStream.h>
+#include <rdr/ZlibOutStream.h>
+#include <rfb/Encoder.h>
+
+namespace rfb {
+
+  class TightPalette;
+  class JpegCompressor;
+
+  // TightConf holds what each compression level does: the rectangle sizes
+  // for a bitmap and for the gradient filter to be tried, the zlib level for
+  // each stream, the thresholds for the gradient filter for 16 and 24-bit
+  // colour, and how many pixels a palette's colour must average.
+
+  struct TightConf {
+    int monoMinRectSize;
+    int gradientMinRectSize;
+    int zlibLevel[4];
+    int gradientThreshold;
+    int gradientThreshold24;
+    int idxMaxColoursDivisor;
+  };
+
+  // TightFormat is what tightEncode.h needs to know about the client's
+  // pixel format.  swap is true if the client's pixels are the other way
+  // round from ours, and pack24 if its 32-bit pixels are sent as three
+  // bytes, red, green and blue.  The gradient filter is only for true colour
+  // of 16 or 32 bits.
+
+  struct TightFormat {
+    bool trueColour;
+    bool swap;
+    bool pack24;
+    int redMax, greenMax, blueMax;
+    int redShift, greenShift, blueShift;
+  };
+
+  class TightEncoder : public Encoder {
+  public:
+    static Encoder* create(SMsgWriter* writer);
+    virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual);
+    virtual ~TightEncoder();
+
+    // The zlib streams, by what they carry
+    enum { streamFullColour, streamMono, streamIndexed, streamGradient };
+
+    // The rest is for the encoding functions in tightEncode.h.
+
+    const TightConf& conf() { return *conf_; }
+    const TightFormat& format() { return format_; }
+    TightPalette* palette() { return palette_; }
+    rdr::OutStream* getOutStream();
+    int* getGradientBuf(int width);
+
+    // writeFill() writes the compression control byte for a fill, to be
+    // followed by the pixel.
+    void writeFill();
+
+    // writeControl() writes the compression control byte for data through
+    // the given stream, and the filter id unless it's the copy filter.
+    void writeControl(int stream, int filter);
+
+    // startData() returns the stream to write len bytes of data to, and
+    // endData() sends it, compressed if there's enough of it.
+    rdr::OutStream* startData(int stream, int len);
+    void endData();
+
+    // jpegQuality() is the JPEG quality to use for this rectangle, or 0 if
+    // JPEG mustn't be used.  writeJpeg() sends the pixels as JPEG, unless
+    // it comes to too much, when it writes nothing and returns false.
+    int jpegQuality() { return jpegQuality_; }
+    bool writeJpeg(const rdr::U8* data, int w, int h, int stride);
+
+  private:
+    TightEncoder(SMsgWriter* writer);
+    void setFormat();
+    void setJpegQuality();
+    void writeCompactLength(int len);
+    SMsgWriter* writer;
+    const TightConf* conf_;
+    TightFormat format_;
+    TightPalette* palette_;
+    rdr::ZlibOutStream* zos[4];
+    int zosLevel[4];
+    rdr::MemOutStream mos;
+    int dataStream;
+    int dataLen;
+    std::vector<int> gradientBuf;
+    JpegCompressor* jpeg;
+    int jpegQuality_;
+    bool sentLossy;
+  };
+}
+#endif
@@ -0,0 +1,164 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- TileRegion.cxx
+
+#include <rfb/TileRegion.h>
+#include <rfb/Region.h>
+#include <rfb/Exception.h>
+
+using namespace rfb;
+
+// Counts the bits set in a word, without needing a popcount instruction.
+
+static inline int countBits(rdr::U64 x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+TileRegion::TileRegion()
+  : width(0), height(0), tilesAcross(0), tilesDown(0), wordsPerRow(0)
+{
+}
+
+void TileRegion::setSize(int w, int h)
+{
+  width = w;
+  height = h;
+  tilesAcross = (w + tileSize - 1) / tileSize;
+  tilesDown = (h + tileSize - 1) / tileSize;
+  wordsPerRow = (tilesAcross + 63) / 64;
+  bits.assign(wordsPerRow * tilesDown, 0);
+}
+
+void TileRegion::clear()
+{
+  for (unsigned int i = 0; i < bits.size(); i++)
+    bits[i] = 0;
+}
+
+void TileRegion::add(const Rect& r_)
+{
+  Rect r = r_.intersect(Rect(0, 0, width, height));
+  if (r.is_empty()) return;
+
+  int left = r.tl.x / tileSize;
+  int right = (r.br.x - 1) / tileSize;
+  int top = r.tl.y / tileSize;
+  int bottom = (r.br.y - 1) / tileSize;
+
+  for (int ty = top; ty <= bottom; ty++) {
+    rdr::U64* row = &bits[ty * wordsPerRow];
+    for (int w = left / 64; w <= right / 64; w++) {
+      rdr::U64 mask = ~(rdr::U64)0;
+      if (w == left / 64)
+        mask &= ~(rdr::U64)0 << (left % 64);
+      if (w == right / 64 && right % 64 != 63)
+        mask &= ((rdr::U64)1 << (right % 64 + 1)) - 1;
+      row[w] |= mask;
+    }
+  }
+}
+
+void TileRegion::add(const Region& r)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+  r.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    add(*i);
+}
+
+void TileRegion::checkSize(const TileRegion& r) const
+{
+  if (r.width != width || r.height != height)
+    throw Exception("TileRegion: regions are different sizes");
+}
+
+void TileRegion::assign_union(const TileRegion& r)
+{
+  checkSize(r);
+  for (unsigned int i = 0; i < bits.size(); i++)
+    bits[i] |= r.bits[i];
+}
+
+void TileRegion::assign_intersect(const TileRegion& r)
+{
+  checkSize(r);
+  for (unsigned int i = 0; i < bits.size(); i++)
+    bits[i] &= r.bits[i];
+}
+
+void TileRegion::assign_subtract(const TileRegion& r)
+{
+  checkSize(r);
+  for (unsigned int i = 0; i < bits.size(); i++)
+    bits[i] &= ~r.bits[i];
+}
+
+bool TileRegion::equals(const TileRegion& r) const
+{
+  return width == r.width && height == r.height && bits == r.bits;
+}
+
+bool TileRegion::is_empty() const
+{
+  for (unsigned int i = 0; i < bits.size(); i++)
+    if (bits[i]) return false;
+  return true;
+}
+
+int TileRegion::numTiles() const
+{
+  int n = 0;
+  for (unsigned int i = 0; i < bits.size(); i++)
+    n += countBits(bits[i]);
+  return n;
+}
+
+void TileRegion::get_rects(std::vector<Rect>* rects) const
+{
+  rects->clear();
+  for (int ty = 0; ty < tilesDown; ty++) {
+    const rdr::U64* row = &bits[ty * wordsPerRow];
+    int top = ty * tileSize;
+    int bottom = min_vnc(top + tileSize, height);
+    int runLeft = -1;
+
+    for (int w = 0; w < wordsPerRow; w++) {
+      rdr::U64 word = row[w];
+      // Skip words which can't start or end a run.
+      if (runLeft < 0 ? word == 0 : word == ~(rdr::U64)0)
+        continue;
+      for (int b = 0; b < 64; b++) {
+        bool set = (word >> b) & 1;
+        if (set && runLeft < 0) {
+          runLeft = (w * 64 + b) * tileSize;
+        } else if (!set && runLeft >= 0) {
+          int right = min_vnc((w * 64 + b) * tileSize, width);
+          if (right > runLeft)
+            rects->push_back(Rect(runLeft, top, right, bottom));
+          runLeft = -1;
+        }
+      }
+    }
+    if (runLeft >= 0)
+      rects->push_back(Rect(runLeft, top, width, bottom));
+  }
+}
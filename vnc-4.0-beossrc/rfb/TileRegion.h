@@ -0,0 +1,78 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- TileRegion.h
+//
+// A TileRegion records which 16x16 tiles of an area have changed, as one bit
+// per tile.  Each row of tiles is a whole number of 64-bit words, so the set
+// operations are a few word operations per row and never allocate.  It is
+// meant for the scattered, blocky changes found by comparing the
+// framebuffer, where an Xlib band list would need thousands of rectangles.
+//
+// Adding a rectangle marks every tile it touches, so a TileRegion covers at
+// least as much as was added to it.  get_rects() turns it back into
+// rectangles, clipped to the area, for making a Region out of.  Set
+// operations are only allowed between TileRegions of the same size.
+
+#ifndef __RFB_TILEREGION_H__
+#define __RFB_TILEREGION_H__
+
+#include <vector>
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  class Region;
+
+  class TileRegion {
+  public:
+    TileRegion();
+
+    // setSize() sets the size of the area in pixels, and clears it.
+    void setSize(int width, int height);
+
+    void clear();
+    void add(const Rect& r);
+    void add(const Region& r);
+    void add_tile(int tx, int ty) {
+      bits[ty * wordsPerRow + tx / 64] |= (rdr::U64)1 << (tx % 64);
+    }
+
+    void assign_union(const TileRegion& r);
+    void assign_intersect(const TileRegion& r);
+    void assign_subtract(const TileRegion& r);
+
+    bool equals(const TileRegion& r) const;
+    bool is_empty() const;
+    int numTiles() const;
+
+    // get_rects() gives the runs of tiles in each row of tiles, in y-x banded
+    // order, ready for Region::setOrderedRects().
+    void get_rects(std::vector<Rect>* rects) const;
+
+    enum { tileSize = 16 };
+
+  private:
+    void checkSize(const TileRegion& r) const;
+    int width, height;
+    int tilesAcross, tilesDown, wordsPerRow;
+    std::vector<rdr::U64> bits;
+  };
+
+};
+
+#endif
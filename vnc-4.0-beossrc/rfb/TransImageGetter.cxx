@@ -26,6 +26,7 @@
 #include <rfb/PixelBuffer.h>
 #include <rfb/ColourCube.h>
 #include <rfb/TransImageGetter.h>
+#include <rfb/TransKernels.h>
 
 using namespace rfb;
 
@@ -229,6 +230,10 @@ void TransImageGetter::init(PixelBuffer* pb_, const PixelFormat& out,
 
   // TC to TC
 
+  transFn = initTransKernel(&table, inPF, outPF);
+  if (transFn)
+    return;
+
   if ((inPF.bpp > 16) || (economic && (inPF.bpp == 16))) {
     transFn = transRGBFns[inPF.bpp/32][outPF.bpp/16];
     (*initRGBTCtoTCFns[outPF.bpp/16]) (&table, inPF, outPF);
@@ -270,6 +275,22 @@ void TransImageGetter::getImage(void* outPtr, const Rect& r, int outStride)
              outPF, outPtr, outStride, r.width(), r.height());
 }
 
+const rdr::U8* TransImageGetter::getImagePtr(const Rect& r, int* stride)
+{
+  if (transFn != noTransFn)
+    return 0;
+  return pb->getPixelsR(r.translate(offset.negate()), stride);
+}
+
+const rdr::U8* TransImageGetter::getSourcePtr(const Rect& r, int* stride,
+                                              int* bytesPerPixel)
+{
+  *bytesPerPixel = pb->getPF().bpp / 8;
+  const rdr::U8* data = pb->getPixelsR(r.translate(offset.negate()), stride);
+  *stride *= *bytesPerPixel;
+  return data;
+}
+
 void TransImageGetter::translatePixels(void* inPtr, void* outPtr,
                                        int nPixels) const
 {
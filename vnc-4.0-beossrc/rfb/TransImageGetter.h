@@ -75,6 +75,14 @@ namespace rfb {
     // padding will be outStride-r.width() pixels).
     void getImage(void* outPtr, const Rect& r, int outStride=0);
 
+    // getImagePtr() gives the PixelBuffer's own pixels when no translation
+    // is needed.
+    const rdr::U8* getImagePtr(const Rect& r, int* stride);
+
+    // getSourcePtr() gives the PixelBuffer's own pixels.
+    const rdr::U8* getSourcePtr(const Rect& r, int* stride,
+                                int* bytesPerPixel);
+
     // translatePixels() translates the given number of pixels from inPtr,
     // putting it into the buffer pointed to by outPtr.  The pixels at inPtr
     // should be in the same format as the PixelBuffer, and the translated
@@ -86,6 +94,7 @@ namespace rfb {
     // buffer MUST have the same pixel format as the old one - if not you
     // should call init() instead.
     void setPixelBuffer(PixelBuffer* pb_) { pb = pb_; }
+    PixelBuffer* getPixelBuffer() const { return pb; }
 
     // setOffset() sets an offset which is subtracted from the coordinates of
     // the rectangle given to getImage().
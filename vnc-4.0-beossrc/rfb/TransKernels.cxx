@@ -0,0 +1,326 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+#include <rfb/CpuFeatures.h>
+#include <rfb/TransKernels.h>
+#include <rfb/LogWriter.h>
+
+#ifdef RFB_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace rfb;
+
+static LogWriter vlog("TransKernels");
+
+// Each component is worked out the same way as the tables do it:
+//
+//   out = ((in >> inShift & inMax) * outMax + inMax/2) / inMax << outShift
+//
+// The division is done by multiplying by a magic number and taking the high
+// 16 bits, shifted right by magicShift.  The magic numbers are chosen (and
+// checked against every possible value) when the kernel is set up.
+
+struct TransKernelParams {
+  int inShift[3];
+  int inMax[3];
+  int outMax[3];
+  int outShift[3];
+  int magic[3];
+  int magicShift[3];
+  bool swap;
+};
+
+static bool findMagic(int divisor, int maxValue, int* magic, int* shift)
+{
+  for (int s = 0; s < 16; s++) {
+    int m = ((1 << (16 + s)) + divisor - 1) / divisor;
+    if (m > 0xffff) break;
+    int x;
+    for (x = 0; x <= maxValue; x++) {
+      if ((((rdr::U32)x * m) >> (16 + s)) != (rdr::U32)(x / divisor))
+        break;
+    }
+    if (x > maxValue) {
+      *magic = m;
+      *shift = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline rdr::U32 transPixel(const TransKernelParams* p, rdr::U32 pix)
+{
+  rdr::U32 out = 0;
+  for (int i = 0; i < 3; i++) {
+    int c = (pix >> p->inShift[i]) & p->inMax[i];
+    c = (c * p->outMax[i] + p->inMax[i] / 2) / p->inMax[i];
+    out |= c << p->outShift[i];
+  }
+  return out;
+}
+
+#ifdef RFB_HAVE_X86_SIMD
+
+// The parameters for each component, loaded into registers once per call.
+
+struct ComponentSSE2 {
+  __m128i inShift;
+  __m128i mask32;
+  __m128i mask16;
+  __m128i mul;
+  __m128i add;
+  __m128i magic;
+  __m128i magicShift;
+  __m128i outShift;
+  bool scale;
+};
+
+__attribute__((target("sse2")))
+static void loadComponentsSSE2(const TransKernelParams* p, ComponentSSE2* c)
+{
+  for (int i = 0; i < 3; i++) {
+    c[i].inShift = _mm_cvtsi32_si128(p->inShift[i]);
+    c[i].mask32 = _mm_set1_epi32(p->inMax[i]);
+    c[i].mask16 = _mm_set1_epi16(p->inMax[i]);
+    c[i].mul = _mm_set1_epi16(p->outMax[i]);
+    c[i].add = _mm_set1_epi16(p->inMax[i] / 2);
+    c[i].magic = _mm_set1_epi16((short)p->magic[i]);
+    c[i].magicShift = _mm_cvtsi32_si128(p->magicShift[i]);
+    c[i].outShift = _mm_cvtsi32_si128(p->outShift[i]);
+    c[i].scale = (p->inMax[i] != p->outMax[i]);
+  }
+}
+
+// transComponentsSSE2() translates eight pixels, returning the result in
+// 16-bit lanes for 8 and 16bpp output, or in two sets of 32-bit lanes for
+// 32bpp output.  Components which don't need scaling from 32bpp to 32bpp
+// are just moved, without going through 16-bit lanes.  Byte swapping is
+// left to the caller.
+
+__attribute__((target("sse2"), always_inline))
+static inline void transComponentsSSE2(const ComponentSSE2* c,
+                                       const rdr::U8* ip, int inBpp,
+                                       int outBpp, __m128i* lo, __m128i* hi)
+{
+  __m128i p0 = _mm_loadu_si128((const __m128i*)ip);
+  __m128i p1 = p0;
+  if (inBpp == 32)
+    p1 = _mm_loadu_si128((const __m128i*)(ip + 16));
+
+  __m128i zero = _mm_setzero_si128();
+  *lo = zero;
+  *hi = zero;
+
+  for (int i = 0; i < 3; i++) {
+    if (inBpp == 32 && outBpp == 32 && !c[i].scale) {
+      __m128i v0 = _mm_and_si128(_mm_srl_epi32(p0, c[i].inShift),
+                                 c[i].mask32);
+      __m128i v1 = _mm_and_si128(_mm_srl_epi32(p1, c[i].inShift),
+                                 c[i].mask32);
+      *lo = _mm_or_si128(*lo, _mm_sll_epi32(v0, c[i].outShift));
+      *hi = _mm_or_si128(*hi, _mm_sll_epi32(v1, c[i].outShift));
+      continue;
+    }
+
+    __m128i v;
+    if (inBpp == 32)
+      v = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(p0, c[i].inShift),
+                                        c[i].mask32),
+                          _mm_and_si128(_mm_srl_epi32(p1, c[i].inShift),
+                                        c[i].mask32));
+    else
+      v = _mm_and_si128(_mm_srl_epi16(p0, c[i].inShift), c[i].mask16);
+
+    if (c[i].scale) {
+      v = _mm_add_epi16(_mm_mullo_epi16(v, c[i].mul), c[i].add);
+      v = _mm_srl_epi16(_mm_mulhi_epu16(v, c[i].magic), c[i].magicShift);
+    }
+
+    if (outBpp == 32) {
+      *lo = _mm_or_si128(*lo, _mm_sll_epi32(_mm_unpacklo_epi16(v, zero),
+                                            c[i].outShift));
+      *hi = _mm_or_si128(*hi, _mm_sll_epi32(_mm_unpackhi_epi16(v, zero),
+                                            c[i].outShift));
+    } else {
+      *lo = _mm_or_si128(*lo, _mm_sll_epi16(v, c[i].outShift));
+    }
+  }
+}
+
+__attribute__((target("sse2")))
+static inline __m128i swap16SSE2(__m128i v)
+{
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i swap32SSE2(__m128i v)
+{
+  v = swap16SSE2(v);
+  return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+}
+
+// Eight pixels take up inBpp bytes of input and outBpp bytes of output.  For
+// 8bpp output sixteen pixels are done at a time, to fill a whole register.
+
+__attribute__((target("sse2"), always_inline))
+static inline void transSSE2(void* table, void* inPtr, int inStride,
+                             void* outPtr, int outStride, int width,
+                             int height, int inBpp, int outBpp)
+{
+  const TransKernelParams* p = (const TransKernelParams*)table;
+  ComponentSSE2 c[3];
+  loadComponentsSSE2(p, c);
+  const rdr::U8* ip = (const rdr::U8*)inPtr;
+  rdr::U8* op = (rdr::U8*)outPtr;
+  int inStrideBytes = inStride * (inBpp / 8);
+  int outStrideBytes = outStride * (outBpp / 8);
+  int step = (outBpp == 8) ? 16 : 8;
+
+  while (height > 0) {
+    const rdr::U8* i = ip;
+    rdr::U8* o = op;
+    int x = 0;
+    for (; x + step <= width; x += step) {
+      __m128i lo, hi;
+      transComponentsSSE2(c, i, inBpp, outBpp, &lo, &hi);
+      i += inBpp;
+      if (outBpp == 32) {
+        if (p->swap) {
+          lo = swap32SSE2(lo);
+          hi = swap32SSE2(hi);
+        }
+        _mm_storeu_si128((__m128i*)o, lo);
+        _mm_storeu_si128((__m128i*)(o + 16), hi);
+      } else if (outBpp == 16) {
+        if (p->swap)
+          lo = swap16SSE2(lo);
+        _mm_storeu_si128((__m128i*)o, lo);
+      } else {
+        __m128i lo2, hi2;
+        transComponentsSSE2(c, i, inBpp, outBpp, &lo2, &hi2);
+        i += inBpp;
+        _mm_storeu_si128((__m128i*)o, _mm_packus_epi16(lo, lo2));
+      }
+      o += outBpp * step / 8;
+    }
+    for (; x < width; x++) {
+      rdr::U32 pix = (inBpp == 32) ? *(const rdr::U32*)i : *(const rdr::U16*)i;
+      rdr::U32 out = transPixel(p, pix);
+      if (outBpp == 32) {
+        if (p->swap)
+          out = ((out >> 24) | ((out & 0xff0000) >> 8) |
+                 ((out & 0xff00) << 8) | (out << 24));
+        *(rdr::U32*)o = out;
+      } else if (outBpp == 16) {
+        if (p->swap)
+          out = ((out & 0xff) << 8) | (out >> 8);
+        *(rdr::U16*)o = out;
+      } else {
+        *o = out;
+      }
+      i += inBpp / 8;
+      o += outBpp / 8;
+    }
+    ip += inStrideBytes;
+    op += outStrideBytes;
+    height--;
+  }
+}
+
+// The bit depths are made constants in each of these, so that the compiler
+// can drop the tests on them from the inner loop.
+
+#define TRANS_SSE2(in,out)                                                   \
+__attribute__((target("sse2")))                                              \
+static void transSSE2_##in##to##out(void* table, const PixelFormat& inPF,    \
+                                    void* inPtr, int inStride,               \
+                                    const PixelFormat& outPF, void* outPtr,  \
+                                    int outStride, int width, int height)    \
+{                                                                            \
+  transSSE2(table, inPtr, inStride, outPtr, outStride, width, height,        \
+            in, out);                                                        \
+}
+
+TRANS_SSE2(16,8)
+TRANS_SSE2(16,16)
+TRANS_SSE2(16,32)
+TRANS_SSE2(32,8)
+TRANS_SSE2(32,16)
+TRANS_SSE2(32,32)
+
+static transFnType transSSE2Fns[][3] = {
+  { transSSE2_16to8, transSSE2_16to16, transSSE2_16to32 },
+  { transSSE2_32to8, transSSE2_32to16, transSSE2_32to32 }
+};
+
+#endif
+
+transFnType rfb::initTransKernel(rdr::U8** tablep, const PixelFormat& inPF,
+                                 const PixelFormat& outPF)
+{
+#ifdef RFB_HAVE_X86_SIMD
+  if (!CpuFeatures::hasSSE2())
+    return 0;
+
+  if (!inPF.trueColour || !outPF.trueColour)
+    return 0;
+  if ((inPF.bpp != 16 && inPF.bpp != 32) ||
+      (outPF.bpp != 8 && outPF.bpp != 16 && outPF.bpp != 32))
+    return 0;
+
+  rdr::U32 endianTest = 1;
+  bool nativeBigEndian = *(rdr::U8*)(&endianTest) != 1;
+  if (inPF.bigEndian != nativeBigEndian)
+    return 0;
+
+  TransKernelParams p;
+  int inMax[3] = { inPF.redMax, inPF.greenMax, inPF.blueMax };
+  int inShift[3] = { inPF.redShift, inPF.greenShift, inPF.blueShift };
+  int outMax[3] = { outPF.redMax, outPF.greenMax, outPF.blueMax };
+  int outShift[3] = { outPF.redShift, outPF.greenShift, outPF.blueShift };
+
+  for (int i = 0; i < 3; i++) {
+    if (inMax[i] < 1 || inMax[i] > 255 || outMax[i] < 1 || outMax[i] > 255)
+      return 0;
+    if (inShift[i] >= inPF.bpp || outShift[i] >= outPF.bpp ||
+        ((rdr::U64)inMax[i] << inShift[i]) >> inPF.bpp != 0 ||
+        ((rdr::U64)outMax[i] << outShift[i]) >> outPF.bpp != 0)
+      return 0;
+    p.inShift[i] = inShift[i];
+    p.inMax[i] = inMax[i];
+    p.outMax[i] = outMax[i];
+    p.outShift[i] = outShift[i];
+    if (!findMagic(inMax[i], 255 * outMax[i] + inMax[i] / 2,
+                   &p.magic[i], &p.magicShift[i]))
+      return 0;
+  }
+  p.swap = (outPF.bpp > 8 && outPF.bigEndian != nativeBigEndian);
+
+  delete [] *tablep;
+  *tablep = new rdr::U8[sizeof(TransKernelParams)];
+  memcpy(*tablep, &p, sizeof(TransKernelParams));
+
+  vlog.debug("using SSE2 translation from %dbpp to %dbpp",
+             inPF.bpp, outPF.bpp);
+  return transSSE2Fns[inPF.bpp/32][outPF.bpp/16];
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,44 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// TransKernels.h - SIMD versions of the pixel translation functions used by
+// TransImageGetter.
+//
+// The table driven translation functions in transTempl.h look up every
+// pixel, which is slow for the 32bpp to 16bpp and 8bpp conversions needed by
+// clients on slow links.  The kernels here instead work out each colour
+// component arithmetically for eight pixels at a time, giving exactly the
+// same results as the tables.  They handle truecolour to truecolour
+// translation from 16 or 32bpp to 8, 16 or 32bpp, where no component has
+// a max above 255.
+//
+
+#ifndef __RFB_TRANSKERNELS_H__
+#define __RFB_TRANSKERNELS_H__
+
+#include <rfb/TransImageGetter.h>
+
+namespace rfb {
+
+  // initTransKernel() returns a kernel for translating from inPF to outPF,
+  // replacing the table pointed to by tablep with the parameters it needs.
+  // If there is no suitable kernel, or the processor can't run it, it
+  // returns 0 and leaves the table alone.
+
+  transFnType initTransKernel(rdr::U8** tablep, const PixelFormat& inPF,
+                              const PixelFormat& outPF);
+}
+#endif
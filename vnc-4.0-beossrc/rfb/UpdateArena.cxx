@@ -0,0 +1,204 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- UpdateArena.cxx
+
+#include <stdlib.h>
+#include <string.h>
+#include <rfb/UpdateArena.h>
+#include <rfb/Threading.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+static LogWriter vlog("UpdateArena");
+
+#define CHUNK_SIZE 65536
+
+// Each piece of memory is preceded by its size, in a header which keeps the
+// piece aligned for any type.
+
+union Header {
+  size_t size;
+  double align;
+};
+
+struct UpdateArena::Chunk {
+  Chunk* next;
+  size_t size;
+  size_t used;
+  Header* data() { return (Header*)(this + 1); }
+};
+
+static size_t roundUp(size_t size)
+{
+  return (size + sizeof(Header) - 1) / sizeof(Header) * sizeof(Header);
+}
+
+UpdateArena::UpdateArena()
+  : liveObjects(0), allocations(0), heapAllocations(0), chunks(0), chunk(0),
+    last(0), depth(0)
+{
+}
+
+UpdateArena::~UpdateArena()
+{
+  while (chunks) {
+    Chunk* next = chunks->next;
+    ::free(chunks);
+    chunks = next;
+  }
+}
+
+void* UpdateArena::alloc(size_t size)
+{
+  size_t needed = sizeof(Header) + roundUp(size);
+  allocations++;
+
+  // Use the next chunk along if this one is full, or a new one if there
+  // isn't a next one big enough.
+
+  while (!chunk || chunk->used + needed > chunk->size) {
+    Chunk* next = chunk ? chunk->next : chunks;
+    if (next && next->size >= needed) {
+      chunk = next;
+      chunk->used = 0;
+      continue;
+    }
+    size_t chunkSize = needed > CHUNK_SIZE ? needed : CHUNK_SIZE;
+    Chunk* c = (Chunk*)malloc(sizeof(Chunk) + chunkSize);
+    if (!c) return 0;
+    heapAllocations++;
+    c->size = chunkSize;
+    c->used = 0;
+    c->next = next;
+    if (chunk)
+      chunk->next = c;
+    else
+      chunks = c;
+    chunk = c;
+  }
+
+  Header* h = (Header*)((char*)chunk->data() + chunk->used);
+  h->size = size;
+  chunk->used += needed;
+  last = h + 1;
+  return last;
+}
+
+void* UpdateArena::realloc(void* ptr, size_t size)
+{
+  if (!ptr)
+    return alloc(size);
+
+  // The last piece handed out can grow in place if there's room.
+
+  Header* h = (Header*)ptr - 1;
+  if (ptr == last) {
+    size_t start = (char*)h - (char*)chunk->data();
+    if (start + sizeof(Header) + roundUp(size) <= chunk->size) {
+      chunk->used = start + sizeof(Header) + roundUp(size);
+      h->size = size;
+      return ptr;
+    }
+  }
+
+  void* newPtr = alloc(size);
+  if (newPtr)
+    memcpy(newPtr, ptr, h->size < size ? h->size : size);
+  return newPtr;
+}
+
+void UpdateArena::free(void* ptr)
+{
+  // Only the last piece handed out can be given back straight away.
+
+  if (ptr && ptr == last) {
+    chunk->used = (char*)ptr - sizeof(Header) - (char*)chunk->data();
+    last = 0;
+  }
+}
+
+bool UpdateArena::owns(const void* ptr) const
+{
+  for (Chunk* c = chunks; c; c = c->next) {
+    if (ptr >= (void*)c->data() && ptr < (void*)((char*)c->data() + c->size))
+      return true;
+  }
+  return false;
+}
+
+void UpdateArena::reset()
+{
+  if (liveObjects) {
+    vlog.error("can't reset with %d objects still using the arena",
+               liveObjects);
+    return;
+  }
+  chunk = 0;
+  last = 0;
+  allocations = 0;
+  heapAllocations = 0;
+}
+
+
+#ifdef __RFB_THREADING_IMPL
+static ThreadLocal& currentArena()
+{
+  static ThreadLocal arena;
+  return arena;
+}
+
+UpdateArena* UpdateArena::current()
+{
+  return (UpdateArena*)currentArena().get();
+}
+
+void UpdateArena::setCurrent(UpdateArena* arena)
+{
+  currentArena().set(arena);
+}
+#else
+static UpdateArena* currentArena = 0;
+
+UpdateArena* UpdateArena::current()
+{
+  return currentArena;
+}
+
+void UpdateArena::setCurrent(UpdateArena* arena)
+{
+  currentArena = arena;
+}
+#endif
+
+
+UpdateArena::Scope::Scope(UpdateArena* arena_)
+  : arena(arena_), previous(current())
+{
+  if (arena)
+    arena->depth++;
+  if (arena != previous)
+    setCurrent(arena);
+}
+
+UpdateArena::Scope::~Scope()
+{
+  if (arena != previous)
+    setCurrent(previous);
+  if (arena && --arena->depth == 0)
+    arena->reset();
+}
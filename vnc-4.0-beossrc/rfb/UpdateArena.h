@@ -0,0 +1,82 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- UpdateArena.h
+//
+// An UpdateArena hands out memory for the temporary objects made while an
+// update is worked out and written, by bumping a pointer through a few large
+// chunks.  The memory isn't given back one piece at a time; reset() gives it
+// all back at once and keeps the chunks for the next update, so once they
+// are big enough an update needs no mallocs at all.
+//
+// A Scope makes an arena the current one for its thread.  Regions made while
+// there is a current arena keep their rectangles in it (see rfb/Region.h),
+// so such regions must only be used by the same thread, and must be gone
+// before the arena is reset.  When the outermost Scope of an arena ends it
+// calls reset(), which does nothing if anything made from the arena is still
+// alive.
+
+#ifndef __RFB_UPDATEARENA_H__
+#define __RFB_UPDATEARENA_H__
+
+#include <stddef.h>
+
+namespace rfb {
+
+  class UpdateArena {
+  public:
+    UpdateArena();
+    ~UpdateArena();
+
+    void* alloc(size_t size);
+    void* realloc(void* ptr, size_t size);
+    void free(void* ptr);
+    bool owns(const void* ptr) const;
+
+    void reset();
+
+    // The objects which use an arena count themselves in liveObjects.
+    int liveObjects;
+
+    // Counts since the last reset() of the pieces of memory handed out, and
+    // of the chunks which had to be malloced for them.
+    int allocations;
+    int heapAllocations;
+
+    // current() returns the current arena for this thread, or null.
+    static UpdateArena* current();
+    static void setCurrent(UpdateArena* arena);
+
+    class Scope {
+    public:
+      Scope(UpdateArena* arena);
+      ~Scope();
+    private:
+      UpdateArena* arena;
+      UpdateArena* previous;
+    };
+
+  private:
+    struct Chunk;
+    Chunk* chunks;
+    Chunk* chunk;
+    void* last;
+    int depth;
+  };
+
+};
+
+#endif
@@ -0,0 +1,154 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- UpdatePacer.cxx
+
+#include <algorithm>
+#include <rfb/UpdatePacer.h>
+#include <rfb/LogWriter.h>
+#include <rfb/ServerCore.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static LogWriter vlog("UpdatePacer");
+
+// An update is never cut down to less than the connection carries in
+// MIN_UPDATE_MILLIS, nor a rectangle to fewer than MIN_BAND_ROWS rows.
+
+#define MIN_UPDATE_MILLIS 20
+#define MIN_BAND_ROWS 16
+
+UpdatePacer::UpdatePacer()
+  : nextSample(0), rtt(-1), kbps(0), compression(1), awaitingRequest(false),
+    queuedAtSend(0), updates(0), updatesLimited(0)
+{
+  for (int i = 0; i < nSamples; i++)
+    samples[i] = -1;
+}
+
+// The compression is how big updates are compared with raw, which turns
+// the number of bytes an update should be into a number of pixels.
+
+void UpdatePacer::updateSent(int bytes, int rawBytes, int queued,
+                             unsigned int kbps_)
+{
+  kbps = kbps_;
+  if (rawBytes > 0)
+    compression += 0.25 * ((double)bytes / rawBytes - compression);
+  queuedAtSend = queued;
+  gettimeofday(&sentTime, 0);
+  awaitingRequest = true;
+  updates++;
+}
+
+// A measurement is thrown away if most of the time went on sending what was
+// queued, since the estimate of that time is rough.
+
+void UpdatePacer::requestReceived()
+{
+  if (!awaitingRequest)
+    return;
+  awaitingRequest = false;
+
+  struct timeval now;
+  gettimeofday(&now, 0);
+  double millis = ((now.tv_sec - sentTime.tv_sec) * 1000.0 +
+                   (now.tv_usec - sentTime.tv_usec) / 1000.0);
+  double sending = kbps ? queuedAtSend * 8.0 / kbps : 0;
+  if (sending > millis * 3 / 4)
+    return;
+
+  samples[nextSample] = (int)(millis - sending + 0.5);
+  nextSample = (nextSample + 1) % nSamples;
+
+  rtt = samples[0];
+  for (int i = 1; i < nSamples; i++)
+    if (samples[i] >= 0 && (rtt < 0 || samples[i] < rtt))
+      rtt = samples[i];
+}
+
+// Rectangles are taken nearest the pointer first.  Once one doesn't fit,
+// smaller ones further away may still do.  If the first doesn't fit, a band
+// of it across the pointer is taken.
+
+struct PointerDistance {
+  PointerDistance(const Point& p_) : p(p_) {}
+  int distance(const Rect& r) const {
+    int dx = max_vnc(max_vnc(r.tl.x - p.x, p.x - r.br.x + 1), 0);
+    int dy = max_vnc(max_vnc(r.tl.y - p.y, p.y - r.br.y + 1), 0);
+    return dx * dx + dy * dy;
+  }
+  bool operator()(const Rect& a, const Rect& b) const {
+    return distance(a) < distance(b);
+  }
+  Point p;
+};
+
+bool UpdatePacer::limit(Region* changed, const Point& pointer, int bpp)
+{
+  int roundTrips = rfb::Server::pacingRoundTrips;
+  if (roundTrips <= 0 || rtt < 0 || !kbps)
+    return false;
+
+  int millis = max_vnc(rtt * roundTrips, MIN_UPDATE_MILLIS);
+  double maxBytes = kbps / 8.0 * millis;
+  double maxPixels = maxBytes / (compression * bpp / 8);
+  if (maxPixels >= 1 << 30)
+    return false;
+
+  changed->get_rects(&rects);
+  unsigned int total = 0;
+  std::vector<Rect>::iterator i;
+  for (i = rects.begin(); i != rects.end(); i++)
+    total += i->area();
+  if (total <= maxPixels)
+    return false;
+
+  std::stable_sort(rects.begin(), rects.end(), PointerDistance(pointer));
+
+  kept.clear();
+  unsigned int pixels = 0;
+  for (i = rects.begin(); i != rects.end() && pixels < maxPixels; i++) {
+    Rect r = *i;
+    unsigned int left = (unsigned int)maxPixels - pixels;
+    if (r.area() > left) {
+      if (!kept.empty())
+        continue;
+      int rows = min_vnc(max_vnc((int)left / r.width(), MIN_BAND_ROWS),
+                         r.height());
+      int y = pointer.y - rows / 2;
+      y = max_vnc(min_vnc(y, r.br.y - rows), r.tl.y);
+      r = Rect(r.tl.x, y, r.br.x, y + rows);
+    }
+    kept.push_back(r);
+    pixels += r.area();
+  }
+
+  changed->setRects(kept);
+  updatesLimited++;
+  vlog.debug("update cut to %u of %u pixels (round trip %d ms, %u kbit/s)",
+             pixels, total, rtt, kbps);
+  return true;
+}
+
+void UpdatePacer::logStats()
+{
+  if (rtt < 0)
+    return;
+  vlog.info("round trip %d ms, %u kbit/s, %d of %d updates cut short",
+            rtt, kbps, updatesLimited, updates);
+}
@@ -0,0 +1,86 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- UpdatePacer.h
+//
+// An UpdatePacer keeps the updates to a client about the size the
+// connection can carry in a few round trips.  The client only asks for its
+// next update once it has had the last one, so a large update holds up
+// whatever changes next, such as those following the pointer.  Sending it
+// in parts instead, nearest the pointer first, lets those changes through
+// sooner.  Each part costs a round trip of waiting for the next request,
+// so the parts are made big enough for that not to matter much.
+//
+// The round trip time is measured from when an update has been written to
+// when the client's next request arrives, less the time for whatever was
+// still queued to go out.  The client's time to deal with the update counts
+// as well, so the least of the last few measurements is taken.  The
+// connection's speed comes from FdOutStream::kbitsPerSecond().
+//
+// updateSent() should be called once an update has been written, and
+// requestReceived() for each FramebufferUpdateRequest.  limit() then cuts
+// the changed region of the next update down to size.  The rest is left for
+// the updates after it.
+
+#ifndef __RFB_UPDATEPACER_H__
+#define __RFB_UPDATEPACER_H__
+
+#include <sys/time.h>
+#include <vector>
+#include <rfb/Region.h>
+
+namespace rfb {
+
+  class UpdatePacer {
+  public:
+    UpdatePacer();
+
+    // updateSent() takes the size of the update, what its rectangles would
+    // have been raw, the number of bytes still queued for the client, and
+    // the connection's speed.
+    void updateSent(int bytes, int rawBytes, int queued, unsigned int kbps);
+    void requestReceived();
+
+    // limit() returns true if it cut changed down.  bpp is the client's.
+    bool limit(Region* changed, const Point& pointer, int bpp);
+
+    // rttMillis() is -1 until there's been a measurement.
+    int rttMillis() { return rtt; }
+    unsigned int kbitsPerSecond() { return kbps; }
+
+    void logStats();
+
+  private:
+    enum { nSamples = 16 };
+    int samples[nSamples];
+    int nextSample;
+    int rtt;
+    unsigned int kbps;
+    double compression;
+
+    bool awaitingRequest;
+    struct timeval sentTime;
+    int queuedAtSend;
+
+    int updates;
+    int updatesLimited;
+
+    // Kept between calls to save making new lists each time.
+    std::vector<Rect> rects, kept;
+  };
+
+}
+#endif
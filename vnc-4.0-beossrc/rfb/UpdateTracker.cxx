@@ -146,6 +146,7 @@ void SimpleUpdateTracker::get_update(UpdateInfo* info, const Region& clip)
   info->changed = changed.intersect(clip);
   info->copied = copied.intersect(clip);
   info->copy_delta = copy_delta;
+  info->solid.clear();
 }
 
 void SimpleUpdateTracker::flush_update(UpdateTracker &info,
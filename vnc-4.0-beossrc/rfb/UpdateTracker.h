@@ -19,6 +19,7 @@
 #ifndef __RFB_UPDATETRACKER_INCLUDED__
 #define __RFB_UPDATETRACKER_INCLUDED__
 
+#include <vector>
 #include <rfb/Rect.h>
 #include <rfb/Region.h>
 #include <rfb/PixelBuffer.h>
@@ -27,14 +28,27 @@ namespace rfb {
 
   class UpdateInfo {
   public:
+    UpdateInfo() : maxRectArea(0), maxRectWidth(0), lossless(false) {}
     Region changed;
     Region copied;
     Point copy_delta;
+    // Changed rectangles of more than maxRectArea pixels are sent in strips,
+    // and those wider than maxRectWidth pixels in pieces side by side, unless
+    // they're zero.
+    int maxRectArea;
+    int maxRectWidth;
+    // Areas of a single colour which SMsgWriter::findSolidRects() has taken
+    // out of changed, to be sent as one rectangle each.
+    std::vector<Rect> solid;
+    // If lossless is set, nothing in the update may be sent lossily, as when
+    // areas which were are being sent again.
+    bool lossless;
     bool is_empty() const {
-      return copied.is_empty() && changed.is_empty();
+      return copied.is_empty() && changed.is_empty() && solid.empty();
     }
     int numRects() const {
-      return copied.numRects() + changed.numRects();
+      return (copied.numRects() +
+              changed.numRects(maxRectArea, maxRectWidth) + solid.size());
     }
   };
 
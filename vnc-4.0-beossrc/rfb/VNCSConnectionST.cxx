@@ -21,6 +21,7 @@
 #include <rfb/secTypes.h>
 #include <rfb/ServerCore.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/tightConstants.h>
 #define XK_MISCELLANY
 #define XK_XKB_KEYS
 #include <rfb/keysymdef.h>
@@ -56,6 +57,11 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
   }
 
   server->clients.push_front(this);
+  clientsEntry = server->clients.begin();
+  int fd = sock->getFd();
+  if (fd >= (int)server->clientsByFd.size())
+    server->clientsByFd.resize(fd + 1, 0);
+  server->clientsByFd[fd] = this;
 }
 
 
@@ -72,8 +78,13 @@ VNCSConnectionST::~VNCSConnectionST()
   if (server->pointerClient == this)
     server->pointerClient = 0;
 
+  pacer.logStats();
+
   // Remove this client from the server
-  server->clients.remove(this);
+  if (readyForUpdate())
+    server->readyClientCount--;
+  server->clients.erase(clientsEntry);
+  server->clientsByFd[sock->getFd()] = 0;
 }
 
 
@@ -222,6 +233,17 @@ void VNCSConnectionST::setCursorOrClose()
   }
 }
 
+void VNCSConnectionST::flushSocket()
+{
+  if (state() == RFBSTATE_CLOSING) return;
+  try {
+    sock->outStream().flush();
+    writeFramebufferUpdate();
+  } catch(rdr::Exception& e) {
+    close(e.str());
+  }
+}
+
 
 int VNCSConnectionST::checkIdleTimeout()
 {
@@ -454,8 +476,11 @@ void VNCSConnectionST::framebufferUpdateRequest(const Rect& r,bool incremental)
   if (!(accessRights & AccessView)) return;
 
   SConnection::framebufferUpdateRequest(r, incremental);
+  pacer.requestReceived();
 
   Region reqRgn(r);
+  if (requested.is_empty() && !reqRgn.is_empty())
+    server->readyClientCount++;
   requested.assign_union(reqRgn);
 
   if (!incremental) {
@@ -502,7 +527,30 @@ void VNCSConnectionST::writeSetCursorCallback()
 
 void VNCSConnectionST::writeFramebufferUpdate()
 {
-  if (state() != RFBSTATE_NORMAL || requested.is_empty()) return;
+  UpdateArena::Scope scope(&arena);
+  UpdateInfo update;
+  if (!prepareUpdate(&update)) return;
+  writeUpdate(&update);
+  updateWritten();
+}
+
+
+// prepareUpdate() works out what the next update to the client will be.  It
+// returns false if there is nothing to send, or if the client doesn't want an
+// update yet.
+
+bool VNCSConnectionST::prepareUpdate(UpdateInfo* update)
+{
+  UpdateArena::Scope scope(&arena);
+  if (state() != RFBSTATE_NORMAL || requested.is_empty()) return false;
+
+  // Hold the update back while the client is behind with reading the
+  // previous ones.  Changes keep accumulating in the meantime, and
+  // flushSocket() tries again as the queue drains.
+
+  if (sock->outStream().queuedBytes() >
+      rfb::Server::clientQueueHighWaterKBytes * 1024)
+    return false;
 
   server->checkUpdate();
 
@@ -527,10 +575,25 @@ void VNCSConnectionST::writeFramebufferUpdate()
     removeRenderedCursor = false;
   }
 
+  // Once nothing has been sent lossily for LosslessRefreshDelay, the areas
+  // which were are sent again, and everything in that update is sent
+  // exactly.
+
+  bool refresh = false;
+  int refreshDelay = rfb::Server::losslessRefreshDelay;
+  if (refreshDelay > 0 && !writer()->getLossyRegion().is_empty() &&
+      writer()->lossyMillis() >= refreshDelay) {
+    Region lossy(writer()->getLossyRegion().intersect(requested));
+    if (!lossy.is_empty()) {
+      updates.add_changed(lossy);
+      refresh = true;
+    }
+  }
+
   // Return if there is nothing to send the client.
 
   if (updates.is_empty() && !writer()->needFakeUpdate() && !drawRenderedCursor)
-    return;
+    return false;
 
   // If the client needs a server-side rendered cursor, work out the cursor
   // rectangle.  If it's empty then don't bother drawing it, but if it overlaps
@@ -558,20 +621,87 @@ void VNCSConnectionST::writeFramebufferUpdate()
     //  updates.subtract(renderedCursorRect);
   }
 
-  UpdateInfo update;
   updates.enable_copyrect(cp.useCopyRect);
-  updates.get_update(&update, requested);
-  if (!update.is_empty() || writer()->needFakeUpdate() || drawRenderedCursor) {
-    int nRects = update.numRects() + (drawRenderedCursor ? 1 : 0);
-    writer()->writeFramebufferUpdateStart(nRects);
-    Region updatedRegion;
-    writer()->writeRects(update, &image_getter, &updatedRegion);
-    updates.subtract(updatedRegion);
-    if (drawRenderedCursor)
-      writeRenderedCursorRect();
-    writer()->writeFramebufferUpdateEnd();
-    requested.clear();
+  updates.get_update(update, requested);
+  if (update->is_empty() && !writer()->needFakeUpdate() && !drawRenderedCursor)
+    return false;
+
+  // Merge nearby changed rectangles where sending the pixels between them
+  // costs less than the extra rectangles.  Raw pixels are dear, so then only
+  // gaps smaller than a rectangle header are filled in.  If the merged region
+  // now covers the rendered cursor, it must be drawn again.
+
+  int rectCost = rfb::Server::rectOverhead;
+  if (cp.currentEncoding() == encodingRaw)
+    rectCost = min_vnc(rectCost, 12 * 8 / cp.pf().bpp);
+  merger.merge(&update->changed, requested.subtract(update->copied), rectCost);
+  pacer.limit(&update->changed, server->cursorPos, cp.pf().bpp);
+  update->maxRectArea = rfb::Server::maxRectArea;
+  update->maxRectWidth = 0;
+
+  // Tight can't send rectangles wider than tightMaxWidth or of more than
+  // tightMaxPixels, so they're split up within this update rather than the
+  // rest waiting for the next one.  The client may be sent Tight whenever it
+  // supports it, if encodings are being selected.
+
+  if (cp.supportsEncoding(encodingTight)) {
+    update->maxRectWidth = tightMaxWidth;
+    if (!update->maxRectArea || update->maxRectArea > tightMaxPixels)
+      update->maxRectArea = tightMaxPixels;
   }
+  update->lossless = refresh;
+
+  if (needRenderedCursor() && !renderedCursorRect.is_empty() &&
+      !update->changed.intersect(renderedCursorRect).is_empty())
+    drawRenderedCursor = true;
+
+  writer()->setEncodeCache(server->getEncodeCache());
+  return true;
+}
+
+
+// writeUpdate() encodes and writes an update given by prepareUpdate().  It
+// only uses this connection's own state and the server's rendered cursor, so
+// that the updates for different connections can be written at the same time
+// by different threads.  Areas of a single colour are picked out of the
+// update here rather than in prepareUpdate(), since that means reading the
+// pixels.
+
+void VNCSConnectionST::writeUpdate(UpdateInfo* update)
+{
+  UpdateArena::Scope scope(&arena);
+  sock->outStream().resetCounters();
+  unsigned int kbps = sock->outStream().kbitsPerSecond();
+  int rawBytesBefore = writer()->getRawBytesEquivalent();
+  writer()->setClientKbitsPerSecond(kbps);
+  writer()->findSolidRects(update, &image_getter);
+  int nRects = update->numRects() + (drawRenderedCursor ? 1 : 0);
+  writer()->writeFramebufferUpdateStart(nRects);
+  Region updatedRegion;
+  writer()->writeRects(*update, &image_getter, &updatedRegion);
+  updates.subtract(updatedRegion);
+  if (drawRenderedCursor)
+    writeRenderedCursorRect();
+  writer()->writeFramebufferUpdateEnd();
+  int bytes = (sock->outStream().bytesCopied() +
+               sock->outStream().bytesReferenced());
+  pacer.updateSent(bytes, writer()->getRawBytesEquivalent() - rawBytesBefore,
+                   sock->outStream().queuedBytes(),
+                   sock->outStream().kbitsPerSecond());
+  vlog.debug("update of %d bytes, %d copied into the output buffer, "
+             "%d temporary allocations, %d from the heap",
+             bytes, sock->outStream().bytesCopied(),
+             arena.allocations, arena.heapAllocations);
+}
+
+
+// updateWritten() is called once the update has been written, to wait for the
+// client's next request.
+
+void VNCSConnectionST::updateWritten()
+{
+  requested.clear();
+  server->readyClientCount--;
 }
 
 
@@ -580,13 +710,14 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
 void VNCSConnectionST::writeRenderedCursorRect()
 {
+  PixelBuffer* pb = image_getter.getPixelBuffer();
   image_getter.setPixelBuffer(&server->renderedCursor);
   image_getter.setOffset(server->renderedCursorTL);
 
   Rect actual;
   writer()->writeRect(renderedCursorRect, &image_getter, &actual);
 
-  image_getter.setPixelBuffer(server->pb);
+  image_getter.setPixelBuffer(pb);
   image_getter.setOffset(Point(0,0));
 
   drawRenderedCursor = false;
@@ -627,4 +758,9 @@ void VNCSConnectionST::setSocketTimeouts()
   }
   sock->inStream().setTimeout(timeoutms);
   sock->outStream().setTimeout(timeoutms);
+
+  // Queue output for a slow client rather than holding up the other clients
+  // while it catches up.
+  int maxQueued = rfb::Server::clientQueueKBytes * 1024;
+  sock->outStream().setBlocking(maxQueued == 0, maxQueued);
 }
@@ -29,7 +29,10 @@
 #include <set>
 #include <rfb/SConnection.h>
 #include <rfb/SMsgWriter.h>
+#include <rfb/RectMerger.h>
 #include <rfb/TransImageGetter.h>
+#include <rfb/UpdateArena.h>
+#include <rfb/UpdatePacer.h>
 #include <rfb/VNCServerST.h>
 
 namespace rfb {
@@ -67,6 +70,11 @@ namespace rfb {
     void serverCutText(const char *str, int len);
     void setCursorOrClose();
 
+    // flushSocket() sends as much queued output as the socket will take
+    // without waiting, then sends any update which was held back while the
+    // queue was too long.
+    void flushSocket();
+
     // checkIdleTimeout() returns the number of milliseconds left until the
     // idle timeout expires.  If it has expired, the connection is closed and
     // zero is returned.  Zero is also returned if there is no idle timeout.
@@ -103,6 +111,25 @@ namespace rfb {
 
     void approveConnectionOrClose(bool accept, const char* reason);
 
+    // Methods called from VNCServerMT, which do the work of
+    // writeFramebufferUpdate() in stages.  prepareUpdate() and updateWritten()
+    // must be called from the server thread, but writeUpdate() may be called
+    // from any thread, as long as no other methods of this connection are
+    // called until it returns.  writeUpdate() may throw an exception, in
+    // which case the caller should close() the connection rather than calling
+    // updateWritten().
+
+    bool prepareUpdate(UpdateInfo* update);
+    void writeUpdate(UpdateInfo* update);
+    void updateWritten();
+
+    // setUpdatePixelBuffer() makes writeUpdate() read the pixels from pb,
+    // which must be a copy of the server's PixelBuffer, or from the server's
+    // PixelBuffer again if pb is null.
+    void setUpdatePixelBuffer(PixelBuffer* pb) {
+      image_getter.setPixelBuffer(pb ? pb : server->pb);
+    }
+
   private:
     // SConnection callbacks
 
@@ -145,15 +172,22 @@ namespace rfb {
     void setSocketTimeouts();
 
     network::Socket* sock;
+    std::list<VNCSConnectionST*>::iterator clientsEntry; // In server->clients.
     CharArray peerEndpoint;
     bool reverseConnection;
     VNCServerST* server;
     SimpleUpdateTracker updates;
+    RectMerger merger;
+    UpdatePacer pacer;
     TransImageGetter image_getter;
     Region requested;
     bool drawRenderedCursor, removeRenderedCursor;
     Rect renderedCursorRect;
 
+    // arena holds the temporary regions made while working out and writing
+    // an update, and is reset when the update has been written.
+    UpdateArena arena;
+
     std::set<rdr::U32> pressedKeys;
 
     time_t lastEventTime;
@@ -0,0 +1,146 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- VNCServerMT.cxx
+
+#include <vector>
+#include <rdr/Exception.h>
+#include <rfb/ServerCore.h>
+#include <rfb/VNCServerMT.h>
+#include <rfb/VNCSConnectionST.h>
+#include <rfb/SnapshotPixelBuffer.h>
+#include <rfb/WorkerPool.h>
+#include <rfb/LogWriter.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static LogWriter vlog("VNCServerMT");
+
+
+// UpdateJob encodes and writes one client's update.  Any exception is kept for
+// the server thread to deal with, so that one client failing doesn't stop the
+// others' updates being written.
+
+class rfb::UpdateJob : public WorkerPool::Job {
+public:
+  UpdateJob() : client(0) {}
+  virtual void run() {
+    try {
+      client->writeUpdate(&update);
+    } catch (rdr::Exception& e) {
+      error.replaceBuf(strDup(e.str()));
+    }
+  }
+  VNCSConnectionST* client;
+  UpdateInfo update;
+  CharArray error;
+};
+
+
+VNCServerMT::VNCServerMT(const char* name_, SDesktop* desktop_,
+                         SSecurityFactory* securityFactory_)
+  : VNCServerST(name_, desktop_, securityFactory_), workers(0), jobs(0),
+    maxJobs(0)
+{
+}
+
+VNCServerMT::~VNCServerMT()
+{
+  delete workers;
+  delete [] jobs;
+}
+
+
+// getWorkerPool() returns the pool of threads to write updates with, or null
+// if the UpdateThreads parameter says to use just the server thread.
+
+WorkerPool* VNCServerMT::getWorkerPool()
+{
+  int nThreads = rfb::Server::updateThreads;
+  if (nThreads == 1)
+    return 0;
+
+  if (workers) {
+    if (nThreads < 1 || workers->getThreads() == nThreads)
+      return workers->getThreads() > 1 ? workers : 0;
+    delete workers;
+    workers = 0;
+  }
+  workers = new WorkerPool(nThreads);
+  return workers->getThreads() > 1 ? workers : 0;
+}
+
+
+void VNCServerMT::tryUpdate()
+{
+  WorkerPool* pool = getWorkerPool();
+  if (!pool || readyClientCount < 2) {
+    VNCServerST::tryUpdate();
+    return;
+  }
+
+  checkUpdate();
+
+  if (readyClientCount > maxJobs) {
+    delete [] jobs;
+    maxJobs = readyClientCount;
+    jobs = new UpdateJob[maxJobs];
+  }
+
+  int nJobs = 0;
+  std::list<VNCSConnectionST*>::iterator ci, ci_next;
+  for (ci = clients.begin(); ci != clients.end() && nJobs < maxJobs;
+       ci = ci_next) {
+    ci_next = ci; ci_next++;
+    try {
+      if ((*ci)->prepareUpdate(&jobs[nJobs].update))
+        jobs[nJobs++].client = *ci;
+    } catch (rdr::Exception& e) {
+      (*ci)->close(e.str());
+    }
+  }
+
+  if (nJobs == 0)
+    return;
+
+  Region changed;
+  int i;
+  for (i = 0; i < nJobs; i++)
+    changed.assign_union(jobs[i].update.changed);
+  SnapshotPixelBuffer* snapshot = takeSnapshot(changed);
+
+  std::vector<WorkerPool::Job*> jobPtrs(nJobs);
+  for (i = 0; i < nJobs; i++) {
+    snapshot->acquire();
+    jobs[i].client->setUpdatePixelBuffer(snapshot);
+    jobPtrs[i] = &jobs[i];
+  }
+  snapshot->release();
+
+  pool->runJobs(&jobPtrs[0], nJobs);
+
+  for (i = 0; i < nJobs; i++) {
+    jobs[i].client->setUpdatePixelBuffer(0);
+    snapshot->release();
+    if (jobs[i].error.buf) {
+      jobs[i].client->close(jobs[i].error.buf);
+      jobs[i].error.replaceBuf(0);
+    } else {
+      jobs[i].client->updateWritten();
+    }
+  }
+}
@@ -0,0 +1,65 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- VNCServerMT.h
+
+// VNCServer implementation which writes the clients' updates on several
+// threads.  Everything apart from writing updates is done on the server thread
+// just as by VNCServerST, so input events still reach the desktop one at a
+// time and in order.
+//
+// Each time tryUpdate() is called, the server thread works out the update for
+// each client which wants one and brings the changed parts of a framebuffer
+// snapshot up to date (see SnapshotPixelBuffer).  All the clients share the
+// one snapshot, each holding a reference to it until its update has been
+// written.  The updates are then encoded from the snapshot and written
+// to the clients' sockets by a WorkerPool, one client to a job, and
+// tryUpdate() returns once they have all been written.  A client whose update
+// fails is closed afterwards by the server thread.
+//
+// The number of threads is set by the UpdateThreads parameter.  With only one
+// thread, or fewer than two clients wanting an update, VNCServerMT behaves
+// exactly like VNCServerST.
+
+#ifndef __RFB_VNCSERVERMT_H__
+#define __RFB_VNCSERVERMT_H__
+
+#include <rfb/VNCServerST.h>
+
+namespace rfb {
+
+  class WorkerPool;
+  class UpdateJob;
+
+  class VNCServerMT : public VNCServerST {
+  public:
+    VNCServerMT(const char* name_, SDesktop* desktop_,
+                SSecurityFactory* securityFactory_=0);
+    virtual ~VNCServerMT();
+
+    virtual void tryUpdate();
+
+  protected:
+    WorkerPool* getWorkerPool();
+
+    WorkerPool* workers;
+    UpdateJob* jobs;
+    int maxJobs;
+  };
+
+};
+
+#endif
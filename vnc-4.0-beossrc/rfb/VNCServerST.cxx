@@ -57,6 +57,7 @@
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/SnapshotPixelBuffer.h>
 #include <rfb/SSecurityFactoryStandard.h>
 #include <rfb/util.h>
 
@@ -77,8 +78,8 @@ static SSecurityFactoryStandard defaultSecurityFactory;
 VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_,
                          SSecurityFactory* sf)
   : blHosts(&blacklist), desktop(desktop_), desktopStarted(false), pb(0),
-    name(strDup(name_)), pointerClient(0), comparer(0),
-    renderedCursorInvalid(false),
+    name(strDup(name_)), pointerClient(0), readyClientCount(0), eventLoop(0),
+    comparer(0), renderedCursorInvalid(false), changesFound(0),
     securityFactory(sf ? sf : &defaultSecurityFactory),
     queryConnectionHandler(0), useEconomicTranslate(false)
 {
@@ -95,10 +96,13 @@ VNCServerST::~VNCServerST()
   // Delete all the clients, and their sockets, and any closing sockets
   //   NB: Deleting a client implicitly removes it from the clients list
   while (!clients.empty()) {
-    delete clients.front()->getSock();
+    network::Socket* sock = clients.front()->getSock();
+    if (eventLoop) eventLoop->remove(sock->getFd());
     delete clients.front();
+    delete sock;
   }
   while (!closingSockets.empty()) {
+    if (eventLoop) eventLoop->remove(closingSockets.front()->getFd());
     delete closingSockets.front();
     closingSockets.pop_front();
   }
@@ -109,6 +113,7 @@ VNCServerST::~VNCServerST()
     desktop->stop();
   }
 
+  deleteSnapshots();
   delete comparer;
 }
 
@@ -122,6 +127,8 @@ void VNCServerST::addClient(network::Socket* sock)
 
 void VNCServerST::addClient(network::Socket* sock, bool reverse)
 {
+  if (eventLoop) eventLoop->add(sock->getFd());
+
   // - Check the connection isn't black-marked
   // *** do this in getSecurity instead?
   CharArray address(sock->getPeerAddress());
@@ -145,23 +152,22 @@ void VNCServerST::addClient(network::Socket* sock, bool reverse)
 bool VNCServerST::processSocketEvent(network::Socket* sock)
 {
   // - Find the appropriate VNCSConnectionST and process the event
-  std::list<VNCSConnectionST*>::iterator ci;
-  for (ci = clients.begin(); ci != clients.end(); ci++) {
-    if ((*ci)->getSock() == sock) {
-      if ((*ci)->processMessages())
-        return true;
-      // processMessages failed, so delete the client
-      delete *ci;
-      break;
-    }
+  VNCSConnectionST* client = findClient(sock);
+  if (client) {
+    if (client->processMessages())
+      return true;
+    // processMessages failed, so delete the client
+    delete client;
+  } else {
+    closingSockets.remove(sock);
   }
 
   // - If no client is using the Socket then delete it
-  closingSockets.remove(sock);
+  if (eventLoop) eventLoop->remove(sock->getFd());
   delete sock;
 
   // - Check that the desktop object is still required
-  if (authClientCount() == 0 && desktopStarted) {
+  if (desktopStarted && !anyAuthClients()) {
     slog.debug("no authenticated clients - stopping desktop");
     desktopStarted = false;
     desktop->stop();
@@ -171,6 +177,13 @@ bool VNCServerST::processSocketEvent(network::Socket* sock)
   return false;
 }
 
+void VNCServerST::processSocketWriteEvent(network::Socket* sock)
+{
+  VNCSConnectionST* client = findClient(sock);
+  if (client)
+    client->flushSocket();
+}
+
 int VNCServerST::checkTimeouts()
 {
   int timeout = 0;
@@ -178,6 +191,12 @@ int VNCServerST::checkTimeouts()
   for (ci=clients.begin();ci!=clients.end();ci=ci_next) {
     ci_next = ci; ci_next++;
     soonestTimeout(&timeout, (*ci)->checkIdleTimeout());
+    if (eventLoop) {
+      network::Socket* sock = (*ci)->getSock();
+      eventLoop->setEvents(sock->getFd(), network::EventLoop::Read |
+                           (sock->outStream().queuedBytes() > 0
+                            ? network::EventLoop::Write : 0));
+    }
   }
   return timeout;
 }
@@ -191,6 +210,9 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_)
   delete comparer;
   comparer = 0;
 
+  encodeCache.clear();
+  deleteSnapshots();
+
   if (pb) {
     comparer = new ComparingUpdateTracker(pb);
     cursor.setPF(pb->getPF());
@@ -246,12 +268,7 @@ void VNCServerST::add_copied(const Region& dest, const Point& delta)
 
 bool VNCServerST::clientsReadyForUpdate()
 {
-  std::list<VNCSConnectionST*>::iterator ci;
-  for (ci = clients.begin(); ci != clients.end(); ci++) {
-    if ((*ci)->readyForUpdate())
-      return true;
-  }
-  return false;
+  return readyClientCount > 0;
 }
 
 void VNCServerST::tryUpdate()
@@ -301,13 +318,9 @@ void VNCServerST::setCursorPos(int x, int y)
 void VNCServerST::approveConnection(network::Socket* sock, bool accept,
                                     const char* reason)
 {
-  std::list<VNCSConnectionST*>::iterator ci;
-  for (ci = clients.begin(); ci != clients.end(); ci++) {
-    if ((*ci)->getSock() == sock) {
-      (*ci)->approveConnectionOrClose(accept, reason);
-      return;
-    }
-  }
+  VNCSConnectionST* client = findClient(sock);
+  if (client)
+    client->approveConnectionOrClose(accept, reason);
 }
 
 void VNCServerST::closeClients(const char* reason, network::Socket* except)
@@ -320,6 +333,46 @@ void VNCServerST::closeClients(const char* reason, network::Socket* except)
   }
 }
 
+void VNCServerST::setEventLoop(network::EventLoop* loop)
+{
+  std::list<network::Socket*> sockets;
+  getSockets(&sockets);
+  std::list<network::Socket*>::iterator si;
+  if (eventLoop) {
+    for (si = sockets.begin(); si != sockets.end(); si++)
+      eventLoop->remove((*si)->getFd());
+  }
+  eventLoop = loop;
+  if (eventLoop) {
+    for (si = sockets.begin(); si != sockets.end(); si++)
+      eventLoop->add((*si)->getFd());
+  }
+}
+
+void VNCServerST::processEvent(int fd, int events)
+{
+  network::Socket* sock = 0;
+  VNCSConnectionST* client = findClient(fd);
+  if (client) {
+    sock = client->getSock();
+  } else {
+    std::list<network::Socket*>::iterator si;
+    for (si = closingSockets.begin(); si != closingSockets.end(); si++) {
+      if ((*si)->getFd() == fd) {
+        sock = *si;
+        break;
+      }
+    }
+  }
+  if (!sock)
+    return;
+
+  if (events & network::EventLoop::Write)
+    processSocketWriteEvent(sock);
+  if (events & network::EventLoop::Read)
+    processSocketEvent(sock);
+}
+
 void VNCServerST::getSockets(std::list<network::Socket*>* sockets)
 {
   sockets->clear();
@@ -334,12 +387,7 @@ void VNCServerST::getSockets(std::list<network::Socket*>* sockets)
 }
 
 SConnection* VNCServerST::getSConnection(network::Socket* sock) {
-  std::list<VNCSConnectionST*>::iterator ci;
-  for (ci = clients.begin(); ci != clients.end(); ci++) {
-    if ((*ci)->getSock() == sock)
-      return *ci;
-  }
-  return 0;
+  return findClient(sock);
 }
 
 
@@ -366,6 +414,30 @@ int VNCServerST::authClientCount() {
   return count;
 }
 
+bool VNCServerST::anyAuthClients() {
+  std::list<VNCSConnectionST*>::iterator ci;
+  for (ci = clients.begin(); ci != clients.end(); ci++) {
+    if ((*ci)->authenticated())
+      return true;
+  }
+  return false;
+}
+
+VNCSConnectionST* VNCServerST::findClient(int fd)
+{
+  if (fd < 0 || fd >= (int)clientsByFd.size())
+    return 0;
+  return clientsByFd[fd];
+}
+
+VNCSConnectionST* VNCServerST::findClient(network::Socket* sock)
+{
+  VNCSConnectionST* client = findClient(sock->getFd());
+  if (client && client->getSock() != sock)
+    return 0;
+  return client;
+}
+
 inline bool VNCServerST::needRenderedCursor()
 {
   std::list<VNCSConnectionST*>::iterator ci;
@@ -381,6 +453,43 @@ inline bool VNCServerST::needRenderedCursor()
 // state of the (server-side) rendered cursor, if necessary rendering it again
 // with the correct background.
 
+EncodeCache* VNCServerST::getEncodeCache()
+{
+  // NB: std::list::size() may count the whole list.
+  if (!rfb::Server::shareEncodings || clients.empty() ||
+      ++clients.begin() == clients.end())
+    return 0;
+  return &encodeCache;
+}
+
+SnapshotPixelBuffer* VNCServerST::takeSnapshot(const Region& region)
+{
+  SnapshotPixelBuffer* snapshot = 0;
+  std::list<SnapshotPixelBuffer*>::iterator si;
+  for (si = snapshots.begin(); si != snapshots.end(); si++) {
+    if (!(*si)->inUse()) {
+      snapshot = *si;
+      break;
+    }
+  }
+  if (!snapshot) {
+    snapshot = new SnapshotPixelBuffer(pb);
+    snapshots.push_back(snapshot);
+    slog.debug("created framebuffer snapshot %d", (int)snapshots.size());
+  }
+  snapshot->update(region);
+  snapshot->acquire();
+  return snapshot;
+}
+
+void VNCServerST::deleteSnapshots()
+{
+  while (!snapshots.empty()) {
+    delete snapshots.front();
+    snapshots.pop_front();
+  }
+}
+
 void VNCServerST::checkUpdate()
 {
   bool renderCursor = needRenderedCursor();
@@ -388,6 +497,8 @@ void VNCServerST::checkUpdate()
   if (comparer->is_empty() && !(renderCursor && renderedCursorInvalid))
     return;
 
+  UpdateArena::Scope scope(&arena);
+
   Region toCheck = comparer->get_changed().union_(comparer->get_copied());
 
   if (renderCursor) {
@@ -419,6 +530,23 @@ void VNCServerST::checkUpdate()
     renderedCursorInvalid = false;
   }
 
+  // Anything encoded from the old framebuffer contents is no use now.
+
+  if (!comparer->is_empty()) {
+    encodeCache.clear();
+    changesFound++;
+  }
+
+  // The snapshots' copies of everything that was checked may be out of date,
+  // even where compare() found no change: the framebuffer may be live screen
+  // memory, which a snapshot could have copied mid-change.
+
+  if (!snapshots.empty()) {
+    std::list<SnapshotPixelBuffer*>::iterator si;
+    for (si = snapshots.begin(); si != snapshots.end(); si++)
+      (*si)->invalidate(toCheck);
+  }
+
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
   for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
     ci_next = ci; ci_next++;
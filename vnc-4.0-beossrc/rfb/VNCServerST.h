@@ -24,6 +24,7 @@
 #define __RFB_VNCSERVERST_H__
 
 #include <list>
+#include <vector>
 
 #include <rfb/SDesktop.h>
 #include <rfb/VNCServer.h>
@@ -31,13 +32,17 @@
 #include <rfb/LogWriter.h>
 #include <rfb/Blacklist.h>
 #include <rfb/Cursor.h>
+#include <rfb/EncodeCache.h>
+#include <rfb/UpdateArena.h>
 #include <network/Socket.h>
+#include <network/EventLoop.h>
 
 namespace rfb {
 
   class VNCSConnectionST;
   class ComparingUpdateTracker;
   class PixelBuffer;
+  class SnapshotPixelBuffer;
 
   class VNCServerST : public VNCServer, public network::SocketServer {
   public:
@@ -71,12 +76,28 @@ namespace rfb {
 
     virtual bool processSocketEvent(network::Socket* sock);
 
+    // - Send output queued for the client using a particular Socket
+    //   The platform-specific side calls this when a Socket with queued
+    //   output becomes writable.  The Socket is never deleted.
+
+    virtual void processSocketWriteEvent(network::Socket* sock);
+
     // - checkTimeouts() returns the number of milliseconds left until the next
     //   idle timeout expires.  If any have already expired, the corresponding
     //   connections are closed.  Zero is returned if there is no idle timeout.
 
+    //   It also sets which client sockets the EventLoop, if there is one,
+    //   should wait to write to, so call it just before waiting.
+
     virtual int checkTimeouts();
 
+    // - getChangesFound() returns the number of times that checking for an
+    //   update has found the framebuffer changed.  The platform-specific
+    //   side can compare it before and after scanning the screen, to scan
+    //   less often while nothing is changing.
+
+    unsigned int getChangesFound() { return changesFound; }
+
 
     // Methods overridden from VNCServer
 
@@ -111,6 +132,14 @@ namespace rfb {
     void addClient(network::Socket* sock, bool reverse);
 
 
+    // setEventLoop() makes the server register its sockets with loop, from
+    // when they are added until just before they are deleted.  processEvent()
+    // then handles the events which loop.wait() reports for them, and ignores
+    // any fd which isn't one of the server's sockets.
+
+    void setEventLoop(network::EventLoop* loop);
+    void processEvent(int fd, int events);
+
     // getSockets() gets a list of sockets.  This can be used to generate an
     // fd_set for calling select().
 
@@ -205,7 +234,20 @@ namespace rfb {
 
     std::list<VNCSConnectionST*> clients;
     VNCSConnectionST* pointerClient;
+
+    // clientsByFd holds each client at the index of its socket's file
+    // descriptor, so that events and sockets can be matched to clients
+    // without searching the list.  findClient() returns 0 if the socket or
+    // fd isn't a client's.
+    std::vector<VNCSConnectionST*> clientsByFd;
+
+    // readyClientCount is the number of clients which have requested an
+    // update, so that clientsReadyForUpdate() needn't ask each of them.
+    int readyClientCount;
+    VNCSConnectionST* findClient(int fd);
+    VNCSConnectionST* findClient(network::Socket* sock);
     std::list<network::Socket*> closingSockets;
+    network::EventLoop* eventLoop;
 
     ComparingUpdateTracker* comparer;
 
@@ -218,9 +260,27 @@ namespace rfb {
 
     // - Check how many of the clients are authenticated.
     int authClientCount();
+    bool anyAuthClients();
 
     bool needRenderedCursor();
     void checkUpdate();
+    UpdateArena arena; // For checkUpdate()'s temporary regions.
+    unsigned int changesFound;
+
+    // getEncodeCache() returns the cache of encoded rectangles for clients to
+    // share, or null if sharing is turned off or there's only one client.
+    EncodeCache* getEncodeCache();
+    EncodeCache encodeCache;
+
+    // takeSnapshot() returns a snapshot of the framebuffer which is up to date
+    // within the given region, with a reference held for the caller.  A
+    // snapshot which nobody holds a reference to is reused, so that only the
+    // tiles which have changed since it was last used need copying.
+    // checkUpdate() keeps the snapshots informed of changes, and
+    // setPixelBuffer() deletes them.
+    SnapshotPixelBuffer* takeSnapshot(const Region& region);
+    void deleteSnapshots();
+    std::list<SnapshotPixelBuffer*> snapshots;
 
     SSecurityFactory* securityFactory;
     QueryConnectionHandler* queryConnectionHandler;
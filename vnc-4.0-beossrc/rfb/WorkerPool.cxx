@@ -0,0 +1,168 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- WorkerPool.cxx
+
+#include <string.h>
+#include <rdr/Exception.h>
+#include <rfb/WorkerPool.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+static LogWriter vlog("WorkerPool");
+
+#ifdef __RFB_THREADING_IMPL
+
+class rfb::WorkerThread : public Thread {
+public:
+  WorkerThread(WorkerPool* pool_) : Thread("rfb::WorkerPool"), pool(pool_) {}
+  virtual void run() { pool->workerLoop(); }
+private:
+  WorkerPool* pool;
+};
+
+WorkerPool::WorkerPool(int nThreads_)
+  : nThreads(nThreads_), workers(0),
+    jobsReady(&mutex), jobsDone(&mutex), jobs(0), nJobs(0), nextJob(0),
+    nFinished(0), stopping(false), failed(false)
+{
+  errorMsg[0] = 0;
+  if (nThreads < 1)
+    nThreads = Thread::cpuCount();
+  if (nThreads < 1)
+    nThreads = 1;
+  vlog.debug("starting %d worker threads", nThreads - 1);
+  workers = new WorkerThread*[nThreads];
+  for (int i = 0; i < nThreads - 1; i++) {
+    workers[i] = new WorkerThread(this);
+    workers[i]->start();
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    Lock l(mutex);
+    stopping = true;
+    jobsReady.broadcast();
+  }
+  for (int i = 0; i < nThreads - 1; i++) {
+    workers[i]->join();
+    delete workers[i];
+  }
+  delete [] workers;
+}
+
+void WorkerPool::runJobs(Job** jobs_, int nJobs_)
+{
+  if (nThreads == 1 || nJobs_ < 2) {
+    for (int i = 0; i < nJobs_; i++)
+      jobs_[i]->run();
+    return;
+  }
+
+  {
+    Lock l(mutex);
+    jobs = jobs_;
+    nJobs = nJobs_;
+    nextJob = 0;
+    nFinished = 0;
+    failed = false;
+    jobsReady.broadcast();
+  }
+
+  // Lend a hand, then wait for the jobs other threads are still doing.
+
+  while (runNextJob())
+    ;
+
+  Lock l(mutex);
+  while (nFinished < nJobs)
+    jobsDone.wait();
+  jobs = 0;
+  nJobs = 0;
+  if (failed)
+    throw rdr::Exception(errorMsg);
+}
+
+// runNextJob() runs one job if there are any left to be started, returning
+// false if there weren't.
+
+bool WorkerPool::runNextJob()
+{
+  Job* job;
+  {
+    Lock l(mutex);
+    if (nextJob >= nJobs)
+      return false;
+    job = jobs[nextJob++];
+  }
+
+  bool ok = true;
+  char msg[256];
+  try {
+    job->run();
+  } catch (rdr::Exception& e) {
+    ok = false;
+    strncpy(msg, e.str(), sizeof(msg) - 1);
+    msg[sizeof(msg) - 1] = 0;
+  }
+
+  Lock l(mutex);
+  if (!ok && !failed) {
+    failed = true;
+    strcpy(errorMsg, msg);
+  }
+  if (++nFinished == nJobs)
+    jobsDone.signal();
+  return true;
+}
+
+void WorkerPool::workerLoop()
+{
+  while (true) {
+    {
+      Lock l(mutex);
+      while (!stopping && nextJob >= nJobs)
+        jobsReady.wait();
+      if (stopping)
+        return;
+    }
+    while (runNextJob())
+      ;
+  }
+}
+
+#else
+
+WorkerPool::WorkerPool(int nThreads_) : nThreads(1)
+{
+  if (nThreads_ > 1)
+    vlog.info("no threading support, jobs will be run one at a time");
+}
+
+WorkerPool::~WorkerPool()
+{
+}
+
+void WorkerPool::runJobs(Job** jobs, int nJobs)
+{
+  for (int i = 0; i < nJobs; i++)
+    jobs[i]->run();
+}
+
+#endif
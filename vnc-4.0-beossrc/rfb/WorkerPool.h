@@ -0,0 +1,81 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// WorkerPool - a set of threads for splitting up a piece of work.
+//
+// runJobs() hands out the jobs to the worker threads and to the calling
+// thread, and returns when all of them have been run.  Jobs are taken in
+// order, but may finish in any order, so each job should put its results
+// somewhere of its own and the caller can then combine them in order.  If a
+// job throws an rdr::Exception, the remaining jobs are still run and then an
+// exception with the same message is thrown from runJobs().
+//
+// On platforms without threading support (see rfb/Threading.h) the jobs are
+// just run one after the other by the calling thread.
+//
+
+#ifndef __RFB_WORKERPOOL_H__
+#define __RFB_WORKERPOOL_H__
+
+#include <rfb/Threading.h>
+
+namespace rfb {
+
+  class WorkerThread;
+
+  class WorkerPool {
+  public:
+    class Job {
+    public:
+      virtual ~Job() {}
+      virtual void run() = 0;
+    };
+
+    // nThreads is the total number of threads to use, including the caller.
+    // Zero means one thread per processor.
+    WorkerPool(int nThreads);
+    ~WorkerPool();
+
+    void runJobs(Job** jobs, int nJobs);
+
+    int getThreads() const { return nThreads; }
+
+  private:
+    friend class WorkerThread;
+
+    int nThreads;
+
+#ifdef __RFB_THREADING_IMPL
+    bool runNextJob();
+    void workerLoop();
+
+    WorkerThread** workers;
+    Mutex mutex;
+    Condition jobsReady;
+    Condition jobsDone;
+    Job** jobs;
+    int nJobs;
+    int nextJob;
+    int nFinished;
+    bool stopping;
+    char errorMsg[256];
+    bool failed;
+#endif
+  };
+
+}
+#endif
@@ -15,6 +15,7 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
+#include <sys/time.h>
 #include <rdr/OutStream.h>
 #include <rfb/Exception.h>
 #include <rfb/ImageGetter.h>
@@ -22,17 +23,29 @@
 #include <rfb/ConnParams.h>
 #include <rfb/SMsgWriter.h>
 #include <rfb/ZRLEEncoder.h>
+#include <rfb/WorkerPool.h>
 #include <rfb/Configuration.h>
+#include <rfb/LogWriter.h>
 
 using namespace rfb;
 
+static LogWriter vlog("ZRLEEncoder");
+
 rdr::MemOutStream* ZRLEEncoder::sharedMos = 0;
 int ZRLEEncoder::maxLen = 513 * 4096; // enough for width 8192 32-bit pixels
 
 IntParameter zlibLevel("ZlibLevel","Zlib compression level",-1);
+BoolParameter zlibAdaptive("ZlibAdaptive",
+                           "Adjust the zlib compression level to suit each "
+                           "client's connection, starting from ZlibLevel",
+                           true);
+IntParameter zrleThreads("ZRLEThreads",
+                         "Number of threads used to encode each large ZRLE "
+                         "rectangle (0 = one per processor)",1);
 
 #define EXTRA_ARGS ImageGetter* ig
 #define GET_IMAGE_INTO_BUF(r,buf) ig->getImage(buf, r);
+#define GET_IMAGE_PTR(r,stride) ig->getImagePtr(r, stride)
 #define BPP 8
 #include <rfb/zrleEncode.h>
 #undef BPP
@@ -49,40 +62,104 @@ IntParameter zlibLevel("ZlibLevel","Zlib compression level",-1);
 #undef CPIXEL
 #undef BPP
 
+// With ZlibAdaptive, each connection starts at ZlibLevel and moves between
+// MIN_LEVEL and MAX_LEVEL.  Every ADJUST_MICROS of encoding time the rate
+// at which compressed data came out is compared with the rate at which the
+// client has been taking it.  ZlibLevel -1 is zlib's default, which is
+// DEFAULT_LEVEL.
+
+#define DEFAULT_LEVEL 6
+#define MIN_LEVEL 1
+#define MAX_LEVEL 9
+#define ADJUST_MICROS 50000
+
 Encoder* ZRLEEncoder::create(SMsgWriter* writer)
 {
   return new ZRLEEncoder(writer);
 }
 
 ZRLEEncoder::ZRLEEncoder(SMsgWriter* writer_)
-  : writer(writer_), zos(0,0,zlibLevel)
+  : writer(writer_), zos(0,0,zlibLevel), level(zlibLevel),
+    adaptive(zlibAdaptive),
+    sampleBytes(0), sampleMicros(0), independent(false), sentRect(false),
+    workers(0)
 {
+  for (int i = 0; i < 10; i++)
+    levelRects[i] = levelBytes[i] = 0;
+
+  if (adaptive && level < 0)
+    level = DEFAULT_LEVEL;
+
   if (sharedMos)
     mos = sharedMos;
   else
     mos = new rdr::MemOutStream(129*1024);
 }
 
-ZRLEEncoder::~ZRLEEncoder()
+// Once we've said we're shareable, data from other clients' encoders may have
+// been sent in place of ours, so the next rectangle has to start afresh.
+
+bool ZRLEEncoder::shareable()
 {
-  if (!sharedMos)
-    delete mos;
+  if (!writer->getEncodeCache() || !sentRect)
+    return false;
+  independent = true;
+  return true;
 }
 
-bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
+// Level -1 compresses just as DEFAULT_LEVEL does, so it gives the same
+// settings, and the real level in the statistics.
+
+int ZRLEEncoder::settings()
 {
-  rdr::U8* imageBuf = writer->getImageBuf(64 * 64 * 4 + 4);
-  mos->clear();
-  bool wroteAll = true;
-  *actual = r;
+  return level < 0 ? DEFAULT_LEVEL : level;
+}
 
+// adjustLevel() moves the level a step towards whichever of encoding and the
+// connection is holding things up.  If the client can take data faster than
+// it is being produced, time is being wasted on compression.  If it takes
+// less than half as fast, the connection is the limit and it's worth
+// compressing harder.  The gap between the two keeps the level from going
+// back and forth.
+
+void ZRLEEncoder::adjustLevel(int bytes, int micros)
+{
+  sampleBytes += bytes;
+  sampleMicros += micros;
+  if (sampleMicros < ADJUST_MICROS)
+    return;
+
+  double encodeKbps = sampleBytes * 8000.0 / sampleMicros;
+  double clientKbps = writer->clientKbitsPerSecond();
+  sampleBytes = sampleMicros = 0;
+  if (!clientKbps)
+    return;
+
+  int newLevel = level;
+  if (clientKbps > encodeKbps && level > MIN_LEVEL)
+    newLevel--;
+  else if (clientKbps * 2 < encodeKbps && level < MAX_LEVEL)
+    newLevel++;
+  if (newLevel == level)
+    return;
+
+  vlog.debug("zlib level %d: encoding at %d kbit/s, client taking %d kbit/s",
+             newLevel, (int)encodeKbps, (int)clientKbps);
+  level = newLevel;
+}
+
+// encodeRect() encodes r with the zrleEncode function which suits the
+// client's pixel format.
+
+static bool encodeRect(const Rect& r, rdr::MemOutStream* mos,
+                       rdr::ZlibOutStream* zos, void* imageBuf, int maxLen,
+                       Rect* actual, ImageGetter* ig, SMsgWriter* writer)
+{
   switch (writer->bpp()) {
   case 8:
-    wroteAll = zrleEncode8(r, mos, &zos, imageBuf, maxLen, actual, ig);
-    break;
+    return zrleEncode8(r, mos, zos, imageBuf, maxLen, actual, ig);
   case 16:
-    wroteAll = zrleEncode16(r, mos, &zos, imageBuf, maxLen, actual, ig);
-    break;
+    return zrleEncode16(r, mos, zos, imageBuf, maxLen, actual, ig);
   case 32:
     {
       const PixelFormat& pf = writer->getConnParams()->pf();
@@ -98,25 +175,175 @@ bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
       if ((fitsInLS3Bytes && !pf.bigEndian) ||
           (fitsInMS3Bytes && pf.bigEndian))
       {
-        wroteAll = zrleEncode24A(r, mos, &zos, imageBuf, maxLen, actual, ig);
+        return zrleEncode24A(r, mos, zos, imageBuf, maxLen, actual, ig);
       }
       else if ((fitsInLS3Bytes && pf.bigEndian) ||
                (fitsInMS3Bytes && !pf.bigEndian))
       {
-        wroteAll = zrleEncode24B(r, mos, &zos, imageBuf, maxLen, actual, ig);
+        return zrleEncode24B(r, mos, zos, imageBuf, maxLen, actual, ig);
       }
       else
       {
-        wroteAll = zrleEncode32(r, mos, &zos, imageBuf, maxLen, actual, ig);
+        return zrleEncode32(r, mos, zos, imageBuf, maxLen, actual, ig);
       }
-      break;
     }
   }
+  return true;
+}
+
+// A ZRLEBandJob encodes one band of a rectangle into its own MemOutStream,
+// starting from a fresh zlib stream with no header, so that the result can
+// be appended to the connection's stream with writeSegment().
+
+class rfb::ZRLEBandJob : public WorkerPool::Job {
+public:
+  ZRLEBandJob(int level_) : level(level_), zos(0,0,level_) {
+    zos.omitHeader();
+  }
+  virtual void run() {
+    mos.clear();
+    zos.setUnderlying(&mos);
+    zos.reset();
+    zos.setCompressionLevel(level);
+    actual = band;
+    wroteAll = encodeRect(band, &mos, &zos, imageBuf, maxLen, &actual, ig,
+                          writer);
+  }
+  Rect band;
+  int level;
+  ImageGetter* ig;
+  SMsgWriter* writer;
+  int maxLen;
+  rdr::U8 imageBuf[64 * 64 * 4 + 4];
+  rdr::MemOutStream mos;
+  rdr::ZlibOutStream zos;
+  Rect actual;
+  bool wroteAll;
+};
+
+// The destructor is here so that ZRLEBandJob is complete when jobs are
+// deleted.
+
+ZRLEEncoder::~ZRLEEncoder()
+{
+  for (int i = 0; i < 10; i++)
+    if (levelRects[i])
+      vlog.info("    zlib level %d: %d rects, %d bytes", i, levelRects[i],
+                levelBytes[i]);
+  if (!sharedMos)
+    delete mos;
+  for (unsigned int i = 0; i < jobs.size(); i++)
+    delete jobs[i];
+  delete workers;
+}
+
+// Below this many pixels it isn't worth waking up the other threads.
+
+#define MIN_PARALLEL_AREA (256*256)
+
+// Bands per thread.  More bands even out the load, but each one starts
+// compressing without a dictionary, which costs a little compression.
+
+#define BANDS_PER_THREAD 2
+
+WorkerPool* ZRLEEncoder::getWorkerPool(const Rect& r)
+{
+  int nThreads = zrleThreads;
+  if (nThreads == 1 || r.area() < MIN_PARALLEL_AREA || r.height() <= 64)
+    return 0;
+
+  if (workers) {
+    if (nThreads < 1 || workers->getThreads() == nThreads)
+      return workers->getThreads() > 1 ? workers : 0;
+    delete workers;
+    workers = 0;
+  }
+  workers = new WorkerPool(nThreads);
+  return workers->getThreads() > 1 ? workers : 0;
+}
+
+// writeBands() encodes r as bands of whole tile rows on the worker threads,
+// and joins the bands together in order in mos.  As with a single stream,
+// it stops once the data would exceed maxLen, setting actual to the part
+// which was written.
+
+bool ZRLEEncoder::writeBands(const Rect& r, WorkerPool* pool,
+                             ImageGetter* ig, Rect* actual)
+{
+  int tileRows = (r.height() + 63) / 64;
+  int nBands = min_vnc(tileRows, pool->getThreads() * BANDS_PER_THREAD);
+  int rowsPerBand = (tileRows + nBands - 1) / nBands;
+  nBands = (tileRows + rowsPerBand - 1) / rowsPerBand;
+
+  while ((int)jobs.size() < nBands)
+    jobs.push_back(new ZRLEBandJob(level));
+
+  for (int i = 0; i < nBands; i++) {
+    int y = r.tl.y + i * rowsPerBand * 64;
+    jobs[i]->band = Rect(r.tl.x, y, r.br.x,
+                         min_vnc(r.br.y, y + rowsPerBand * 64));
+    jobs[i]->level = level;
+    jobs[i]->ig = ig;
+    jobs[i]->writer = writer;
+    jobs[i]->maxLen = maxLen;
+  }
+
+  std::vector<WorkerPool::Job*> poolJobs(jobs.begin(), jobs.begin() + nBands);
+  pool->runJobs(&poolJobs[0], nBands);
+
+  zos.setUnderlying(mos);
+  for (int i = 0; i < nBands; i++) {
+    ZRLEBandJob* job = jobs[i];
+    if (i > 0 && mos->length() + job->mos.length() > maxLen) {
+      actual->br.y = job->band.tl.y;
+      return false;
+    }
+    zos.writeSegment(job->mos.data(), job->mos.length());
+    if (!job->wroteAll) {
+      actual->br.y = job->actual.br.y;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
+{
+  rdr::U8* imageBuf = writer->getImageBuf(64 * 64 * 4 + 4);
+  mos->clear();
+
+  // While sharing, the client's zlib stream may not match ours, so we have
+  // to start afresh each time, including the first rectangle after sharing
+  // stops.
+
+  zos.setUnderlying(mos);
+  if (writer->getEncodeCache() || independent)
+    zos.reset();
+  independent = (writer->getEncodeCache() != 0);
+  zos.setCompressionLevel(level);
+  bool wroteAll = true;
+  *actual = r;
+
+  struct timeval before, after;
+  gettimeofday(&before, 0);
+  WorkerPool* pool = getWorkerPool(r);
+  if (pool)
+    wroteAll = writeBands(r, pool, ig, actual);
+  else
+    wroteAll = encodeRect(r, mos, &zos, imageBuf, maxLen, actual, ig, writer);
+  gettimeofday(&after, 0);
+  levelRects[settings()]++;
+  levelBytes[settings()] += mos->length();
 
   writer->startRect(*actual, encodingZRLE);
   rdr::OutStream* os = writer->getOutStream();
   os->writeU32(mos->length());
   os->writeBytes(mos->data(), mos->length());
   writer->endRect();
+  sentRect = true;
+
+  if (adaptive)
+    adjustLevel(mos->length(), ((after.tv_sec - before.tv_sec) * 1000000 +
+                                after.tv_usec - before.tv_usec));
   return wroteAll;
 }
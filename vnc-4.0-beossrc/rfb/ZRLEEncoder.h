@@ -18,18 +18,28 @@
 #ifndef __RFB_ZRLEENCODER_H__
 #define __RFB_ZRLEENCODER_H__
 
+#include <vector>
 #include <rdr/MemOutStream.h>
 #include <rdr/ZlibOutStream.h>
 #include <rfb/Encoder.h>
 
 namespace rfb {
 
+  class WorkerPool;
+  class ZRLEBandJob;
+
   class ZRLEEncoder : public Encoder {
   public:
     static Encoder* create(SMsgWriter* writer);
     virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual);
     virtual ~ZRLEEncoder();
 
+    // While the writer has an EncodeCache, each rectangle is compressed
+    // independently of the ones before it, so that it can be shared.  The
+    // first rectangle on a connection carries the zlib header, so it isn't.
+    virtual bool shareable();
+    virtual int settings();
+
     // setMaxLen() sets the maximum size in bytes of any ZRLE rectangle.  This
     // can be used to stop the MemOutStream from growing too large.  The value
     // must be large enough to allow for at least one row of ZRLE tiles.  So
@@ -41,11 +51,38 @@ namespace rfb {
     // ZRLEEncoders.  Should be called before any ZRLEEncoders are created.
     static void setSharedMos(rdr::MemOutStream* mos_) { sharedMos = mos_; }
 
+    // The zlib level is set by the ZlibLevel parameter, where -1 means
+    // zlib's default.  With ZlibAdaptive it is then adjusted to suit the
+    // connection: lower when the client could take data faster than it is
+    // being encoded, higher when the connection is the limit.  settings()
+    // gives the current level (see SMsgWriter::getZlibLevel()), and the
+    // number of rectangles and bytes sent at each level is logged at the
+    // end.
+
+    // Large rectangles may be split into bands of whole tile rows which are
+    // encoded by several threads (see the ZRLEThreads parameter).  Each band
+    // is compressed independently and the results are joined together in
+    // order into a single ZRLE rectangle.
+
   private:
     ZRLEEncoder(SMsgWriter* writer);
+    void adjustLevel(int bytes, int micros);
+    WorkerPool* getWorkerPool(const Rect& r);
+    bool writeBands(const Rect& r, WorkerPool* pool, ImageGetter* ig,
+                    Rect* actual);
     SMsgWriter* writer;
     rdr::ZlibOutStream zos;
     rdr::MemOutStream* mos;
+    int level;
+    bool adaptive;
+    int sampleBytes;
+    int sampleMicros;
+    int levelRects[10];
+    int levelBytes[10];
+    bool independent;
+    bool sentRect;
+    WorkerPool* workers;
+    std::vector<ZRLEBandJob*> jobs;
     static rdr::MemOutStream* sharedMos;
     static int maxLen;
   };
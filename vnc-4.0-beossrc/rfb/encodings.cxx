@@ -28,6 +28,7 @@ int rfb::encodingNum(const char* name)
   if (strcasecmp(name, "RRE") == 0)      return encodingRRE;
   if (strcasecmp(name, "CoRRE") == 0)    return encodingCoRRE;
   if (strcasecmp(name, "hextile") == 0)  return encodingHextile;
+  if (strcasecmp(name, "Tight") == 0)    return encodingTight;
   if (strcasecmp(name, "ZRLE") == 0)     return encodingZRLE;
   return -1;
 }
@@ -40,6 +41,7 @@ const char* rfb::encodingName(unsigned int num)
   case encodingRRE:      return "RRE";
   case encodingCoRRE:    return "CoRRE";
   case encodingHextile:  return "hextile";
+  case encodingTight:    return "Tight";
   case encodingZRLE:     return "ZRLE";
   default:               return "[unknown encoding]";
   }
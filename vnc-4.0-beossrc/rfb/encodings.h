@@ -25,6 +25,7 @@ namespace rfb {
   const unsigned int encodingRRE = 2;
   const unsigned int encodingCoRRE = 4;
   const unsigned int encodingHextile = 5;
+  const unsigned int encodingTight = 7;
   const unsigned int encodingZRLE = 16;
 
   const unsigned int encodingMax = 255;
@@ -32,6 +33,14 @@ namespace rfb {
   const unsigned int pseudoEncodingCursor = 0xffffff11;
   const unsigned int pseudoEncodingDesktopSize = 0xffffff21;
 
+  // Tight compression levels 0 to 9
+  const unsigned int pseudoEncodingCompressLevel0 = 0xffffff00;
+  const unsigned int pseudoEncodingCompressLevel9 = 0xffffff09;
+
+  // Tight JPEG quality levels 0 to 9
+  const unsigned int pseudoEncodingQualityLevel0 = 0xffffffe0;
+  const unsigned int pseudoEncodingQualityLevel9 = 0xffffffe9;
+
   int encodingNum(const char* name);
   const char* encodingName(unsigned int num);
 }
@@ -22,9 +22,17 @@
 // BPP                - 8, 16 or 32
 // EXTRA_ARGS         - optional extra arguments
 // GET_IMAGE_INTO_BUF - gets a rectangle of pixel data into a buffer
+// GET_IMAGE_PTR      - optional, gets a pointer to pixel data which is
+//                      already in the right format, or 0 if there isn't one
+//
+// The tiles are analysed with the pixel masks from HextileKernels.h, so
+// neither the classification nor the subrectangle search writes to the pixel
+// data, and every tile is encoded from the pixel data wherever it is.
 
+#include <string.h>
 #include <rdr/OutStream.h>
 #include <rfb/hextileConstants.h>
+#include <rfb/HextileKernels.h>
 
 namespace rfb {
 
@@ -41,9 +49,12 @@ namespace rfb {
 #define HEXTILE_ENCODE_TILE CONCAT2E(hextileEncodeTile,BPP)
 #define TEST_TILE_TYPE CONCAT2E(hextileTestTileType,BPP)
 
-int TEST_TILE_TYPE (PIXEL_T* data, int w, int h, PIXEL_T* bg, PIXEL_T* fg);
-int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
-                         rdr::U8* encoded, PIXEL_T bg);
+int TEST_TILE_TYPE (const PIXEL_T* data, int w, int h, int stride,
+                    HextileMasks* masks, rdr::U16* isBg,
+                    PIXEL_T* bg, PIXEL_T* fg);
+int HEXTILE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                         int tileType, const HextileMasks* masks,
+                         const rdr::U16* isBg, rdr::U8* encoded);
 
 void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
 #ifdef EXTRA_ARGS
@@ -57,6 +68,8 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
   bool oldBgValid = false;
   bool oldFgValid = false;
   rdr::U8 encoded[256*(BPP/8)];
+  HextileMasks masks;
+  rdr::U16 isBg[16];
 
   for (t.tl.y = r.tl.y; t.tl.y < r.br.y; t.tl.y += 16) {
 
@@ -66,10 +79,20 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
 
       t.br.x = min_vnc(r.br.x, t.tl.x + 16);
 
-      GET_IMAGE_INTO_BUF(t,buf);
+      const PIXEL_T* data = 0;
+      int stride = t.width();
+#ifdef GET_IMAGE_PTR
+      data = (const PIXEL_T*)GET_IMAGE_PTR(t, &stride);
+#endif
+      if (!data) {
+        GET_IMAGE_INTO_BUF(t,buf);
+        data = buf;
+        stride = t.width();
+      }
 
       PIXEL_T bg, fg;
-      int tileType = TEST_TILE_TYPE(buf, t.width(), t.height(), &bg, &fg);
+      int tileType = TEST_TILE_TYPE(data, t.width(), t.height(), stride,
+                                    &masks, isBg, &bg, &fg);
 
       if (!oldBgValid || oldBg != bg) {
         tileType |= hextileBgSpecified;
@@ -91,13 +114,13 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
           }
         }
 
-        encodedLen = HEXTILE_ENCODE_TILE(buf, t.width(), t.height(), tileType,
-                                         encoded, bg);
+        encodedLen = HEXTILE_ENCODE_TILE(data, t.width(), t.height(), stride,
+                                         tileType, &masks, isBg, encoded);
 
         if (encodedLen < 0) {
-          GET_IMAGE_INTO_BUF(t,buf);
           os->writeU8(hextileRaw);
-          os->writeBytes(buf, t.width() * t.height() * (BPP/8));
+          for (int y = 0; y < t.height(); y++)
+            os->writeBytes(&data[y * stride], t.width() * (BPP/8));
           oldBgValid = oldFgValid = false;
           continue;
         }
@@ -112,129 +135,155 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
 }
 
 
-int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
-                         rdr::U8* encoded, PIXEL_T bg)
+// HEXTILE_ENCODE_TILE works along the rows, taking each pixel which is
+// neither background nor already covered as the top-left corner of a
+// subrectangle.  The run of pixels to its right which are the same as their
+// left neighbours gives the width, and the rows below in which the whole
+// run is the same as the row above give the height.  As in the original
+// search, a taller and narrower subrectangle is used instead if it covers
+// more.  Each pixel which is neither background nor the same as its left or
+// upper neighbour must start a subrectangle of its own, so counting those
+// gives a lower bound on the encoded size, and if even that is bigger than
+// the raw tile, the search is not done at all.
+
+int HEXTILE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                         int tileType, const HextileMasks* masks,
+                         const rdr::U16* isBg, rdr::U8* encoded)
 {
+  const rdr::U32 full = (1 << w) - 1;
+  const int rawLen = w*h*(BPP/8);
+  const int subrectLen = ((tileType & hextileSubrectsColoured)
+                          ? 2 + (BPP/8) : 2);
+  int y;
+
+  int corners = 0;
+  for (y = 0; y < h; y++)
+    corners += hextileCountBits(~(masks->left[y] | masks->above[y] | isBg[y])
+                                & full);
+  if (1 + corners * subrectLen > rawLen) return -1;
+
+  rdr::U32 done[16];
+  for (y = 0; y < h; y++)
+    done[y] = isBg[y];
+
   rdr::U8* nSubrectsPtr = encoded;
   *nSubrectsPtr = 0;
   encoded++;
 
-  for (int y = 0; y < h; y++)
+  for (y = 0; y < h; y++)
   {
-    int x = 0;
-    while (x < w) {
-      if (*data == bg) {
-        x++;
-        data++;
-        continue;
-      }
+    rdr::U32 todo;
+    while ((todo = ~done[y] & full) != 0) {
+      int x = hextileLowestBit(todo);
+      const PIXEL_T* pix = &data[y * stride + x];
 
       // Find horizontal subrect first
-      PIXEL_T* ptr = data+1;
-      PIXEL_T* eol = data+w-x;
-      while (ptr < eol && *ptr == *data) ptr++;
-      int sw = ptr - data;
+      rdr::U32 run = (masks->left[y] & ~done[y]) >> (x+1);
+      int sw = 1 + hextileLowestBit(~run);
+      rdr::U32 rowBits = ((1 << sw) - 1) << x;
 
-      ptr = data + w;
       int sh = 1;
-      while (sh < h-y) {
-        eol = ptr + sw;
-        while (ptr < eol)
-          if (*ptr++ != *data) goto endOfHorizSubrect;
-        ptr += w - sw;
+      while (sh < h-y &&
+             (masks->above[y+sh] & ~done[y+sh] & rowBits) == rowBits)
         sh++;
-      }
-    endOfHorizSubrect:
 
       // Find vertical subrect
+      rdr::U32 colBit = 1 << x;
       int vh;
       for (vh = sh; vh < h-y; vh++)
-        if (data[vh*w] != *data) break;
+        if (!(masks->above[y+vh] & ~done[y+vh] & colBit)) break;
 
       if (vh != sh) {
-        ptr = data+1;
-        int vw;
-        for (vw = 1; vw < sw; vw++) {
-          for (int i = 0; i < vh; i++)
-            if (ptr[i*w] != *data) goto endOfVertSubrect;
-          ptr++;
-        }
-      endOfVertSubrect:
+        rdr::U32 cols = rowBits;
+        for (int i = 1; i < vh; i++)
+          cols &= masks->above[y+i] & ~done[y+i];
+        int vw = hextileLowestBit(~(cols >> x));
 
         // If vertical subrect bigger than horizontal then use that.
         if (sw*sh < vw*vh) {
           sw = vw;
           sh = vh;
+          rowBits = ((1 << sw) - 1) << x;
         }
       }
 
       (*nSubrectsPtr)++;
 
       if (tileType & hextileSubrectsColoured) {
-        if (encoded - nSubrectsPtr + (BPP/8) > w*h*(BPP/8)) return -1;
+        if (encoded - nSubrectsPtr + (BPP/8) > rawLen) return -1;
 #if (BPP == 8)
-        *encoded++ = *data;
+        *encoded++ = *pix;
 #elif (BPP == 16)
-        *encoded++ = ((rdr::U8*)data)[0];
-        *encoded++ = ((rdr::U8*)data)[1];
+        *encoded++ = ((const rdr::U8*)pix)[0];
+        *encoded++ = ((const rdr::U8*)pix)[1];
 #elif (BPP == 32)
-        *encoded++ = ((rdr::U8*)data)[0];
-        *encoded++ = ((rdr::U8*)data)[1];
-        *encoded++ = ((rdr::U8*)data)[2];
-        *encoded++ = ((rdr::U8*)data)[3];
+        *encoded++ = ((const rdr::U8*)pix)[0];
+        *encoded++ = ((const rdr::U8*)pix)[1];
+        *encoded++ = ((const rdr::U8*)pix)[2];
+        *encoded++ = ((const rdr::U8*)pix)[3];
 #endif
       }
 
-      if (encoded - nSubrectsPtr + 2 > w*h*(BPP/8)) return -1;
+      if (encoded - nSubrectsPtr + 2 > rawLen) return -1;
       *encoded++ = (x << 4) | y;
       *encoded++ = ((sw-1) << 4) | (sh-1);
 
-      ptr = data+w;
-      PIXEL_T* eor = data+w*sh;
-      while (ptr < eor) {
-        eol = ptr + sw;
-        while (ptr < eol) *ptr++ = bg;
-        ptr += w - sw;
-      }
-      x += sw;
-      data += sw;
+      for (int i = 0; i < sh; i++)
+        done[y+i] |= rowBits;
     }
   }
   return encoded - nSubrectsPtr;
 }
 
 
-int TEST_TILE_TYPE (PIXEL_T* data, int w, int h, PIXEL_T* bg, PIXEL_T* fg)
+// TEST_TILE_TYPE fills in the tile's masks, and isBg with the pixels of the
+// background colour.  A tile of two colours takes the commoner one as its
+// background.
+
+int TEST_TILE_TYPE (const PIXEL_T* data, int w, int h, int stride,
+                    HextileMasks* masks, rdr::U16* isBg,
+                    PIXEL_T* bg, PIXEL_T* fg)
 {
-  int tileType = 0;
-  PIXEL_T pix1 = *data, pix2 = 0;
-  int count1 = 0, count2 = 0;
-  PIXEL_T* end = data + w*h;
-
-  for (PIXEL_T* ptr = data; ptr < end; ptr++) {
-    if (*ptr == pix1) {
-      count1++;
-      continue;
-    }
+  const rdr::U32 full = (1 << w) - 1;
+  int y;
+
+  hextileTileMasks((const rdr::U8*)data, stride * (BPP/8), w, h, BPP/8,
+                   masks);
+
+  int count1 = 0;
+  for (y = 0; y < h; y++)
+    count1 += hextileCountBits(masks->first[y]);
+
+  PIXEL_T pix1 = *data;
+  if (count1 == w*h) {
+    *bg = *fg = pix1;
+    for (y = 0; y < h; y++)
+      isBg[y] = masks->first[y];
+    return 0;
+  }
 
-    if (count2 == 0) {
-      tileType |= hextileAnySubrects;
-      pix2 = *ptr;
-    }
+  for (y = 0; masks->first[y] == full; y++) ;
+  PIXEL_T pix2 = data[y * stride + hextileLowestBit(~masks->first[y] & full)];
 
-    if (*data == pix2) {
-      count2++;
-      continue;
-    }
+  rdr::U16 second[16];
+  hextileMatchMasks((const rdr::U8*)data, stride * (BPP/8), w, h, BPP/8,
+                    pix2, second);
+  int count2 = 0;
+  for (y = 0; y < h; y++)
+    count2 += hextileCountBits(second[y]);
 
+  int tileType = hextileAnySubrects;
+  if (count1 + count2 < w*h)
     tileType |= hextileSubrectsColoured;
-    break;
-  }
 
   if (count1 >= count2) {
     *bg = pix1; *fg = pix2;
+    for (y = 0; y < h; y++)
+      isBg[y] = masks->first[y];
   } else {
     *bg = pix2; *fg = pix1;
+    for (y = 0; y < h; y++)
+      isBg[y] = second[y];
   }
   return tileType;
 }
@@ -0,0 +1,40 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_TIGHTCONSTANTS_H__
+#define __RFB_TIGHTCONSTANTS_H__
+namespace rfb {
+  // Compression control byte: the top four bits, after shifting down
+  const int tightExplicitFilter = 0x04;
+  const int tightFill = 0x08;
+  const int tightJpeg = 0x09;
+  const int tightMaxSubencoding = 0x09;
+
+  // Filter ids
+  const int tightFilterCopy = 0x00;
+  const int tightFilterPalette = 0x01;
+  const int tightFilterGradient = 0x02;
+
+  // Data of fewer bytes than this is sent without compressing it
+  const int tightMinToCompress = 12;
+
+  // Clients only allow rectangles up to this wide
+  const int tightMaxWidth = 2048;
+
+  // Rectangles are kept to this many pixels, so that at four bytes a pixel
+  // the length of their compressed data still fits in the 22 bits it's sent in
+  const int tightMaxPixels = 1000000;
+}
+#endif
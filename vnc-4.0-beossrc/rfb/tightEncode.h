@@ -0,0 +1,497 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// tightEncode.h - Tight encoding function.
+//
+// This file is #included after having set the following macro:
+// BPP                - 8, 16 or 32
+//
+// TIGHT_ENCODE writes the body of a Tight rectangle, from the compression
+// control byte on, for the pixels given.  The pixel data is never written
+// to.
+//
+
+#include <string.h>
+#include <rdr/OutStream.h>
+#include <rfb/CompareKernels.h>
+#include <rfb/TightEncoder.h>
+#include <rfb/tightConstants.h>
+
+namespace rfb {
+
+// CONCAT2E concatenates its arguments, expanding them if they are macros
+
+#ifndef CONCAT2E
+#define CONCAT2(a,b) a##b
+#define CONCAT2E(a,b) CONCAT2(a,b)
+#endif
+
+#ifndef TIGHT_ONCE
+#define TIGHT_ONCE
+
+#define TIGHT_SWAP16(n) ((((n) & 0xff) << 8) | (((n) >> 8) & 0xff))
+#define TIGHT_SWAP32(n) (((n) >> 24) | (((n) & 0x00ff0000) >> 8) | \
+                         (((n) & 0x0000ff00) << 8) | ((n) << 24))
+
+// TightPalette finds the colours in a rectangle, giving each its index, with
+// a simple hash table.  clear() only empties the slots which were used, so
+// that it costs little for small rectangles.
+
+class TightPalette {
+public:
+  enum { MAX_SIZE = 256, HASH_SIZE = 4096, EMPTY = 0xffff };
+
+  TightPalette() : size(0)
+  {
+    for (int i = 0; i < HASH_SIZE + MAX_SIZE; i++)
+      index[i] = EMPTY;
+  }
+
+  inline int hash(rdr::U32 pix)
+  {
+    return (pix ^ (pix >> 9) ^ (pix >> 17)) & (HASH_SIZE - 1);
+  }
+
+  // insert() adds pix if it's new, returning false if that would make more
+  // than maxSize colours.
+
+  inline bool insert(rdr::U32 pix, int maxSize)
+  {
+    int i = hash(pix);
+    while (index[i] != EMPTY) {
+      if (key[i] == pix) return true;
+      i++;
+    }
+    if (size == maxSize) return false;
+
+    index[i] = size;
+    key[i] = pix;
+    slot[size] = i;
+    colours[size++] = pix;
+    return true;
+  }
+
+  inline int lookup(rdr::U32 pix)
+  {
+    int i = hash(pix);
+    while (index[i] != EMPTY && key[i] != pix)
+      i++;
+    return index[i] == EMPTY ? -1 : index[i];
+  }
+
+  void clear()
+  {
+    for (int i = 0; i < size; i++)
+      index[slot[i]] = EMPTY;
+    size = 0;
+  }
+
+  rdr::U32 colours[MAX_SIZE];
+  int size;
+
+private:
+  rdr::U16 index[HASH_SIZE + MAX_SIZE];
+  rdr::U32 key[HASH_SIZE + MAX_SIZE];
+  rdr::U16 slot[MAX_SIZE];
+};
+
+// The gradient filter and JPEG are only used if a sample of the errors in
+// predicting each pixel from its neighbours says the picture is smooth, or
+// looks like a photograph.  Runs of DETECT_RUN pixels are looked at, from
+// rows spread over the rectangle and starting at places spread across it.
+// TightSmoothness counts the components looked at, those predicted exactly
+// and those out by more than DETECT_LARGE_ERROR (scaled to eight bits), and
+// adds up the squares of the errors.
+
+#define DETECT_RUN 8
+#define DETECT_ROWS 64
+#define DETECT_MIN_SIZE 16
+#define DETECT_LARGE_ERROR 48
+
+// JPEG is only tried for rectangles of at least JPEG_MIN_AREA pixels, and
+// only if fewer than JPEG_MAX_ZEROS percent of the errors are zero and
+// fewer than JPEG_MAX_LARGE percent are large.
+
+#define JPEG_MIN_AREA 4096
+#define JPEG_MAX_ZEROS 50
+#define JPEG_MAX_LARGE 5
+
+struct TightSmoothness {
+  int samples;
+  int zeros;
+  int large;
+  double sumSquares;
+
+  // smooth() is true if the gradient filter looks worth using.  If nearly
+  // all the errors are zero, the picture is flat enough for zlib to do well
+  // without it.  Otherwise it is smooth if the mean square of the errors
+  // which aren't zero is under the threshold.
+  bool smooth(int threshold) const {
+    if (samples == 0 || zeros * 100 >= samples * 95)
+      return false;
+    return sumSquares / (samples - zeros) < threshold;
+  }
+
+  // photographic() is true if the picture looks like a photograph, which
+  // JPEG does well with: few pixels are exactly predicted, as they are in
+  // the flat areas and sharp edges of text and drawings, and few are far
+  // out, as they are at those edges.
+  bool photographic() const {
+    return (samples != 0 && zeros * 100 < samples * JPEG_MAX_ZEROS &&
+            large * 100 < samples * JPEG_MAX_LARGE);
+  }
+};
+#endif
+
+#define PIXEL_T rdr::CONCAT2E(U,BPP)
+#define WRITE_PIXEL CONCAT2E(writeOpaque,BPP)
+#define TIGHT_ENCODE CONCAT2E(tightEncode,BPP)
+#define TIGHT_WRITE_PIXEL CONCAT2E(tightWritePixel,BPP)
+#define TIGHT_FILL_PALETTE CONCAT2E(tightFillPalette,BPP)
+#define TIGHT_WRITE_MONO CONCAT2E(tightWriteMono,BPP)
+#define TIGHT_WRITE_INDEXED CONCAT2E(tightWriteIndexed,BPP)
+#define TIGHT_WRITE_FULL CONCAT2E(tightWriteFull,BPP)
+#define TIGHT_WRITE_GRADIENT CONCAT2E(tightWriteGradient,BPP)
+#define TIGHT_DETECT_SMOOTH CONCAT2E(tightDetectSmooth,BPP)
+
+#if (BPP == 8)
+#define SWAP_PIXEL(n) (n)
+#elif (BPP == 16)
+#define SWAP_PIXEL(n) TIGHT_SWAP16(n)
+#else
+#define SWAP_PIXEL(n) TIGHT_SWAP32(n)
+#endif
+
+// TIGHT_WRITE_PIXEL writes a pixel as it is, or as red, green and blue bytes
+// if the format says so.
+
+inline void TIGHT_WRITE_PIXEL(rdr::OutStream* os, PIXEL_T pix,
+                              const TightFormat& tf)
+{
+#if (BPP == 32)
+  if (tf.pack24) {
+    rdr::U32 value = tf.swap ? SWAP_PIXEL(pix) : pix;
+    os->writeU8(value >> tf.redShift);
+    os->writeU8(value >> tf.greenShift);
+    os->writeU8(value >> tf.blueShift);
+    return;
+  }
+#endif
+  os->WRITE_PIXEL(pix);
+}
+
+// TIGHT_FILL_PALETTE returns the number of colours in the rectangle, or 0
+// if there are more than maxColours.
+
+int TIGHT_FILL_PALETTE(const PIXEL_T* data, int w, int h, int stride,
+                       TightPalette* palette, int maxColours)
+{
+  palette->clear();
+  PIXEL_T prev = data[0];
+  palette->insert(prev, maxColours);
+
+  for (int y = 0; y < h; y++) {
+    const PIXEL_T* row = data + y * stride;
+    for (int x = 0; x < w; x++) {
+      if (row[x] == prev) continue;
+      prev = row[x];
+      if (!palette->insert(prev, maxColours))
+        return 0;
+    }
+  }
+  return palette->size;
+}
+
+// TIGHT_WRITE_MONO writes a bit for each pixel, 1 if it isn't bg, with each
+// row starting a new byte.
+
+void TIGHT_WRITE_MONO(const PIXEL_T* data, int w, int h, int stride,
+                      PIXEL_T bg, rdr::OutStream* os)
+{
+  rdr::U8 rowBuf[(tightMaxWidth + 7) / 8];
+
+  for (int y = 0; y < h; y++) {
+    const PIXEL_T* row = data + y * stride;
+    rdr::U8* out = rowBuf;
+    unsigned int bits = 0;
+    int x;
+    for (x = 0; x < w; x++) {
+      bits = (bits << 1) | (row[x] != bg);
+      if ((x & 7) == 7) {
+        *out++ = bits;
+        bits = 0;
+      }
+    }
+    if (x & 7)
+      *out++ = bits << (8 - (x & 7));
+    os->writeBytes(rowBuf, out - rowBuf);
+  }
+}
+
+void TIGHT_WRITE_INDEXED(const PIXEL_T* data, int w, int h, int stride,
+                         TightPalette* palette, rdr::OutStream* os)
+{
+  rdr::U8 rowBuf[tightMaxWidth];
+  PIXEL_T prev = data[0];
+  rdr::U8 index = palette->lookup(prev);
+
+  for (int y = 0; y < h; y++) {
+    const PIXEL_T* row = data + y * stride;
+    for (int x = 0; x < w; x++) {
+      if (row[x] != prev) {
+        prev = row[x];
+        index = palette->lookup(prev);
+      }
+      rowBuf[x] = index;
+    }
+    os->writeBytes(rowBuf, w);
+  }
+}
+
+void TIGHT_WRITE_FULL(const PIXEL_T* data, int w, int h, int stride,
+                      const TightFormat& tf, rdr::OutStream* os)
+{
+#if (BPP == 32)
+  if (tf.pack24) {
+    rdr::U8 rowBuf[tightMaxWidth * 3];
+    for (int y = 0; y < h; y++) {
+      const PIXEL_T* row = data + y * stride;
+      rdr::U8* out = rowBuf;
+      for (int x = 0; x < w; x++) {
+        rdr::U32 value = tf.swap ? SWAP_PIXEL(row[x]) : row[x];
+        *out++ = value >> tf.redShift;
+        *out++ = value >> tf.greenShift;
+        *out++ = value >> tf.blueShift;
+      }
+      os->writeBytes(rowBuf, w * 3);
+    }
+    return;
+  }
+#endif
+  for (int y = 0; y < h; y++)
+    os->writeBytes(data + y * stride, w * (BPP/8));
+}
+
+#if (BPP != 8)
+
+// TIGHT_WRITE_GRADIENT predicts each component of each pixel as the one to
+// its left plus the one above less the one above and to the left, taking
+// those outside the rectangle as zero, and writes what's left over, modulo
+// the component's maximum.  buf must have room for 6 * (w + 1) ints, which
+// hold the components of the row above and this row, each with a zero pixel
+// on the left.
+
+void TIGHT_WRITE_GRADIENT(const PIXEL_T* data, int w, int h, int stride,
+                          const TightFormat& tf, int* buf,
+                          rdr::OutStream* os)
+{
+  rdr::U8 rowBuf[tightMaxWidth * (BPP/8)];
+  const int max[3] = { tf.redMax, tf.greenMax, tf.blueMax };
+  const int shift[3] = { tf.redShift, tf.greenShift, tf.blueShift };
+  int* above = buf;
+  int* here = buf + 3 * (w + 1);
+
+  memset(above, 0, 3 * (w + 1) * sizeof(int));
+  here[0] = here[1] = here[2] = 0;
+
+  for (int y = 0; y < h; y++) {
+    const PIXEL_T* row = data + y * stride;
+    rdr::U8* out = rowBuf;
+    for (int x = 0; x < w; x++) {
+      rdr::U32 value = tf.swap ? SWAP_PIXEL(row[x]) : row[x];
+      rdr::U32 residue = 0;
+      for (int c = 0; c < 3; c++) {
+        int component = (value >> shift[c]) & max[c];
+        int prediction = here[3*x + c] + above[3*x + 3 + c] - above[3*x + c];
+        if (prediction < 0)
+          prediction = 0;
+        else if (prediction > max[c])
+          prediction = max[c];
+        here[3*x + 3 + c] = component;
+        int diff = (component - prediction) & max[c];
+#if (BPP == 32)
+        if (tf.pack24) {
+          *out++ = diff;
+          continue;
+        }
+#endif
+        residue |= diff << shift[c];
+      }
+#if (BPP == 32)
+      if (tf.pack24) continue;
+#endif
+      PIXEL_T pix = tf.swap ? SWAP_PIXEL(residue) : residue;
+      memcpy(out, &pix, sizeof(pix));
+      out += sizeof(pix);
+    }
+    os->writeBytes(rowBuf, out - rowBuf);
+    int* tmp = above;
+    above = here;
+    here = tmp;
+  }
+}
+
+// TIGHT_DETECT_SMOOTH fills in a TightSmoothness from a sample of the
+// rectangle, or leaves it empty if the rectangle is too small to tell.
+
+void TIGHT_DETECT_SMOOTH(const PIXEL_T* data, int w, int h, int stride,
+                         const TightFormat& tf, TightSmoothness* sm)
+{
+  sm->samples = sm->zeros = sm->large = 0;
+  sm->sumSquares = 0;
+  if (w < DETECT_MIN_SIZE || h < DETECT_MIN_SIZE)
+    return;
+
+  const int max[3] = { tf.redMax, tf.greenMax, tf.blueMax };
+  const int shift[3] = { tf.redShift, tf.greenShift, tf.blueShift };
+  int nRows = h - 1 < DETECT_ROWS ? h - 1 : DETECT_ROWS;
+
+  for (int i = 0; i < nRows; i++) {
+    int y = 1 + i * (h - 1) / nRows;
+    int x0 = 1 + (i * (w - DETECT_RUN - 1) / nRows + i * 7) %
+             (w - DETECT_RUN);
+    const PIXEL_T* row = data + y * stride;
+    const PIXEL_T* prevRow = row - stride;
+
+    for (int x = x0; x < x0 + DETECT_RUN && x < w; x++) {
+      rdr::U32 pix = tf.swap ? SWAP_PIXEL(row[x]) : row[x];
+      rdr::U32 left = tf.swap ? SWAP_PIXEL(row[x-1]) : row[x-1];
+      rdr::U32 up = tf.swap ? SWAP_PIXEL(prevRow[x]) : prevRow[x];
+      rdr::U32 upLeft = tf.swap ? SWAP_PIXEL(prevRow[x-1]) : prevRow[x-1];
+      for (int c = 0; c < 3; c++) {
+        if (max[c] == 0) continue;
+        int prediction = (((left >> shift[c]) & max[c]) +
+                          ((up >> shift[c]) & max[c]) -
+                          ((upLeft >> shift[c]) & max[c]));
+        if (prediction < 0)
+          prediction = 0;
+        else if (prediction > max[c])
+          prediction = max[c];
+        int error = (int)((pix >> shift[c]) & max[c]) - prediction;
+        if (error < 0) error = -error;
+        error = error * 255 / max[c];
+        sm->samples++;
+        if (error == 0)
+          sm->zeros++;
+        else if (error > DETECT_LARGE_ERROR)
+          sm->large++;
+        sm->sumSquares += error * error;
+      }
+    }
+  }
+}
+
+#endif
+
+void TIGHT_ENCODE(const PIXEL_T* data, int w, int h, int stride,
+                  TightEncoder* te)
+{
+  const TightConf& conf = te->conf();
+  const TightFormat& tf = te->format();
+  rdr::OutStream* os = te->getOutStream();
+  int area = w * h;
+  int pixelBytes = (BPP == 32 && tf.pack24) ? 3 : BPP/8;
+
+  rdr::U32 pattern = data[0];
+#if (BPP == 8)
+  pattern *= 0x01010101;
+#elif (BPP == 16)
+  pattern *= 0x00010001;
+#endif
+  if (isSolidBlock((const rdr::U8*)data, stride * (BPP/8), w * (BPP/8), h,
+                   pattern)) {
+    te->writeFill();
+    TIGHT_WRITE_PIXEL(os, data[0], tf);
+    return;
+  }
+
+  int maxColours = area / conf.idxMaxColoursDivisor;
+  if (maxColours < 2 && area >= conf.monoMinRectSize)
+    maxColours = 2;
+  if (maxColours > TightPalette::MAX_SIZE)
+    maxColours = TightPalette::MAX_SIZE;
+
+  TightPalette* palette = te->palette();
+  int nColours = 0;
+  if (maxColours >= 2)
+    nColours = TIGHT_FILL_PALETTE(data, w, h, stride, palette, maxColours);
+
+  if (nColours == 2) {
+    te->writeControl(TightEncoder::streamMono, tightFilterPalette);
+    os->writeU8(1);
+    TIGHT_WRITE_PIXEL(os, palette->colours[0], tf);
+    TIGHT_WRITE_PIXEL(os, palette->colours[1], tf);
+    rdr::OutStream* ds = te->startData(TightEncoder::streamMono,
+                                       (w + 7) / 8 * h);
+    TIGHT_WRITE_MONO(data, w, h, stride, palette->colours[0], ds);
+    te->endData();
+    return;
+  }
+
+  if (nColours > 2) {
+    te->writeControl(TightEncoder::streamIndexed, tightFilterPalette);
+    os->writeU8(nColours - 1);
+    for (int i = 0; i < nColours; i++)
+      TIGHT_WRITE_PIXEL(os, palette->colours[i], tf);
+    rdr::OutStream* ds = te->startData(TightEncoder::streamIndexed, area);
+    TIGHT_WRITE_INDEXED(data, w, h, stride, palette, ds);
+    te->endData();
+    return;
+  }
+
+#if (BPP != 8)
+  TightSmoothness sm;
+  int threshold = tf.pack24 ? conf.gradientThreshold24
+                            : conf.gradientThreshold;
+  bool tryJpeg = te->jpegQuality() && area >= JPEG_MIN_AREA;
+  bool tryGradient = (tf.trueColour && threshold &&
+                      area >= conf.gradientMinRectSize);
+  if (tryJpeg || tryGradient)
+    TIGHT_DETECT_SMOOTH(data, w, h, stride, tf, &sm);
+
+  if (tryJpeg && sm.photographic() &&
+      te->writeJpeg((const rdr::U8*)data, w, h, stride))
+    return;
+
+  if (tryGradient && sm.smooth(threshold)) {
+    te->writeControl(TightEncoder::streamGradient, tightFilterGradient);
+    rdr::OutStream* ds = te->startData(TightEncoder::streamGradient,
+                                       area * pixelBytes);
+    TIGHT_WRITE_GRADIENT(data, w, h, stride, tf, te->getGradientBuf(w), ds);
+    te->endData();
+    return;
+  }
+#endif
+
+  te->writeControl(TightEncoder::streamFullColour, tightFilterCopy);
+  rdr::OutStream* ds = te->startData(TightEncoder::streamFullColour,
+                                     area * pixelBytes);
+  TIGHT_WRITE_FULL(data, w, h, stride, tf, ds);
+  te->endData();
+}
+
+#undef PIXEL_T
+#undef WRITE_PIXEL
+#undef SWAP_PIXEL
+#undef TIGHT_ENCODE
+#undef TIGHT_WRITE_PIXEL
+#undef TIGHT_FILL_PALETTE
+#undef TIGHT_WRITE_MONO
+#undef TIGHT_WRITE_INDEXED
+#undef TIGHT_WRITE_FULL
+#undef TIGHT_WRITE_GRADIENT
+#undef TIGHT_DETECT_SMOOTH
+}
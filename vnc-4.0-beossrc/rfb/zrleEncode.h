@@ -23,10 +23,12 @@
 // BPP                - 8, 16 or 32
 // EXTRA_ARGS         - optional extra arguments
 // GET_IMAGE_INTO_BUF - gets a rectangle of pixel data into a buffer
+// GET_IMAGE_PTR      - optional, gets a pointer to pixel data which is
+//                      already in the right format, or 0 if there isn't one
 //
-// Note that the buf argument to ZRLE_ENCODE needs to be at least one pixel
-// bigger than the largest tile of pixel data, since the ZRLE encoding
-// algorithm writes to the position one past the end of the pixel data.
+// The tiles are encoded wherever the pixel data is, so a tile is only copied
+// into buf if GET_IMAGE_PTR isn't defined or returns 0.  The pixel data is
+// never written to.
 //
 
 #include <rdr/OutStream.h>
@@ -47,12 +49,14 @@ namespace rfb {
 #define WRITE_PIXEL CONCAT2E(writeOpaque,CPIXEL)
 #define ZRLE_ENCODE CONCAT2E(zrleEncode,CPIXEL)
 #define ZRLE_ENCODE_TILE CONCAT2E(zrleEncodeTile,CPIXEL)
+#define ZRLE_WRITE_RUN CONCAT2E(zrleWriteRun,CPIXEL)
 #define BPPOUT 24
 #else
 #define PIXEL_T rdr::CONCAT2E(U,BPP)
 #define WRITE_PIXEL CONCAT2E(writeOpaque,BPP)
 #define ZRLE_ENCODE CONCAT2E(zrleEncode,BPP)
 #define ZRLE_ENCODE_TILE CONCAT2E(zrleEncodeTile,BPP)
+#define ZRLE_WRITE_RUN CONCAT2E(zrleWriteRun,BPP)
 #define BPPOUT BPP
 #endif
 
@@ -112,7 +116,8 @@ public:
 };
 #endif
 
-void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os);
+void ZRLE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                       rdr::OutStream* os);
 
 bool ZRLE_ENCODE (const Rect& r, rdr::OutStream* os,
                   rdr::ZlibOutStream* zos, void* buf, int maxLen, Rect* actual
@@ -145,9 +150,18 @@ bool ZRLE_ENCODE (const Rect& r, rdr::OutStream* os,
 
       t.br.x = min_vnc(r.br.x, t.tl.x + 64);
 
-      GET_IMAGE_INTO_BUF(t,buf);
+      const PIXEL_T* data = 0;
+      int stride = t.width();
+#ifdef GET_IMAGE_PTR
+      data = (const PIXEL_T*)GET_IMAGE_PTR(t, &stride);
+#endif
+      if (!data) {
+        GET_IMAGE_INTO_BUF(t,buf);
+        data = (const PIXEL_T*)buf;
+        stride = t.width();
+      }
 
-      ZRLE_ENCODE_TILE((PIXEL_T*)buf, t.width(), t.height(), zos);
+      ZRLE_ENCODE_TILE(data, t.width(), t.height(), stride, zos);
     }
 
     zos->flush();
@@ -156,29 +170,64 @@ bool ZRLE_ENCODE (const Rect& r, rdr::OutStream* os,
 }
 
 
-void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
+// ZRLE_WRITE_RUN writes out one run of pixels in RLE form.
+
+static inline void ZRLE_WRITE_RUN (PIXEL_T pix, int len, bool usePalette,
+                                   PaletteHelper* ph, rdr::OutStream* os)
+{
+  if (len <= 2 && usePalette) {
+    int index = ph->lookup(pix);
+    if (len == 2)
+      os->writeU8(index);
+    os->writeU8(index);
+    return;
+  }
+  if (usePalette) {
+    int index = ph->lookup(pix);
+    os->writeU8(index | 128);
+  } else {
+    os->WRITE_PIXEL(pix);
+  }
+  len -= 1;
+  while (len >= 255) {
+    os->writeU8(255);
+    len -= 255;
+  }
+  os->writeU8(len);
+}
+
+void ZRLE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                       rdr::OutStream* os)
 {
-  // First find the palette and the number of runs
+  // First find the palette and the number of runs.  Runs carry on from the
+  // end of one row to the start of the next.
 
   PaletteHelper ph;
 
   int runs = 0;
   int singlePixels = 0;
 
-  PIXEL_T* ptr = data;
-  PIXEL_T* end = ptr + h * w;
-  *end = ~*(end-1); // one past the end is different so the while loop ends
-
-  while (ptr < end) {
-    PIXEL_T pix = *ptr;
-    if (*++ptr != pix) {
-      singlePixels++;
-    } else {
-      while (*++ptr == pix) ;
-      runs++;
+  PIXEL_T runPix = *data;
+  int runLen = 0;
+
+  for (int y = 0; y < h; y++) {
+    const PIXEL_T* ptr = data + y * stride;
+    const PIXEL_T* eol = ptr + w;
+    while (ptr < eol) {
+      if (*ptr == runPix) {
+        const PIXEL_T* runStart = ptr;
+        while (++ptr < eol && *ptr == runPix) ;
+        runLen += ptr - runStart;
+        continue;
+      }
+      if (runLen == 1) singlePixels++; else runs++;
+      ph.insert(runPix);
+      runPix = *ptr++;
+      runLen = 1;
     }
-    ph.insert(pix);
   }
+  if (runLen == 1) singlePixels++; else runs++;
+  ph.insert(runPix);
 
   //fprintf(stderr,"runs %d, single pixels %d, paletteSize %d\n",
   //        runs, singlePixels, ph.size);
@@ -239,36 +288,25 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
 
   if (useRle) {
 
-    PIXEL_T* ptr = data;
-    PIXEL_T* end = ptr + w * h;
-    PIXEL_T* runStart;
-    PIXEL_T pix;
-    while (ptr < end) {
-      runStart = ptr;
-      pix = *ptr++;
-      while (*ptr == pix && ptr < end)
-        ptr++;
-      int len = ptr - runStart;
-      if (len <= 2 && usePalette) {
-        int index = ph.lookup(pix);
-        if (len == 2)
-          os->writeU8(index);
-        os->writeU8(index);
-        continue;
-      }
-      if (usePalette) {
-        int index = ph.lookup(pix);
-        os->writeU8(index | 128);
-      } else {
-        os->WRITE_PIXEL(pix);
-      }
-      len -= 1;
-      while (len >= 255) {
-        os->writeU8(255);
-        len -= 255;
+    PIXEL_T runPix = *data;
+    int runLen = 0;
+
+    for (int y = 0; y < h; y++) {
+      const PIXEL_T* ptr = data + y * stride;
+      const PIXEL_T* eol = ptr + w;
+      while (ptr < eol) {
+        if (*ptr == runPix) {
+          const PIXEL_T* runStart = ptr;
+          while (++ptr < eol && *ptr == runPix) ;
+          runLen += ptr - runStart;
+          continue;
+        }
+        ZRLE_WRITE_RUN(runPix, runLen, usePalette, &ph, os);
+        runPix = *ptr++;
+        runLen = 1;
       }
-      os->writeU8(len);
     }
+    ZRLE_WRITE_RUN(runPix, runLen, usePalette, &ph, os);
 
   } else {
 
@@ -282,13 +320,12 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
 
       int bppp = bitsPerPackedPixel[ph.size-1];
 
-      PIXEL_T* ptr = data;
-
       for (int i = 0; i < h; i++) {
         rdr::U8 nbits = 0;
         rdr::U8 byte = 0;
 
-        PIXEL_T* eol = ptr + w;
+        const PIXEL_T* ptr = data + i * stride;
+        const PIXEL_T* eol = ptr + w;
 
         while (ptr < eol) {
           PIXEL_T pix = *ptr++;
@@ -309,13 +346,16 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
 
       // raw
 
+      for (int i = 0; i < h; i++) {
+        const PIXEL_T* row = data + i * stride;
 #ifdef CPIXEL
-      for (PIXEL_T* ptr = data; ptr < data+w*h; ptr++) {
-        os->WRITE_PIXEL(*ptr);
-      }
+        for (const PIXEL_T* ptr = row; ptr < row+w; ptr++) {
+          os->WRITE_PIXEL(*ptr);
+        }
 #else
-      os->writeBytes(data, w*h*(BPP/8));
+        os->writeBytes(row, w*(BPP/8));
 #endif
+      }
     }
   }
 }
@@ -324,5 +364,6 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
 #undef WRITE_PIXEL
 #undef ZRLE_ENCODE
 #undef ZRLE_ENCODE_TILE
+#undef ZRLE_WRITE_RUN
 #undef BPPOUT
 }
@@ -0,0 +1,258 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- CompareBench.cxx
+//
+// Times ComparingUpdateTracker::compare() over a whole framebuffer of random
+// pixels: with nothing changed, with every block changed, and with every
+// other block changed in a checkerboard.  Before timing, it checks that
+// scattered single pixel changes are found in exactly the right blocks, and
+// that the old copy is brought up to date.  compare() is timed with and
+// without DetectCopies, since looking for moved areas (rfb/CopyDetector.h)
+// takes as long as the comparison itself when most of the screen changes.
+//
+// It also times the block loops on their own, without the regions: the
+// memcmp() and memcpy() of each block in turn which compareRect() used to
+// do, and compareBlockRow(), which goes a scanline at a time across a row of
+// blocks until it finds a difference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <rfb/ComparingUpdateTracker.h>
+#include <rfb/CompareKernels.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ServerCore.h>
+#include <rfb/util.h>
+#include "benchmarks.h"
+
+using namespace rfb;
+
+#define RUNS 20
+#define BLOCK_SIZE 16
+
+static PixelFormat formatForBpp(int bpp)
+{
+  switch (bpp) {
+  case 8:  return PixelFormat(8, 8, false, true, 7, 7, 3, 0, 3, 6);
+  case 16: return PixelFormat(16, 16, false, true, 31, 63, 31, 11, 5, 0);
+  default: return PixelFormat(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+  }
+}
+
+static bool checkChanges(ManagedPixelBuffer* fb, ComparingUpdateTracker* ct)
+{
+  int w = fb->width(), h = fb->height(), bytes = fb->getPF().bpp / 8;
+  Rect all(0, 0, w, h);
+
+  for (int i = 0; i < 200; i++) {
+    Region expected;
+    int n = rand() % 20;
+    for (int k = 0; k < n; k++) {
+      int x = rand() % w, y = rand() % h;
+      fb->data[(y * w + x) * bytes] ^= 1 + rand() % 255;
+      int bx = x / 16 * 16, by = y / 16 * 16;
+      expected.assign_union(Region(Rect(bx, by, min_vnc(bx + 16, w),
+                                        min_vnc(by + 16, h))));
+    }
+    ct->add_changed(Region(all));
+    ct->compare();
+    bool found = ct->get_changed().equals(expected);
+    ct->clear();
+    if (!found) {
+      fprintf(stderr, "compare: wrong blocks found\n");
+      return false;
+    }
+    ct->add_changed(Region(all));
+    ct->compare();
+    bool updated = ct->get_changed().is_empty();
+    ct->clear();
+    if (!updated) {
+      fprintf(stderr, "compare: old copy not updated\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+// timeCompare() changes the framebuffer with change(), which isn't timed,
+// then times compare() over all of it, and returns the best time in ms.
+
+static double timeCompare(ManagedPixelBuffer* fb, ComparingUpdateTracker* ct,
+                          void (*change)(ManagedPixelBuffer* fb, int run))
+{
+  Rect all(0, 0, fb->width(), fb->height());
+  double best = 1e9;
+  for (int run = 0; run < RUNS; run++) {
+    if (change) change(fb, run);
+    ct->add_changed(Region(all));
+    double start = benchmarkSeconds();
+    ct->compare();
+    double t = benchmarkSeconds() - start;
+    ct->clear();
+    if (t < best) best = t;
+  }
+  return best * 1000;
+}
+
+// memcmpBlocks() is the loop compareRect() had before compareBlockRow().
+
+static int memcmpBlocks(rdr::U8* oldData, const rdr::U8* newData, int w,
+                        int h, int bytes)
+{
+  int stride = w * bytes, nChanged = 0;
+  for (int blockTop = 0; blockTop < h; blockTop += BLOCK_SIZE) {
+    int blockBottom = min_vnc(blockTop + BLOCK_SIZE, h);
+    for (int blockLeft = 0; blockLeft < w; blockLeft += BLOCK_SIZE) {
+      int blockWidthBytes = (min_vnc(blockLeft + BLOCK_SIZE, w) - blockLeft)
+                            * bytes;
+      int offset = blockTop * stride + blockLeft * bytes;
+      rdr::U8* oldPtr = oldData + offset;
+      const rdr::U8* newPtr = newData + offset;
+      for (int y = blockTop; y < blockBottom; y++) {
+        if (memcmp(oldPtr, newPtr, blockWidthBytes) != 0) {
+          nChanged++;
+          for (int y2 = y; y2 < blockBottom; y2++) {
+            memcpy(oldPtr, newPtr, blockWidthBytes);
+            oldPtr += stride;
+            newPtr += stride;
+          }
+          break;
+        }
+        oldPtr += stride;
+        newPtr += stride;
+      }
+    }
+  }
+  return nChanged;
+}
+
+static int blockRowBlocks(rdr::U8* oldData, const rdr::U8* newData, int w,
+                        int h, int bytes)
+{
+  int stride = w * bytes, nChanged = 0;
+  int maxWidth = compareMaxBlocksPerRow * BLOCK_SIZE;
+  for (int blockTop = 0; blockTop < h; blockTop += BLOCK_SIZE) {
+    int blockHeight = min_vnc(BLOCK_SIZE, h - blockTop);
+    for (int x = 0; x < w; x += maxWidth) {
+      int offset = blockTop * stride + x * bytes;
+      rdr::U32 mask = compareBlockRow(oldData + offset, stride,
+                                      newData + offset, stride,
+                                      min_vnc(maxWidth, w - x) * bytes,
+                                      blockHeight, BLOCK_SIZE * bytes);
+      for (; mask; mask &= mask - 1)
+        nChanged++;
+    }
+  }
+  return nChanged;
+}
+
+// timeBlocks() is timeCompare() for one of the block loops, which keeps its
+// own old copy.  It checks that the loop finds as many changed blocks as
+// memcmpBlocks() does.
+
+static double timeBlocks(ManagedPixelBuffer* fb,
+                         int (*blocks)(rdr::U8* oldData,
+                                       const rdr::U8* newData,
+                                       int w, int h, int bytes),
+                         void (*change)(ManagedPixelBuffer* fb, int run),
+                         bool* ok)
+{
+  int w = fb->width(), h = fb->height(), bytes = fb->getPF().bpp / 8;
+  std::vector<rdr::U8> oldData(fb->data, fb->data + fb->dataLen());
+  std::vector<rdr::U8> check(fb->data, fb->data + fb->dataLen());
+  double best = 1e9;
+  for (int run = 0; run < RUNS; run++) {
+    if (change) change(fb, run);
+    double start = benchmarkSeconds();
+    int n = blocks(&oldData[0], fb->data, w, h, bytes);
+    double t = benchmarkSeconds() - start;
+    if (t < best) best = t;
+    if (n != memcmpBlocks(&check[0], fb->data, w, h, bytes) ||
+        memcmp(&oldData[0], fb->data, fb->dataLen()) != 0)
+      *ok = false;
+  }
+  return best * 1000;
+}
+
+static void changeAll(ManagedPixelBuffer* fb, int run)
+{
+  for (int i = (run % 16) * 4; i < fb->dataLen(); i += 64)
+    fb->data[i]++;
+}
+
+static void changeCheckerboard(ManagedPixelBuffer* fb, int run)
+{
+  int w = fb->width(), h = fb->height(), bytes = fb->getPF().bpp / 8;
+  for (int y = 0; y < h; y += 16)
+    for (int x = ((y / 16 + run) & 1) * 16; x < w; x += 32)
+      fb->data[(y * w + x) * bytes]++;
+}
+
+int compareBenchmark(int argc, char** argv)
+{
+  int w = argc > 0 ? atoi(argv[0]) : 2560;
+  int h = argc > 1 ? atoi(argv[1]) : 1600;
+  int bpp = argc > 2 ? atoi(argv[2]) : 32;
+  if (w <= 0 || h <= 0 || (bpp != 8 && bpp != 16 && bpp != 32)) {
+    fprintf(stderr, "compare: bad size or bpp\n");
+    return 1;
+  }
+
+  ManagedPixelBuffer fb(formatForBpp(bpp), w, h);
+  srand(1);
+  for (int i = 0; i < fb.dataLen(); i++)
+    fb.data[i] = rand();
+  ComparingUpdateTracker ct(&fb);
+  ct.compare();
+  ct.clear();
+
+  if (!checkChanges(&fb, &ct))
+    return 1;
+
+  static const struct {
+    const char* name;
+    void (*change)(ManagedPixelBuffer* fb, int run);
+  } cases[] = {
+    { "unchanged", 0 },
+    { "all changed", changeAll },
+    { "checkerboard", changeCheckerboard },
+  };
+
+  printf("%dx%d %dbpp, ms:\n", w, h, bpp);
+  printf("                 compare()  no copies  memcmp loop  "
+         "block row loop\n");
+  bool detectCopies = rfb::Server::detectCopies;
+  bool ok = true;
+  for (int i = 0; i < 3; i++) {
+    rfb::Server::detectCopies.setParam(true);
+    double tracker = timeCompare(&fb, &ct, cases[i].change);
+    rfb::Server::detectCopies.setParam(false);
+    double noCopies = timeCompare(&fb, &ct, cases[i].change);
+    // The tracker's old copy now matches fb, as the block loops' will.
+    double old = timeBlocks(&fb, memcmpBlocks, cases[i].change, &ok);
+    double blockRow = timeBlocks(&fb, blockRowBlocks, cases[i].change, &ok);
+    printf("  %-13s %9.3f %10.3f %12.3f %15.3f\n", cases[i].name, tracker,
+           noCopies, old, blockRow);
+  }
+  rfb::Server::detectCopies.setParam(detectCopies);
+  if (!ok) {
+    fprintf(stderr, "compare: the block loops disagree\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,301 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- HextileBench.cxx
+//
+// Times the Hextile encoder on a synthetic desktop: a window with a title
+// bar, text, a scrollbar, a photograph, toolbar icons and a taskbar over a
+// plain background.  It encodes the whole screen and an odd-sized rectangle
+// whose tiles don't line up with it, at 32, 16 and 8bpp, and decodes each
+// result to check that it gives back the pixels.  By default the encoder
+// reads the pixels where they are, as it does when the client's format is
+// the server's; with "buf" it is given copies, as when they are translated.
+// Run it again with UseSIMD=0 to time the plain C tile kernels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rdr/MemOutStream.h>
+#include <rfb/ConnParams.h>
+#include <rfb/ImageGetter.h>
+#include <rfb/SMsgWriterV3.h>
+#include <rfb/encodings.h>
+#include <rfb/hextileConstants.h>
+#include <rfb/util.h>
+#include "benchmarks.h"
+
+using namespace rfb;
+
+#define WIDTH 1024
+#define HEIGHT 768
+
+class BenchImageGetter : public ImageGetter {
+public:
+  BenchImageGetter(const rdr::U8* fb_, int bytes_, bool direct_)
+    : fb(fb_), bytes(bytes_), direct(direct_) {}
+  virtual void getImage(void* imageBuf, const Rect& r, int stride) {
+    if (!stride) stride = r.width();
+    for (int y = r.tl.y; y < r.br.y; y++)
+      memcpy((rdr::U8*)imageBuf + (y - r.tl.y) * stride * bytes,
+             fb + (y * WIDTH + r.tl.x) * bytes, r.width() * bytes);
+  }
+  virtual const rdr::U8* getImagePtr(const Rect& r, int* stride) {
+    if (!direct) return 0;
+    *stride = WIDTH;
+    return fb + (r.tl.y * WIDTH + r.tl.x) * bytes;
+  }
+private:
+  const rdr::U8* fb;
+  int bytes;
+  bool direct;
+};
+
+static rdr::U32 randomSeed = 12345;
+
+static rdr::U32 nextRandom()
+{
+  randomSeed = randomSeed * 1103515245 + 12345;
+  return randomSeed >> 8;
+}
+
+// makeDesktop() draws the desktop in 24-bit colour.
+
+static void makeDesktop(rdr::U32* fb)
+{
+  int x, y;
+  for (y = 0; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      fb[y * WIDTH + x] = 0x3a6ea5;
+
+  for (y = 40; y < 700; y++) {
+    for (x = 60; x < 980; x++) {
+      rdr::U32 p;
+      if (y < 62)
+        p = ((0x10 + (x - 60) / 8) << 16) | (0x24 + (x - 60) / 10) << 8 | 0x6a;
+      else if (x > 960)
+        p = (y % 40 < 30) ? 0xc0c0c0 : 0x808080;
+      else
+        p = 0xffffff;
+      if (y == 40 || y == 699 || x == 60 || x == 979)
+        p = 0x000000;
+      fb[y * WIDTH + x] = p;
+    }
+  }
+
+  // Lines of text, each glyph a few strokes, some of them anti-aliased.
+  for (int line = 0; line < 25; line++) {
+    int y0 = 70 + line * 16;
+    for (int cx = 70; cx < 560; cx += 7) {
+      if (nextRandom() % 6 == 0) continue;
+      int g = nextRandom();
+      for (int s = 0; s < 4; s++) {
+        int gx = cx + (g >> (s * 3)) % 5, gy = y0 + 2 + (g >> (s * 2 + 8)) % 8;
+        bool vertical = (g >> s) & 1;
+        int len = 2 + (g >> (s + 12)) % 5;
+        for (int k = 0; k < len; k++) {
+          int px = vertical ? gx : gx + k, py = vertical ? gy + k : gy;
+          fb[py * WIDTH + px] = (line & 1) ? 0x000000 : 0x202020;
+          if (line % 3 == 2 && px + 1 < cx + 7)
+            fb[py * WIDTH + px + 1] = 0x909090;
+        }
+      }
+    }
+  }
+
+  for (y = 100; y < 420; y++) {
+    for (x = 600; x < 940; x++) {
+      int r = (x - 600) * 255 / 340, g = (y - 100) * 255 / 320;
+      int b = 128 + (int)(nextRandom() % 24) - 12;
+      fb[y * WIDTH + x] = (r << 16) | (g << 8) | b;
+    }
+  }
+
+  for (int i = 0; i < 12; i++) {
+    for (y = 440; y < 472; y++) {
+      for (x = 600 + i * 28; x < 624 + i * 28; x++) {
+        fb[y * WIDTH + x] = (((x + y) % 5 == 0) ? 0xff0000 :
+                             ((x * y) % 7 == 0) ? 0x00aa00 :
+                             (y > 460) ? 0x2020ff : 0xeeeeee);
+      }
+    }
+  }
+
+  for (y = 740; y < HEIGHT; y++)
+    for (x = 0; x < WIDTH; x++)
+      fb[y * WIDTH + x] = (x % 120 < 110) ? 0xd4d0c8 : 0x404040;
+}
+
+static PixelFormat formatForBpp(int bpp)
+{
+  switch (bpp) {
+  case 8:  return PixelFormat(8, 8, false, true, 7, 7, 3, 0, 3, 6);
+  case 16: return PixelFormat(16, 16, false, true, 31, 63, 31, 11, 5, 0);
+  default: return PixelFormat(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+  }
+}
+
+static void putPixel(rdr::U8* p, int bytes, rdr::U32 rgb)
+{
+  switch (bytes) {
+  case 1:
+    *p = ((rgb >> 21) & 7) | (((rgb >> 13) & 7) << 3) | (((rgb >> 6) & 3) << 6);
+    break;
+  case 2:
+    *(rdr::U16*)p = ((rgb >> 19) << 11) | (((rgb >> 10) & 63) << 5) |
+                    ((rgb >> 3) & 31);
+    break;
+  default:
+    *(rdr::U32*)p = rgb;
+  }
+}
+
+// decode() decodes a Hextile rectangle into out, returning false if the
+// data is malformed or doesn't end where it should.
+
+static bool decode(const rdr::U8* d, const rdr::U8* end, rdr::U8* out,
+                   int bytes, const Rect& r, int* tileTypes)
+{
+  rdr::U8 bg[4], fg[4];
+  memset(bg, 0, sizeof(bg));
+  memset(fg, 0, sizeof(fg));
+
+  for (int ty = r.tl.y; ty < r.br.y; ty += 16) {
+    for (int tx = r.tl.x; tx < r.br.x; tx += 16) {
+      int tw = min_vnc(16, r.br.x - tx), th = min_vnc(16, r.br.y - ty);
+      if (d >= end) return false;
+      int type = *d++;
+      int x, y;
+
+      if (type & hextileRaw) {
+        tileTypes[0]++;
+        for (y = 0; y < th; y++) {
+          memcpy(out + ((ty + y) * WIDTH + tx) * bytes, d, tw * bytes);
+          d += tw * bytes;
+        }
+        continue;
+      }
+
+      if (type & hextileBgSpecified) {
+        memcpy(bg, d, bytes);
+        d += bytes;
+      }
+      for (y = 0; y < th; y++)
+        for (x = 0; x < tw; x++)
+          memcpy(out + ((ty + y) * WIDTH + tx + x) * bytes, bg, bytes);
+      if (type & hextileFgSpecified) {
+        memcpy(fg, d, bytes);
+        d += bytes;
+      }
+      if (!(type & hextileAnySubrects)) {
+        tileTypes[1]++;
+        continue;
+      }
+
+      tileTypes[(type & hextileSubrectsColoured) ? 3 : 2]++;
+      int n = *d++;
+      for (int i = 0; i < n; i++) {
+        const rdr::U8* colour = fg;
+        if (type & hextileSubrectsColoured) {
+          colour = d;
+          d += bytes;
+        }
+        int sx = *d >> 4, sy = *d++ & 15;
+        int sw = (*d >> 4) + 1, sh = (*d++ & 15) + 1;
+        if (sx + sw > tw || sy + sh > th)
+          return false;
+        for (y = 0; y < sh; y++)
+          for (x = 0; x < sw; x++)
+            memcpy(out + ((ty + sy + y) * WIDTH + tx + sx + x) * bytes,
+                   colour, bytes);
+      }
+      if (d > end) return false;
+    }
+  }
+  return d == end;
+}
+
+static bool run(int bpp, const rdr::U32* desktop, int iterations,
+                bool direct)
+{
+  int bytes = bpp / 8;
+  rdr::U8* fb = new rdr::U8[WIDTH * HEIGHT * bytes];
+  rdr::U8* out = new rdr::U8[WIDTH * HEIGHT * bytes];
+  for (int i = 0; i < WIDTH * HEIGHT; i++)
+    putPixel(fb + i * bytes, bytes, desktop[i]);
+  BenchImageGetter ig(fb, bytes, direct);
+
+  ConnParams cp;
+  cp.setPF(formatForBpp(bpp));
+  rdr::U32 encodings[1] = { encodingHextile };
+  cp.setEncodings(1, encodings);
+
+  Rect rects[2] = { Rect(0, 0, WIDTH, HEIGHT), Rect(53, 37, 654, 370) };
+  bool ok = true;
+  for (int k = 0; k < 2; k++) {
+    rdr::MemOutStream os(1 << 22);
+    SMsgWriterV3 writer(&cp, &os);
+    double best = 1e9;
+    for (int i = 0; i < iterations; i++) {
+      os.clear();
+      Rect actual;
+      double start = benchmarkSeconds();
+      writer.writeRect(rects[k], encodingHextile, &ig, &actual);
+      double t = benchmarkSeconds() - start;
+      if (t < best) best = t;
+    }
+
+    // Skip the rectangle header.
+    const rdr::U8* data = (const rdr::U8*)os.data() + 12;
+    const rdr::U8* end = (const rdr::U8*)os.data() + os.length();
+    int tileTypes[4] = { 0, 0, 0, 0 };
+    memset(out, 0x5a, WIDTH * HEIGHT * bytes);
+    bool decoded = decode(data, end, out, bytes, rects[k], tileTypes);
+    for (int y = rects[k].tl.y; decoded && y < rects[k].br.y; y++) {
+      int offset = (y * WIDTH + rects[k].tl.x) * bytes;
+      if (memcmp(out + offset, fb + offset, rects[k].width() * bytes) != 0)
+        decoded = false;
+    }
+    if (!decoded) ok = false;
+
+    printf("%2dbpp %4dx%-3d %7d bytes %7.3f ms  tiles: raw %d, solid %d, "
+           "mono %d, coloured %d%s\n", bpp, rects[k].width(),
+           rects[k].height(), (int)(end - data), best * 1000, tileTypes[0],
+           tileTypes[1], tileTypes[2], tileTypes[3],
+           decoded ? "" : "  DECODE MISMATCH");
+  }
+
+  delete [] fb;
+  delete [] out;
+  return ok;
+}
+
+int hextileBenchmark(int argc, char** argv)
+{
+  int iterations = argc > 0 ? atoi(argv[0]) : 20;
+  bool direct = !(argc > 1 && strcmp(argv[1], "buf") == 0);
+  if (iterations <= 0) {
+    fprintf(stderr, "hextile: bad number of iterations\n");
+    return 1;
+  }
+
+  rdr::U32* desktop = new rdr::U32[WIDTH * HEIGHT];
+  makeDesktop(desktop);
+  bool ok = (run(32, desktop, iterations, direct) &&
+             run(16, desktop, iterations, direct) &&
+             run(8, desktop, iterations, direct));
+  delete [] desktop;
+  return ok ? 0 : 1;
+}
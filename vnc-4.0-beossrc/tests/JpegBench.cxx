@@ -0,0 +1,182 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- JpegBench.cxx
+//
+// Compares Tight's JPEG subencoding with ZRLE on a small corpus of synthetic
+// photographs, made from layers of smoothed noise with some grain added, at
+// different scales.  Each one is sent as a single 1024x768 rectangle of 32bpp
+// pixels through SMsgWriterV3: with ZRLE, with Tight without a quality level,
+// which is lossless, and with Tight at each of the given quality levels.  It
+// reports the size of the data, the best time, and how much of the picture
+// Tight sent as JPEG.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <rdr/MemOutStream.h>
+#include <rfb/ConnParams.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SMsgWriterV3.h>
+#include <rfb/encodings.h>
+#include "benchmarks.h"
+
+using namespace rfb;
+
+#define WIDTH 1024
+#define HEIGHT 768
+#define RUNS 5
+
+struct Photo {
+  const char* name;
+  double scale;   // size in pixels of the largest features
+  int octaves;    // layers of finer and finer detail
+  double grain;   // amount of noise added to each pixel
+};
+
+static const Photo photos[] = {
+  { "landscape", 160, 5, 6 },
+  { "grainy", 160, 5, 48 },
+  { "detailed", 24, 4, 12 },
+  { "soft", 300, 3, 2 },
+};
+
+static rdr::U32 randomSeed = 12345;
+
+static rdr::U32 nextRandom()
+{
+  randomSeed = randomSeed * 1103515245 + 12345;
+  return randomSeed >> 8;
+}
+
+// lattice() gives a value between 0 and 1 for each point of a grid, and
+// smoothNoise() interpolates between them.
+
+static double lattice(int x, int y, int seed)
+{
+  rdr::U32 h = ((rdr::U32)x * 73856093) ^ ((rdr::U32)y * 19349663) ^
+               ((rdr::U32)seed * 83492791);
+  return (double)((h * 2654435761U) >> 8) / 16777216.0;
+}
+
+static double smoothNoise(double x, double y, int seed)
+{
+  int xi = (int)x, yi = (int)y;
+  double fx = x - xi, fy = y - yi;
+  fx = fx * fx * (3 - 2 * fx);
+  fy = fy * fy * (3 - 2 * fy);
+  double top = (lattice(xi, yi, seed) * (1 - fx) +
+                lattice(xi + 1, yi, seed) * fx);
+  double bottom = (lattice(xi, yi + 1, seed) * (1 - fx) +
+                   lattice(xi + 1, yi + 1, seed) * fx);
+  return top * (1 - fy) + bottom * fy;
+}
+
+static void makePhoto(const Photo& photo, int seed, ManagedPixelBuffer* pb)
+{
+  rdr::U32* pixels = (rdr::U32*)pb->data;
+  for (int y = 0; y < HEIGHT; y++) {
+    for (int x = 0; x < WIDTH; x++) {
+      rdr::U32 pixel = 0;
+      for (int c = 0; c < 3; c++) {
+        double v = 0, amplitude = 0.5, f = 1 / photo.scale;
+        for (int o = 0; o < photo.octaves; o++) {
+          v += amplitude * smoothNoise(x * f, y * f, seed * 7 + c * 3 + o);
+          amplitude /= 2;
+          f *= 2;
+        }
+        v = v * 255 + ((int)(nextRandom() % 1000) / 1000.0 - 0.5) *
+                      photo.grain;
+        int component = v < 0 ? 0 : v > 255 ? 255 : (int)v;
+        pixel |= component << (16 - c * 8);
+      }
+      pixels[y * WIDTH + x] = pixel;
+    }
+  }
+}
+
+// encode() sends the whole of pb with the given encoding, and quality
+// level if it isn't -1, and gives the size of the data, the best time in
+// ms, and the percentage of the picture which was sent lossily.
+
+static void encode(ManagedPixelBuffer* pb, unsigned int encoding,
+                   int qualityLevel, int* bytes, double* ms, int* lossy)
+{
+  ConnParams cp;
+  cp.setPF(pb->getPF());
+  rdr::U32 encodings[2] = { encoding, pseudoEncodingQualityLevel0 };
+  int nEncodings = 1;
+  if (qualityLevel >= 0) {
+    encodings[1] += qualityLevel;
+    nEncodings = 2;
+  }
+  cp.setEncodings(nEncodings, encodings);
+
+  rdr::MemOutStream os(1 << 22);
+  SMsgWriterV3 writer(&cp, &os);
+  Rect r = pb->getRect();
+  double best = 1e9;
+  for (int i = 0; i < RUNS; i++) {
+    os.clear();
+    Rect actual;
+    double start = benchmarkSeconds();
+    writer.writeRect(r, encoding, pb, &actual);
+    double t = benchmarkSeconds() - start;
+    if (t < best) best = t;
+  }
+
+  *bytes = os.length();
+  *ms = best * 1000;
+  *lossy = (int)((double)writer.getLossyRegion().get_bounding_rect().area()
+                 * 100 / r.area() + 0.5);
+}
+
+int jpegBenchmark(int argc, char** argv)
+{
+  std::vector<int> levels;
+  for (int i = 0; i < argc; i++) {
+    int level = atoi(argv[i]);
+    if (level < 0 || level > 9) {
+      fprintf(stderr, "jpeg: quality levels go from 0 to 9\n");
+      return 1;
+    }
+    levels.push_back(level);
+  }
+  if (levels.empty())
+    levels.push_back(6);
+
+  PixelFormat pf(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+  ManagedPixelBuffer pb(pf, WIDTH, HEIGHT);
+
+  printf("%dx%d 32bpp, best of %d:\n", WIDTH, HEIGHT, RUNS);
+  printf("                                bytes        ms  JPEG\n");
+  for (unsigned int p = 0; p < sizeof(photos) / sizeof(photos[0]); p++) {
+    makePhoto(photos[p], p, &pb);
+
+    int bytes, lossy;
+    double ms;
+    encode(&pb, encodingZRLE, -1, &bytes, &ms, &lossy);
+    printf("%-10s ZRLE              %9d %9.2f\n", photos[p].name, bytes, ms);
+    encode(&pb, encodingTight, -1, &bytes, &ms, &lossy);
+    printf("%-10s Tight lossless    %9d %9.2f\n", "", bytes, ms);
+    for (unsigned int i = 0; i < levels.size(); i++) {
+      encode(&pb, encodingTight, levels[i], &bytes, &ms, &lossy);
+      printf("%-10s Tight quality %d   %9d %9.2f  %3d%%\n", "", levels[i],
+             bytes, ms, lossy);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SocketBench.cxx
+//
+// Drives VNCServerST with many client connections, to show how the cost of
+// each socket event grows with the number of clients.  The connections are
+// socketpairs whose far ends never send anything, so each client sits
+// waiting for the protocol version, and processSocketEvent() does the lookup
+// and a read which finds nothing.  Closing the far ends then times the
+// disconnects, again through processSocketEvent().
+//
+// The clients are added up front, so the process needs two descriptors per
+// connection.  It raises its limit as far as it may, and stops short if it
+// still runs out.  The server's streams wait on their descriptors with
+// select(), so those must be below FD_SETSIZE, as they must in the server;
+// the far ends are moved above it to leave room.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#if !defined(__BEOS__) || defined(__HAIKU__)
+#include <sys/select.h>
+#endif
+#include <vector>
+#include <network/Socket.h>
+#include <network/EventLoop.h>
+#include <rfb/SDesktop.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/util.h>
+#include "benchmarks.h"
+
+using namespace rfb;
+
+class BenchSocket : public network::Socket {
+public:
+  BenchSocket(int fd) : network::Socket(fd) {}
+  virtual ~BenchSocket() { close(getFd()); }
+  virtual void shutdown() { ::shutdown(getFd(), 2); }
+  virtual char* getMyAddress() { return strDup("local"); }
+  virtual int getMyPort() { return 0; }
+  virtual char* getMyEndpoint() { return strDup("local::0"); }
+  virtual char* getPeerAddress() { return strDup("local"); }
+  virtual int getPeerPort() { return 0; }
+  virtual char* getPeerEndpoint() { return strDup("local::0"); }
+  virtual bool sameMachine() { return true; }
+};
+
+class BenchDesktop : public SStaticDesktop {
+public:
+  BenchDesktop(const Point& size) : SStaticDesktop(size), size_(size) {}
+  virtual Point getFbSize() { return size_; }
+private:
+  Point size_;
+};
+
+// Each figure is the total over about EVENTS_PER_RUN events, best of RUNS.
+
+#define EVENTS_PER_RUN 20000
+#define RUNS 5
+
+static void raiseDescriptorLimit()
+{
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+static void runWithClients(int nWanted)
+{
+  BenchDesktop desktop(Point(64, 64));
+  VNCServerST server("vncbench", &desktop);
+
+  std::vector<network::Socket*> socks;
+  std::vector<int> peers;
+  while ((int)socks.size() < nWanted) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+      perror("socketpair");
+      break;
+    }
+    int peer = fcntl(sv[1], F_DUPFD, FD_SETSIZE);
+    close(sv[1]);
+    if (peer < 0 || sv[0] >= FD_SETSIZE) {
+      if (peer < 0)
+        perror("fcntl");
+      else
+        fprintf(stderr, "out of descriptors below FD_SETSIZE\n");
+      close(sv[0]);
+      if (peer >= 0) close(peer);
+      break;
+    }
+    network::Socket* sock = new BenchSocket(sv[0]);
+    server.addClient(sock);
+    socks.push_back(sock);
+    peers.push_back(peer);
+  }
+  int n = socks.size();
+  if (!n) return;
+
+  int rounds = EVENTS_PER_RUN / n + 1;
+  double bestSocket = 1e9, bestFd = 1e9;
+  for (int run = 0; run < RUNS; run++) {
+    double start = benchmarkSeconds();
+    for (int r = 0; r < rounds; r++)
+      for (int i = 0; i < n; i++)
+        server.processSocketEvent(socks[i]);
+    double socketTime = benchmarkSeconds() - start;
+    if (socketTime < bestSocket) bestSocket = socketTime;
+
+    start = benchmarkSeconds();
+    for (int r = 0; r < rounds; r++)
+      for (int i = 0; i < n; i++)
+        server.processEvent(socks[i]->getFd(), network::EventLoop::Read);
+    double fdTime = benchmarkSeconds() - start;
+    if (fdTime < bestFd) bestFd = fdTime;
+  }
+
+  for (int i = 0; i < n; i++)
+    close(peers[i]);
+  int left = 0;
+  double start = benchmarkSeconds();
+  for (int i = 0; i < n; i++) {
+    if (server.processSocketEvent(socks[i]))
+      left++;
+  }
+  double disconnectTime = benchmarkSeconds() - start;
+
+  printf("%5d clients: processSocketEvent %6.2f us, processEvent %6.2f us, "
+         "disconnect %6.2f us", n, bestSocket * 1e6 / (rounds * n),
+         bestFd * 1e6 / (rounds * n), disconnectTime * 1e6 / n);
+  if (left)
+    printf(" (%d still connected)", left);
+  printf("\n");
+}
+
+int socketBenchmark(int argc, char** argv)
+{
+  static const int defaultCounts[] = { 10, 100, 1000 };
+
+  raiseDescriptorLimit();
+  if (argc == 0) {
+    for (int i = 0; i < 3; i++)
+      runWithClients(defaultCounts[i]);
+  }
+  for (int i = 0; i < argc; i++)
+    runWithClients(atoi(argv[i]));
+  return 0;
+}
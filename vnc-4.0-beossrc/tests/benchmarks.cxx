@@ -0,0 +1,96 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- benchmarks.cxx
+//
+// vncbench runs the benchmarks for the server's inner loops, which don't
+// need a screen or a network.  Build it with:
+//   jam -da -q -fJambase -fJamfile-benchmarks
+// and run "vncbench <benchmark> [arguments]".  With no arguments it lists
+// them.  Arguments of the form Name=value set server parameters, such as
+// UseSIMD=0 to time the plain C kernels.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <rdr/Exception.h>
+#include <rfb/Configuration.h>
+#include "benchmarks.h"
+
+struct Benchmark {
+  const char* name;
+  const char* args;
+  const char* description;
+  int (*run)(int argc, char** argv);
+};
+
+static const Benchmark benchmarks[] = {
+  { "compare", "[width height bpp]",
+    "ComparingUpdateTracker::compare() over a whole framebuffer",
+    compareBenchmark },
+  { "hextile", "[iterations [buf]]",
+    "the Hextile encoder on a synthetic desktop",
+    hextileBenchmark },
+  { "jpeg", "[quality levels...]",
+    "Tight with JPEG against ZRLE on synthetic photographs",
+    jpegBenchmark },
+  { "sockets", "[connections...]",
+    "VNCServerST events and disconnects with many clients",
+    socketBenchmark },
+};
+
+static const int nBenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+double benchmarkSeconds()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char** argv)
+{
+  int nArgs = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strchr(argv[i], '=')) {
+      if (!rfb::Configuration::setParam(argv[i])) {
+        fprintf(stderr, "unknown parameter %s\n", argv[i]);
+        return 1;
+      }
+    } else {
+      argv[nArgs++] = argv[i];
+    }
+  }
+  argc = nArgs;
+
+  for (int i = 0; argc > 1 && i < nBenchmarks; i++) {
+    if (strcmp(argv[1], benchmarks[i].name) != 0)
+      continue;
+    try {
+      return benchmarks[i].run(argc - 2, argv + 2);
+    } catch (rdr::Exception& e) {
+      fprintf(stderr, "%s: %s\n", benchmarks[i].name, e.str());
+      return 1;
+    }
+  }
+
+  fprintf(stderr, "usage: %s [Name=value...] <benchmark> [arguments]\n",
+          argv[0]);
+  for (int i = 0; i < nBenchmarks; i++)
+    fprintf(stderr, "  %s %s\n      %s\n", benchmarks[i].name,
+            benchmarks[i].args, benchmarks[i].description);
+  return 1;
+}
@@ -0,0 +1,34 @@
+/* This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- benchmarks.h
+//
+// The benchmarks vncbench runs.  Each is given the arguments after its name
+// on the command line, prints its timings and returns the exit status.  They
+// time wall clock seconds and take the best of several runs, so run them on
+// an otherwise idle machine.
+
+#ifndef __TESTS_BENCHMARKS_H__
+#define __TESTS_BENCHMARKS_H__
+
+double benchmarkSeconds();
+
+int compareBenchmark(int argc, char** argv);
+int hextileBenchmark(int argc, char** argv);
+int jpegBenchmark(int argc, char** argv);
+int socketBenchmark(int argc, char** argv);
+
+#endif